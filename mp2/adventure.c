@@ -37,6 +37,7 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,6 +48,7 @@
 #include "input.h"
 #include "modex.h"
 #include "photo.h"
+#include "render.h"
 #include "text.h"
 #include "world.h"
 
@@ -66,6 +68,9 @@ static int sanity_check (void);
 #define TICK_USEC      50000 /* tick length in microseconds          */
 #define STATUS_MSG_LEN 40    /* maximum length of status message     */
 #define MOTION_SPEED   2     /* pixels moved per command             */
+#define MAX_HELD_SPEED 16    /* fastest motion while direction held  */
+#define ACCEL_MOVES    4     /* held moves per MOTION_SPEED speedup  */
+#define HOLD_USEC      150000 /* longest gap between held moves      */
 
 /* outcome of the game */
 typedef enum {GAME_WON, GAME_QUIT} game_condition_t;
@@ -80,6 +85,10 @@ typedef struct {
     unsigned int map_x, map_y;   /* current upper left display pixel      */
     int          x_speed;        /* number of pixels of x motion per move */
     int          y_speed;        /* number of pixels of y motion per move */
+    cmd_t        held_cmd;       /* direction of last move                */
+    int          held_moves;     /* moves in that direction since it was  */
+    				 /*    first pressed                      */
+    struct timeval held_time;    /* time of last move                     */
 } game_info_t;
 
 
@@ -139,15 +148,18 @@ static const typed_cmd_t cmd_list[] = {
 
 static void cancel_status_thread (void* ignore);
 static void cancel_tux_thread(void* ignore);
+static int32_t change_room (tc_action_t (*move_fn) (room_t**));
 static game_condition_t game_loop (void);
 static int32_t handle_typing (void);
+static int held_speed (cmd_t dir, int speed);
 static void init_game (void);
+static void lock_cancelable (pthread_mutex_t* lock);
 static void move_photo_down (void);
 static void move_photo_left (void);
 static void move_photo_right (void);
 static void move_photo_up (void);
-static void redraw_room (void);
 static void* status_thread (void* ignore);
+static void unlock_mutex (void* lock);
 static int time_is_after (struct timeval* t1, struct timeval* t2);
 static void* tux_thread (void* ignore);
 
@@ -170,11 +182,20 @@ static int prev_time = -1;
  * acquired before reading or writing the message.  Further, if the message
  * is changed, the helper thread must be notified by signaling it with the 
  * condition variable msg_cv (while holding the msg_lock).
+ *
+ * The render thread (see render.c) does all drawing, and holds world_lock
+ * while it reads rooms and objects to draw them; the game loop and the 
+ * Tux thread hold world_lock while they change the world, but never 
+ * while queueing commands for the render thread.  cmd_lock keeps the two
+ * threads from handling commands at the same time.  The Tux thread takes
+ * both locks with lock_cancelable, so that it can be cancelled while 
+ * waiting for either.
  */
 static pthread_t status_thread_id;
 static pthread_t tux_thread_id;
 static pthread_mutex_t msg_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t world_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  msg_cv = PTHREAD_COND_INITIALIZER;
 static char status_msg[STATUS_MSG_LEN + 1] = {'\0'};
 
@@ -196,8 +217,12 @@ cancel_status_thread (void* ignore)
 
 /* 
  * cancel_tux_thread
- *   DESCRIPTION: Terminates the tux helper thread.  Used as
- *                a cleanup method to ensure proper shutdown.
+ *   DESCRIPTION: Terminates the tux helper thread and waits for it to
+ *                end, so that it queues no more commands for the render
+ *                thread.  Used as a cleanup method to ensure proper 
+ *                shutdown.  The tux thread takes its locks with 
+ *                lock_cancelable, so the wait ends even if the caller
+ *                holds one of them.
  *   INPUTS: none (ignored)
  *   OUTPUTS: none
  *   RETURN VALUE: none
@@ -207,8 +232,72 @@ static void
 cancel_tux_thread (void* ignore)
 {
     (void)pthread_cancel (tux_thread_id);
+    (void)pthread_join (tux_thread_id, NULL);
 }
 
+/* 
+ * lock_cancelable
+ *   DESCRIPTION: Acquire a lock, letting the calling thread be cancelled
+ *                while it waits even if it has disabled cancellation.
+ *                The tux thread takes its locks this way so that 
+ *                cancel_tux_thread cannot wait forever on a thread that
+ *                is itself waiting for a lock held by the canceller.
+ *   INPUTS: lock -- the lock to acquire
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: acquires the lock, or ends the thread if cancelled
+ */
+static void
+lock_cancelable (pthread_mutex_t* lock)
+{
+    int old_state; /* caller's cancellation state */
+
+    while (0 != pthread_mutex_trylock (lock)) {
+	(void)pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, &old_state);
+	pthread_testcancel ();
+	(void)pthread_setcancelstate (old_state, NULL);
+	(void)sched_yield ();
+    }
+}
+
+/* 
+ * unlock_mutex
+ *   DESCRIPTION: Release a lock.  Used as a thread cleanup handler, so
+ *                that a thread cancelled while holding the lock 
+ *                releases it.
+ *   INPUTS: lock -- the lock to release
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: releases the lock
+ */
+static void
+unlock_mutex (void* lock)
+{
+    (void)pthread_mutex_unlock ((pthread_mutex_t*)lock);
+}
+
+/* 
+ * change_room
+ *   DESCRIPTION: Try to move the player to another room, holding the 
+ *                world lock so that the render thread does not draw 
+ *                while the world changes.
+ *   INPUTS: move_fn -- the move to try (try_to_move_left, for example)
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the player's room changes, 0 otherwise
+ *   SIDE EFFECTS: may move the player
+ */
+static int32_t
+change_room (tc_action_t (*move_fn) (room_t**))
+{
+    tc_action_t result; /* result of the move */
+
+    lock_cancelable (&world_lock);
+    result = (*move_fn) (&game_info.where);
+    (void)pthread_mutex_unlock (&world_lock);
+    return (TC_CHANGE_ROOM == result);
+}
+
+
 /* 
  * game_loop
  *   DESCRIPTION: Main event loop for the adventure game.
@@ -250,30 +339,30 @@ game_loop ()
     /* The main event loop. */
     while (1) {
 	/* 
-	 * Update the screen, preparing the VGA palette and photo-drawing
-	 * routines and drawing a new room photo first if the player has
-	 * entered a new room, then showing the screen (and status bar,
-	 * once you have it working).
+	 * Update the screen: have the render thread prepare the VGA 
+	 * palette and photo-drawing routines and draw a new room photo 
+	 * first if the player has entered a new room, then redraw the
+	 * status bar.  The render thread shows the screen once it has
+	 * run the commands queued.
 	 */
 	if (enter_room) {
 	    /* Reset the view window to (0,0). */
 	    game_info.map_x = game_info.map_y = 0;
-	    set_view_window (game_info.map_x, game_info.map_y);
 
 	    /* Discard any partially-typed command. */
 	    reset_typed_command ();
-	    
-	    /* Adjust colors and photo drawing for the current room photo. */
-	    prep_room (game_info.where);
 
-	    /* Draw the room (calls show. */
-	    redraw_room ();
+	    /* Keep this room's photo and start reading its neighbors'. */
+	    prefetch_room_photos (game_info.where);
+	    
+	    /* Adjust colors and photo drawing, and draw the room. */
+	    render_enter_room (game_info.where);
 
 	    /* Only draw once on entry. */
 	    enter_room = 0;
 		
 		/*reset the background*/
-		show_status_bar (" ", 3);
+		render_status (" ", 3);
 		
 	}
 
@@ -282,13 +371,13 @@ game_loop ()
 	/*check if the input has changed*/
 	if(strcmp(last_type, get_typed_command()))
 	{
-		show_status_bar (" ", 3);
+		render_status (" ", 3);
 		strcpy(last_type, get_typed_command());
 	}
 	/*check if we need to print the status message*/	
 	if(status_msg[0] != '\0')
 	{
-		show_status_bar (status_msg, 0);	
+		render_status (status_msg, 0);	
 		status_just_gone = 1;
 	}
 	else
@@ -296,22 +385,21 @@ game_loop ()
 		/*check if the status message has just disappeared, i.e. need to reset the background*/
 		if(status_just_gone)
 		{
-			show_status_bar (" ", 3);
+			render_status (" ", 3);
 			status_just_gone = 0;
 		}
 		/*show the room name*/
-		show_status_bar (room_name (game_info.where), 1);
+		render_status (room_name (game_info.where), 1);
 		/*get the latest command*/
 		const char * cmd = get_typed_command ();
 		while (' ' == *cmd) { cmd++; }
 		if ('\0' != *cmd)
-			show_status_bar (get_typed_command (), 2);
+			render_status (get_typed_command (), 2);
 		else
-			show_status_bar ("_", 2);
+			render_status ("_", 2);
 	}
 	(void)pthread_mutex_unlock (&msg_lock);
 	/*end of the critical section*/
-	show_screen ();
 
 	/*
 	 * Wait for tick.  The tick defines the basic timing of our
@@ -369,18 +457,15 @@ game_loop ()
 	    case CMD_DOWN:  move_photo_up ();    break;
 	    case CMD_LEFT:  move_photo_right (); break;
 	    case CMD_MOVE_LEFT:   
-		enter_room = (TC_CHANGE_ROOM == 
-			      try_to_move_left (&game_info.where));
+		enter_room = change_room (try_to_move_left);
 		break;
 	    case CMD_ENTER:
-		enter_room = (TC_CHANGE_ROOM ==
-			      try_to_enter (&game_info.where));
+		enter_room = change_room (try_to_enter);
 		break;
 	    case CMD_MOVE_RIGHT:
-		enter_room = (TC_CHANGE_ROOM == 
-			      try_to_move_right (&game_info.where));
+		enter_room = change_room (try_to_move_right);
 		break;
-	    case CMD_QUIT: return GAME_QUIT;
+	    case CMD_QUIT: game = GAME_QUIT; break;
 	    default: break;
 	}
 	(void)pthread_mutex_unlock (&cmd_lock);
@@ -451,7 +536,11 @@ handle_typing ()
 	/* Compare the prefix of the command with the typed verb. */
         if (0 != strncasecmp (cmd_list[idx].name, cmd, cmd_len)) { continue; }
 
-	/* Execute the command found. */
+	/* 
+	 * Execute the command found, holding the world lock so that the
+	 * render thread does not draw while objects move.
+	 */
+	(void)pthread_mutex_lock (&world_lock);
 	switch (cmd_list[idx].cmd) {
 	    case TC_BUY:
 	        result = typed_cmd_buy (&game_info.where, arg);
@@ -512,6 +601,7 @@ handle_typing ()
 		result = TC_ALLOW_EDIT;
 	        break;
 	}
+	(void)pthread_mutex_unlock (&world_lock);
 
 	/* Handle command result and return. */
 	if (TC_CHANGE_ROOM == result) {
@@ -520,7 +610,7 @@ handle_typing ()
 	if (TC_ALLOW_EDIT != result) {
 	    reset_typed_command ();
 	    if (TC_REDRAW_ROOM == result) {
-	        redraw_room ();
+	        render_redraw ();
 	    }
 	}
 	return 0;
@@ -549,152 +639,170 @@ init_game ()
     game_info.map_y = 0;
     game_info.x_speed = MOTION_SPEED;
     game_info.y_speed = MOTION_SPEED;
+    game_info.held_cmd = CMD_NONE;
+    game_info.held_moves = 0;
+}
+
+
+/* 
+ * held_speed
+ *   DESCRIPTION: Calculate the speed of a move, which grows while the
+ *                player holds the same direction: every ACCEL_MOVES 
+ *                moves made in one direction, with no more than 
+ *                HOLD_USEC between them, add MOTION_SPEED pixels per 
+ *                move, up to MAX_HELD_SPEED.  A move in another 
+ *                direction, or a pause, starts again from the base
+ *                speed.  The exposed band is drawn in one strip however
+ *                wide it is, so faster moves cost no more per line.
+ *   INPUTS: dir -- direction of the move (the command given)
+ *           speed -- base speed for the axis of the move
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of pixels to move
+ *   SIDE EFFECTS: records the move in game_info
+ */
+static int
+held_speed (cmd_t dir, int speed)
+{
+    struct timeval now; /* time of this move           */
+    long           gap; /* time since last move (usec) */
+
+    (void)gettimeofday (&now, NULL);
+    gap = (now.tv_sec - game_info.held_time.tv_sec) * 1000000L + 
+          (now.tv_usec - game_info.held_time.tv_usec);
+    if (dir == game_info.held_cmd && HOLD_USEC >= gap) {
+	game_info.held_moves++;
+    } else {
+	game_info.held_cmd = dir;
+	game_info.held_moves = 0;
+    }
+    game_info.held_time = now;
+
+    /* Speed up, but never slow a player who is already faster. */
+    if (MAX_HELD_SPEED <= speed) {
+	return speed;
+    }
+    speed += MOTION_SPEED * (game_info.held_moves / ACCEL_MOVES);
+    return (MAX_HELD_SPEED < speed ? MAX_HELD_SPEED : speed);
 }
 
 
 /* 
  * move_photo_down
  *   DESCRIPTION: Move background photo down one or more pixels.  Amount of
- *                motion depends on game_info.y_speed.  Movement stops at
- *                upper edge of photo.
+ *                motion depends on game_info.y_speed and on how long
+ *                the direction has been held (see held_speed).  Movement
+ *                stops at upper edge of photo.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: shifts view window
+ *   SIDE EFFECTS: queues a shift of the view window
  */
 static void
 move_photo_down ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
+    int32_t speed; /* Pixels to move if photo allows.    */
 
     /* Calculate the number of pixels by which to move. */
-    delta = (game_info.y_speed > game_info.map_y ?
-	     game_info.map_y : game_info.y_speed);
+    speed = held_speed (CMD_UP, game_info.y_speed);
+    delta = (speed > game_info.map_y ? game_info.map_y : speed);
 
     /* Shift the logical view upward. */
     game_info.map_y -= delta;
-    set_view_window (game_info.map_x, game_info.map_y);
 
-    /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-	(void)draw_horiz_line (idx);
-    }
+    /* Have the render thread draw the newly exposed lines. */
+    render_view (game_info.map_x, game_info.map_y);
 }
 
 
 /* 
  * move_photo_left
  *   DESCRIPTION: Move background photo left one or more pixels.  Amount of
- *                motion depends on game_info.x_speed.  Movement stops at
- *                right edge of photo.
+ *                motion depends on game_info.x_speed and on how long
+ *                the direction has been held (see held_speed).  Movement
+ *                stops at right edge of photo.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: shifts view window
+ *   SIDE EFFECTS: queues a shift of the view window
  */
 static void
 move_photo_left ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
+    int32_t speed; /* Pixels to move if photo allows.    */
 
     /* Calculate the number of pixels by which to move. */
+    speed = held_speed (CMD_RIGHT, game_info.x_speed);
     delta = room_photo_width (game_info.where) - SCROLL_X_DIM -
     	    game_info.map_x;
-    delta = (game_info.x_speed > delta ? delta : game_info.x_speed);
+    delta = (speed > delta ? delta : speed);
 
     /* Shift the logical view to the right. */
     game_info.map_x += delta;
-    set_view_window (game_info.map_x, game_info.map_y);
 
-    /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-	(void)draw_vert_line (SCROLL_X_DIM - idx);
-    }
+    /* Have the render thread draw the newly exposed lines. */
+    render_view (game_info.map_x, game_info.map_y);
 }
 
 
 /* 
  * move_photo_right
  *   DESCRIPTION: Move background photo right one or more pixels.  Amount of
- *                motion depends on game_info.x_speed.  Movement stops at
- *                left edge of photo.
+ *                motion depends on game_info.x_speed and on how long
+ *                the direction has been held (see held_speed).  Movement
+ *                stops at left edge of photo.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: shifts view window
+ *   SIDE EFFECTS: queues a shift of the view window
  */
 static void
 move_photo_right ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over columns to redraw.      */
+    int32_t speed; /* Pixels to move if photo allows.    */
 
     /* Calculate the number of pixels by which to move. */
-    delta = (game_info.x_speed > game_info.map_x ?
-	     game_info.map_x : game_info.x_speed);
+    speed = held_speed (CMD_LEFT, game_info.x_speed);
+    delta = (speed > game_info.map_x ? game_info.map_x : speed);
 
     /* Shift the logical view to the left. */
     game_info.map_x -= delta;
-    set_view_window (game_info.map_x, game_info.map_y);
 
-    /* Draw the newly exposed lines. */
-    for (idx = 0; delta > idx; idx++) {
-	(void)draw_vert_line (idx);
-    }
+    /* Have the render thread draw the newly exposed lines. */
+    render_view (game_info.map_x, game_info.map_y);
 }
 
 
 /* 
  * move_photo_up
  *   DESCRIPTION: Move background photo up one or more pixels.  Amount of
- *                motion depends on game_info.y_speed.  Movement stops at
- *                lower edge of photo.
+ *                motion depends on game_info.y_speed and on how long
+ *                the direction has been held (see held_speed).  Movement
+ *                stops at lower edge of photo.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: shifts view window
+ *   SIDE EFFECTS: queues a shift of the view window
  */
 static void
 move_photo_up ()
 {
     int32_t delta; /* Number of pixels by which to move. */
-    int32_t idx;   /* Index over rows to redraw.         */
+    int32_t speed; /* Pixels to move if photo allows.    */
 
     /* Calculate the number of pixels by which to move. */
+    speed = held_speed (CMD_DOWN, game_info.y_speed);
     delta = room_photo_height (game_info.where) - SCROLL_Y_DIM - 
     	    game_info.map_y;
-    delta = (game_info.y_speed > delta ? delta : game_info.y_speed);
+    delta = (speed > delta ? delta : speed);
 
     /* Shift the logical view upward. */
     game_info.map_y += delta;
-    set_view_window (game_info.map_x, game_info.map_y);
-
-    /* Draw the newly exposed lines. */
-    for (idx = 1; delta >= idx; idx++) {
-	(void)draw_horiz_line (SCROLL_Y_DIM - idx);
-    }
-}
-
-
-/* 
- * redraw_room
- *   DESCRIPTION: Draw all lines on the screen.
- *   INPUTS: none
- *   OUTPUTS: none
- *   RETURN VALUE: none
- *   SIDE EFFECTS: Draws the entire screen (but not the status bar).
- */
-static void
-redraw_room ()
-{
-    int32_t i; /* index over rows */
 
-    /* Draw all lines in the scroll region. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) {
-	(void)draw_horiz_line (i);
-    }
+    /* Have the render thread draw the newly exposed lines. */
+    render_view (game_info.map_x, game_info.map_y);
 }
 
 
@@ -783,6 +891,11 @@ tux_thread (void* ignore)
 
     struct timeval cur_time; /* current time (during tick)      */
 
+    /* 
+     * Only allow cancellation between ticks, when the thread holds no
+     * locks and is not queueing a command for the render thread.
+     */
+    (void)pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
 
     /* Record the starting time--assume success. */
     (void)gettimeofday (&start_time, NULL);
@@ -796,7 +909,9 @@ tux_thread (void* ignore)
 
 	while(1)
 	{
-		(void)pthread_mutex_lock (&cmd_lock);
+	/* If cancelled while waiting for world_lock, release cmd_lock. */
+	lock_cancelable (&cmd_lock);
+	pthread_cleanup_push (unlock_mutex, &cmd_lock);
     
     cmd = get_tux_command ();
 	switch (cmd) 
@@ -806,23 +921,20 @@ tux_thread (void* ignore)
 	    case CMD_DOWN:  move_photo_up ();    break;
 	    case CMD_LEFT:  move_photo_right (); break;
 	    case CMD_MOVE_LEFT:   
-		enter_room = (TC_CHANGE_ROOM == 
-			      try_to_move_left (&game_info.where));
+		enter_room = change_room (try_to_move_left);
 		break;
 	    case CMD_ENTER:
-		enter_room = (TC_CHANGE_ROOM ==
-			      try_to_enter (&game_info.where));
+		enter_room = change_room (try_to_enter);
 		break;
 	    case CMD_MOVE_RIGHT:
-		enter_room = (TC_CHANGE_ROOM == 
-			      try_to_move_right (&game_info.where));
+		enter_room = change_room (try_to_move_right);
 		break;
 		case CMD_QUIT: 
 			game = GAME_QUIT; break;
 	    default: break;
 	}
 
-    (void)pthread_mutex_unlock (&cmd_lock);
+	pthread_cleanup_pop (1);
 	/* If player wins the game, their room becomes NULL. */
 	if (NULL == game_info.where) {
 	    game = GAME_WON;
@@ -833,6 +945,9 @@ tux_thread (void* ignore)
 	 * Wait for tick.  The tick defines the basic timing of our
 	 * event loop, and is the minimum amount of time between events.
 	 */
+	(void)pthread_setcancelstate (PTHREAD_CANCEL_ENABLE, NULL);
+	pthread_testcancel ();
+	(void)pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, NULL);
 	do {
 	    if (gettimeofday (&cur_time, NULL) != 0) 
 		{
@@ -943,14 +1058,6 @@ main ()
 
     open_and_init();
 
-	/* Create tux thread. */
-    if (0 != pthread_create (&tux_thread_id, NULL, tux_thread, NULL)) {
-        PANIC ("failed to create tux thread");
-    }
-    push_cleanup (cancel_tux_thread, NULL); {
-
-
-
     /* Create status message thread. */
     if (0 != pthread_create (&status_thread_id, NULL, status_thread, NULL)) {
         PANIC ("failed to create status thread");
@@ -961,15 +1068,37 @@ main ()
 	if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer)) {
 	    PANIC ("cannot initialize mode X");
 	}
+	set_rect_fill_fn (fill_rect);
+	set_triple_buffering (1);
 	push_cleanup ((cleanup_fn_t)clear_mode_X, NULL); {
 
-	    /* Initialize the keyboard and/or Tux controller. */
-	    if (0 != init_input ()) {
-		PANIC ("cannot initialize input");
+	    /* Start the render thread, which does all drawing from now on. */
+	    if (0 != start_render_thread (&world_lock)) {
+		PANIC ("cannot start render thread");
 	    }
-	    push_cleanup ((cleanup_fn_t)shutdown_input, NULL); {
+	    push_cleanup (stop_render_thread, NULL); {
+
+		/* 
+		 * Create tux thread, which queues commands for the render
+		 * thread, so it must end before the render thread does.
+		 */
+		if (0 != pthread_create (&tux_thread_id, NULL, tux_thread, 
+					 NULL)) {
+		    PANIC ("failed to create tux thread");
+		}
+		push_cleanup (cancel_tux_thread, NULL); {
+
+		    /* Initialize the keyboard and/or Tux controller. */
+		    if (0 != init_input ()) {
+			PANIC ("cannot initialize input");
+		    }
+		    push_cleanup ((cleanup_fn_t)shutdown_input, NULL); {
 
-		game = game_loop ();
+			game = game_loop ();
+
+		    } pop_cleanup (1);
+
+		} pop_cleanup (1);
 
 	    } pop_cleanup (1);
 
@@ -977,8 +1106,6 @@ main ()
 
     } pop_cleanup (1);
 
-	} pop_cleanup (1);
-
     /* Print a message about the outcome. */
     switch (game) {
 	case GAME_WON: printf ("You win the game!  CONGRATULATIONS!\n"); break;
@@ -0,0 +1,1852 @@
+/*									tab:8
+ *
+ * bench.c - timing harness for the ECE391 adventure game (F11 MP2)
+ *
+ * Version:	    1
+ * Filename:	    bench.c
+ * History:
+ *	1	Startup benchmark comparing cached and uncached world
+ *		construction.
+ *	2	Added quantization benchmark over every room photo.
+ *	3	Quantization benchmark compares the reducible octree with
+ *		the fixed palette scheme, including mean squared error.
+ *	4	Added scaling benchmark for threaded quantization.
+ *	5	Added benchmark for drawing a room crowded with objects.
+ *	6	Object drawing benchmark times each blending kernel; added
+ *		check of blending kernels against scalar blending.
+ *	7	Added benchmark for column by column photo copies.
+ *	8	Added benchmark for the room object index.
+ *	9	Added frame rate benchmark for full redraws into the mode X
+ *		build buffer.
+ *	10	Added benchmark for photo and object copies stored by plane.
+ *	11	Added benchmark for drawing scrolled bands as strips.
+ *	12	Added benchmark for diagonal scrolling across a 1024x1024
+ *		map.
+ *	13	Scrolling benchmark times the toroidal build buffer too.
+ *	14	Linked with the headless mode X backend; added benchmark
+ *		for copying frames, the status bar, and the palette to the
+ *		emulated VGA.
+ *	15	Frame copy benchmark times idle frames, frames with one
+ *		object redrawn, and full redraws separately.
+ *	16	Frame copy benchmark reports the bandwidth of each copy
+ *		engine and times full frames with each.
+ *	17	Added frame pacing benchmark for double and triple 
+ *		buffering.
+ *	18	Added benchmark for the time the game loop spends on each
+ *		tick's drawing, with and without the render thread.
+ *	19	Added check of map_to_octree_span against map_to_octree
+ *		for every pixel value and every room photo.
+ *	20	Object benchmark interleaves several timings of each
+ *		method, keeps the best, and compares opaque runs with the
+ *		fastest blending kernel.
+ *	21	Added benchmark comparing a qsort of the level 4 octree 
+ *		nodes with the selection now used by decode_photo.
+ */
+
+/*
+ * This file is a standalone program that times parts of the adventure
+ * game outside of the game loop.  Run it from the mp2 directory (the
+ * image file names in world.c are relative), optionally naming the
+ * benchmarks to run:
+ *
+ *     ./bench [benchmark ...]
+ *
+ * With no arguments, every benchmark is run.  The program is linked with
+ * a headless build of modex.c (see MODEX_HEADLESS there), so it needs 
+ * no VGA.  The Makefile also builds bench_scalar, which is the same 
+ * program linked with a build of photo.c that maps pixels to octree 
+ * nodes without lookup tables (see NO_OCTREE_TABLES there); the 
+ * "octree" check should print the same results for both.
+ */
+
+
+#include <glob.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blend.h"
+#include "modex.h"
+#include "photo.h"
+#include "render.h"
+#include "world.h"
+
+
+/* description of one benchmark */
+typedef struct bench_t bench_t;
+struct bench_t {
+    const char* name;		/* name given on command line */
+    void (*run) (void);		/* function that runs it      */
+    const char* description;	/* one-line summary           */
+};
+
+
+/* 
+ * a level 4 octree node laid out as decode_photo kept it when it sorted 
+ * the nodes with qsort; the sort in bench_select moves these
+ */
+typedef struct ref_node_t ref_node_t;
+struct ref_node_t {
+    uint16_t      idx_by_RGB;      /* index of node in level 4        */
+    uint16_t      idx_in_level_2;  /* index of parent node in level 2 */
+    unsigned long red_sum;         /* sums of pixel colors            */
+    unsigned long green_sum;
+    unsigned long blue_sum;
+    unsigned int  pixel_number;    /* number of pixels in node        */
+    uint16_t      palette_idx;     /* palette entry of node           */
+};
+
+
+/* local functions--see function headers for details */
+static double elapsed_ms (const struct timespec* start);
+static void bench_world (void);
+static int32_t quantize_photo (const char* fname, int32_t n_reps, 
+			       double* ms, double* mse);
+static void bench_quantize (void);
+static uint16_t* read_raw_photo (const char* fname, photo_header_t* hdr);
+static int ref_node_compare (const void* a, const void* b);
+static void bench_select (void);
+static int32_t check_octree_span (const uint16_t* pixels, uint32_t n);
+static void bench_octree (void);
+static int32_t write_synthetic_photo (char* fname);
+static void bench_threads (void);
+static double redraw_room (const room_t* r, int32_t n_frames, 
+			   uint32_t* check);
+static void bench_objects (void);
+static void bench_blend (void);
+static double draw_columns (const room_t* r, int32_t n_frames, 
+			    uint32_t* check);
+static void bench_columns (void);
+static void bench_index (void);
+static void bench_redraw (void);
+static double scroll_lines (room_t* r, int32_t n_passes);
+static void bench_planar (void);
+static double scroll_bands (room_t* r, int32_t speed, int32_t by_strip);
+static void bench_strips (void);
+static void fill_pattern_row (int x, int y, unsigned char buf[SCROLL_X_DIM]);
+static void fill_pattern_col (int x, int y, unsigned char buf[SCROLL_Y_DIM]);
+static void bench_scroll (void);
+static void bench_show (void);
+static void pace_frames (int32_t triple);
+static void bench_pace (void);
+static void tick_frames (int32_t threaded, int32_t triple);
+static void bench_render (void);
+
+
+/* the list of benchmarks */
+static const bench_t bench_list[] = {
+    {"world", bench_world, "build_world with and without photo cache"},
+    {"quantize", bench_quantize, "fixed and reducible octree palettes, uncached"},
+    {"select", bench_select, "128 busiest octree nodes by qsort and by selection"},
+    {"octree", bench_octree, "check map_to_octree_span for all pixels and photos"},
+    {"threads", bench_threads, "read_photo of a 1024x1024 photo on 1-8 threads"},
+    {"objects", bench_objects, "redraw a room holding every object"},
+    {"blend", bench_blend, "check object drawing in every room"},
+    {"columns", bench_columns, "vertical lines with and without column copies"},
+    {"index", bench_index, "redraw rooms of 1-20 objects with and without index"},
+    {"redraw", bench_redraw, "full redraws per second, by lines and by rectangle"},
+    {"planar", bench_planar, "load and scroll costs of copies stored by plane"},
+    {"strips", bench_strips, "scrolling 2-16 pixels per move, by lines and by strips"},
+    {"scroll", bench_scroll, "diagonal scrolling across a 1024x1024 map"},
+    {"show", bench_show, "show_screen, status bar, palette; writes bench.ppm"},
+    {"pace", bench_pace, "frame pacing with double and triple buffering"},
+    {"render", bench_render, "game loop drawing time with and without render thread"},
+    {NULL, NULL, NULL}
+};
+
+
+/*
+ * elapsed_ms
+ *   DESCRIPTION: Calculate the time elapsed since a starting time.
+ *   INPUTS: start -- the starting time (CLOCK_MONOTONIC)
+ *   OUTPUTS: none
+ *   RETURN VALUE: elapsed time in milliseconds
+ *   SIDE EFFECTS: none
+ */
+static double
+elapsed_ms (const struct timespec* start)
+{
+    struct timespec now; /* current time */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((now.tv_sec - start->tv_sec) * 1000.0 +
+	    (now.tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
+
+/*
+ * bench_world
+ *   DESCRIPTION: Time construction of the game world, first quantizing
+ *                every room photo, then mapping the results from the
+ *                quantized photo cache.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes any missing photo cache files; leaks the photos
+ *                 of each world built
+ */
+static void
+bench_world ()
+{
+    struct timespec start; /* start time of one world construction */
+
+    /* Read every photo up front, as the game would with no budget. */
+    set_photo_budget (0);
+    set_photo_cache (0);
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    if (!build_world ()) {
+	return;
+    }
+    printf ("  uncached build_world %10.2f ms\n", elapsed_ms (&start));
+
+    /* Make sure that every cache file exists before timing the cache. */
+    set_photo_cache (1);
+    if (!build_world ()) {
+	return;
+    }
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    if (!build_world ()) {
+	return;
+    }
+    printf ("    cached build_world %10.2f ms\n", elapsed_ms (&start));
+}
+
+
+/*
+ * quantize_photo
+ *   DESCRIPTION: Time the reading of one room photo with the current
+ *                palette selection, and measure the result's error.
+ *   INPUTS: fname -- the photo file
+ *           n_reps -- number of times to read the photo
+ *   OUTPUTS: ms -- average time to read the photo in milliseconds
+ *            mse -- mean squared color error (see photo_mse)
+ *   RETURN VALUE: 1 on success, 0 if the photo cannot be read
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+quantize_photo (const char* fname, int32_t n_reps, double* ms, double* mse)
+{
+    struct timespec start; /* start time of reads */
+    photo_t* p;            /* photo read          */
+    int32_t rep;           /* repetition count    */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (rep = 0; n_reps > rep; rep++) {
+	if (NULL == (p = read_photo (fname))) {
+	    return 0;
+	}
+	if (n_reps - 1 > rep) {
+	    free_photo (p);
+	}
+    }
+    *ms = elapsed_ms (&start) / n_reps;
+    *mse = photo_mse (p, fname);
+    free_photo (p);
+    return 1;
+}
+
+
+/*
+ * bench_quantize
+ *   DESCRIPTION: Time quantization of every room photo in the images
+ *                directory with the quantized photo cache turned off,
+ *                using both the fixed palette scheme and the reducible
+ *                octree with a full 192-color budget, and report the
+ *                mean squared color error of each.  (The choice
+ *                of the octree's level 4 nodes alone is timed by 
+ *                bench_select.)
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: leaves the fixed palette scheme selected
+ */
+static void
+bench_quantize ()
+{
+    static const int32_t n_reps = 10; /* times each photo is read     */
+    glob_t names;                     /* photo file names             */
+    uint32_t idx;                     /* index over photo names       */
+    double fixed_ms, fixed_mse;       /* results for fixed scheme     */
+    double tree_ms, tree_mse;         /* results for reducible octree */
+    double total[4] = {0, 0, 0, 0};   /* sums of the results above    */
+
+    if (0 != glob ("images/*.photo", 0, NULL, &names)) {
+	puts ("  no photos found in images");
+	return;
+    }
+    set_photo_cache (0);
+    printf ("  %-28s %10s %8s %10s %8s\n", "", "fixed ms", "MSE", 
+	    "octree ms", "MSE");
+    for (idx = 0; names.gl_pathc > idx; idx++) {
+	set_palette_budget (0);
+	if (!quantize_photo (names.gl_pathv[idx], n_reps, &fixed_ms, 
+			     &fixed_mse)) {
+	    printf ("  can't read %s\n", names.gl_pathv[idx]);
+	    continue;
+	}
+	set_palette_budget (192);
+	if (!quantize_photo (names.gl_pathv[idx], n_reps, &tree_ms, 
+			     &tree_mse)) {
+	    printf ("  can't read %s\n", names.gl_pathv[idx]);
+	    continue;
+	}
+	printf ("  %-28s %10.3f %8.3f %10.3f %8.3f\n", names.gl_pathv[idx],
+		fixed_ms, fixed_mse, tree_ms, tree_mse);
+	total[0] += fixed_ms;
+	total[1] += fixed_mse;
+	total[2] += tree_ms;
+	total[3] += tree_mse;
+    }
+    if (0 < names.gl_pathc) {
+	printf ("  %-28s %10.3f %8.3f %10.3f %8.3f\n", "all photos (MSE mean)",
+		total[0], total[1] / names.gl_pathc, total[2],
+		total[3] / names.gl_pathc);
+    }
+    set_palette_budget (0);
+    set_photo_cache (1);
+    globfree (&names);
+}
+
+
+/*
+ * read_raw_photo
+ *   DESCRIPTION: Read the 5:6:5 pixels of a room photo file without 
+ *                quantizing them.
+ *   INPUTS: fname -- the photo file
+ *   OUTPUTS: hdr -- the photo dimensions
+ *   RETURN VALUE: a dynamically allocated array of the pixels, or NULL
+ *                 if the file cannot be read
+ *   SIDE EFFECTS: none
+ */
+static uint16_t*
+read_raw_photo (const char* fname, photo_header_t* hdr)
+{
+    FILE*     in;            /* photo file      */
+    uint16_t* pixels = NULL; /* pixels of photo */
+
+    if (NULL == (in = fopen (fname, "rb"))) {
+	return NULL;
+    }
+    if (1 != fread (hdr, sizeof (*hdr), 1, in) ||
+	NULL == (pixels = malloc (hdr->width * hdr->height * 
+				  sizeof (pixels[0]))) ||
+	hdr->width * hdr->height != 
+	    fread (pixels, sizeof (pixels[0]), hdr->width * hdr->height, 
+		   in)) {
+	free (pixels);
+	pixels = NULL;
+    }
+    (void)fclose (in);
+    return pixels;
+}
+
+
+/*
+ * ref_node_compare
+ *   DESCRIPTION: Compare two level 4 octree nodes by pixel count for 
+ *                qsort, putting the busier node first.
+ *   INPUTS: a, b -- pointers to the two nodes
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative if a holds more pixels than b, positive if
+ *                 fewer, or 0 if the same number
+ *   SIDE EFFECTS: none
+ */
+static int
+ref_node_compare (const void* a, const void* b)
+{
+    unsigned int a_count = ((const ref_node_t*)a)->pixel_number;
+    unsigned int b_count = ((const ref_node_t*)b)->pixel_number;
+
+    return (a_count < b_count) - (a_count > b_count);
+}
+
+
+/*
+ * bench_select
+ *   DESCRIPTION: For every room photo in the images directory, count the
+ *                pixels in each level 4 octree node, then time two ways
+ *                of finding the pixel count of the 128th busiest node:
+ *                sorting the nodes with qsort, as decode_photo once did,
+ *                and the selection (kth_largest_count) that it uses now.
+ *                Each way starts from a fresh copy of the nodes or 
+ *                counts, as decode_photo would, and the two counts 
+ *                found are checked against each other.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+bench_select ()
+{
+    static const int32_t n_reps = 1000;  /* times each choice is made */
+    static ref_node_t nodes[OCTREE_LEVEL4_NODES_NUM];  /* counted nodes */
+    static ref_node_t sorted[OCTREE_LEVEL4_NODES_NUM]; /* copy to sort  */
+    static unsigned int counts[OCTREE_LEVEL4_NODES_NUM]; /* copy for    */
+                                                         /* selection   */
+    static uint16_t level_4[65536];      /* level 4 node of each pixel  */
+    glob_t          names;               /* photo file names            */
+    uint32_t        idx;                 /* index over photo names      */
+    uint32_t        i;                   /* index over pixels/nodes     */
+    uint32_t        y;                   /* index over photo rows       */
+    int32_t         rep;                 /* repetition count            */
+    photo_header_t  hdr;                 /* photo dimensions            */
+    uint16_t*       pixels;              /* pixels of one photo         */
+    unsigned int    sort_count;          /* 128th count by qsort        */
+    unsigned int    select_count = 0;    /* 128th count by selection    */
+    double          sort_us, select_us;  /* time per choice             */
+    double          total[2] = {0, 0};   /* sums of the times above     */
+    int32_t         n_bad = 0;           /* number of disagreements     */
+    struct timespec start;               /* start time of choices       */
+
+    if (0 != glob ("images/*.photo", 0, NULL, &names)) {
+	puts ("  no photos found in images");
+	return;
+    }
+    printf ("  %-28s %10s %10s %8s %8s\n", "", "qsort us", "select us",
+	    "speedup", "count");
+    for (idx = 0; names.gl_pathc > idx; idx++) {
+	if (NULL == (pixels = read_raw_photo (names.gl_pathv[idx], &hdr))) {
+	    printf ("  can't read %s\n", names.gl_pathv[idx]);
+	    continue;
+	}
+	memset (nodes, 0, sizeof (nodes));
+	for (i = 0; OCTREE_LEVEL4_NODES_NUM > i; i++) {
+	    nodes[i].idx_by_RGB = i;
+	}
+	for (y = 0; hdr.height > y; y++) {
+	    map_to_octree_span (pixels + y * hdr.width, hdr.width, level_4,
+	    			NULL);
+	    for (i = 0; hdr.width > i; i++) {
+		nodes[level_4[i]].pixel_number++;
+	    }
+	}
+	free (pixels);
+
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	for (rep = 0; n_reps > rep; rep++) {
+	    memcpy (sorted, nodes, sizeof (sorted));
+	    qsort (sorted, OCTREE_LEVEL4_NODES_NUM, sizeof (sorted[0]),
+		   ref_node_compare);
+	}
+	sort_us = elapsed_ms (&start) * 1000.0 / n_reps;
+	sort_count = sorted[OCTREE_LEVEL4_NODES_USED_NUM - 1].pixel_number;
+
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	for (rep = 0; n_reps > rep; rep++) {
+	    for (i = 0; OCTREE_LEVEL4_NODES_NUM > i; i++) {
+		counts[i] = nodes[i].pixel_number;
+	    }
+	    select_count = kth_largest_count (counts, OCTREE_LEVEL4_NODES_NUM,
+					      OCTREE_LEVEL4_NODES_USED_NUM);
+	}
+	select_us = elapsed_ms (&start) * 1000.0 / n_reps;
+
+	if (sort_count != select_count) {
+	    printf ("  %s: qsort found %u, selection found %u\n",
+		    names.gl_pathv[idx], sort_count, select_count);
+	    n_bad++;
+	}
+	printf ("  %-28s %10.2f %10.2f %8.2f %8u\n", names.gl_pathv[idx],
+		sort_us, select_us, sort_us / select_us, select_count);
+	total[0] += sort_us;
+	total[1] += select_us;
+    }
+    if (0 < names.gl_pathc) {
+	printf ("  %-28s %10.2f %10.2f %8.2f\n", "all photos", total[0], 
+		total[1], total[0] / total[1]);
+    }
+    printf ("  %d photos: %d disagreements\n", (int)names.gl_pathc, n_bad);
+    globfree (&names);
+}
+
+
+/*
+ * check_octree_span
+ *   DESCRIPTION: Map a run of pixels to octree nodes with one call to
+ *                map_to_octree_span, and compare the nodes with those
+ *                given by map_to_octree for each pixel.
+ *   INPUTS: pixels -- the 5:6:5 pixels
+ *           n -- the number of pixels (at most 65536)
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of pixels mapped differently
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+check_octree_span (const uint16_t* pixels, uint32_t n)
+{
+    static uint16_t level_4[65536]; /* level 4 node of each pixel */
+    static uint8_t  level_2[65536]; /* level 2 node of each pixel */
+    uint32_t i;                     /* index over pixels          */
+    int32_t  n_bad = 0;             /* number of mismatches       */
+
+    map_to_octree_span (pixels, n, level_4, level_2);
+    for (i = 0; n > i; i++) {
+	if (map_to_octree (pixels[i], 4) != level_4[i] ||
+	    map_to_octree (pixels[i], 2) != level_2[i]) {
+	    n_bad++;
+	}
+    }
+    return n_bad;
+}
+
+
+/*
+ * bench_octree
+ *   DESCRIPTION: Check map_to_octree_span against map_to_octree, first
+ *                for all 65536 pixel values in one run, then for the 
+ *                pixels of every room photo in the images directory, 
+ *                one row at a time as decode_photo maps them.  Each
+ *                photo is then decoded (without the photo cache) with
+ *                the fixed palette scheme, and the mean squared color
+ *                error of the result is printed, so that the output of
+ *                bench and bench_scalar can be compared.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: leaves the photo cache turned off
+ */
+static void
+bench_octree ()
+{
+    static uint16_t all[65536];  /* every 5:6:5 pixel value         */
+    glob_t         names;        /* photo file names                */
+    uint32_t       idx;          /* index over photo names/pixels   */
+    uint32_t       y;            /* index over photo rows           */
+    photo_header_t hdr;          /* photo dimensions                */
+    uint16_t*      pixels;       /* pixels of one photo             */
+    FILE*          in;           /* photo file                      */
+    photo_t*       p;            /* decoded photo                   */
+    int32_t        n_bad;        /* mismatches in one photo         */
+    int32_t        total_bad;    /* mismatches in all photos        */
+
+    for (idx = 0; 65536 > idx; idx++) {
+	all[idx] = idx;
+    }
+    printf ("  all pixel values: %d mismatches\n", 
+	    check_octree_span (all, 65536));
+
+    if (0 != glob ("images/*.photo", 0, NULL, &names)) {
+	puts ("  no photos found in images");
+	return;
+    }
+    set_photo_cache (0);
+    set_palette_budget (0);
+    total_bad = 0;
+    for (idx = 0; names.gl_pathc > idx; idx++) {
+	pixels = NULL;
+	if (NULL == (in = fopen (names.gl_pathv[idx], "rb")) ||
+	    1 != fread (&hdr, sizeof (hdr), 1, in) ||
+	    NULL == (pixels = malloc (hdr.width * hdr.height * 
+	    			      sizeof (pixels[0]))) ||
+	    hdr.width * hdr.height != 
+		fread (pixels, sizeof (pixels[0]), hdr.width * hdr.height, 
+		       in) ||
+	    NULL == (p = read_photo (names.gl_pathv[idx]))) {
+	    printf ("  can't read %s\n", names.gl_pathv[idx]);
+	    free (pixels);
+	    if (NULL != in) {
+		(void)fclose (in);
+	    }
+	    total_bad++;
+	    continue;
+	}
+	(void)fclose (in);
+	n_bad = 0;
+	for (y = 0; hdr.height > y; y++) {
+	    n_bad += check_octree_span (pixels + y * hdr.width, hdr.width);
+	}
+	printf ("  %-28s %8d mismatches  MSE %10.6f\n", names.gl_pathv[idx],
+		n_bad, photo_mse (p, names.gl_pathv[idx]));
+	total_bad += n_bad;
+	free_photo (p);
+	free (pixels);
+    }
+    printf ("  %d photos: %d mismatches or unreadable photos\n", 
+	    (int)names.gl_pathc, total_bad);
+    globfree (&names);
+}
+
+
+/*
+ * write_synthetic_photo
+ *   DESCRIPTION: Write a 1024x1024 room photo file of smooth gradients
+ *                with some noise, so that most octree nodes are used.
+ *                The photo is the same every time.
+ *   INPUTS: fname -- template for the file name, ending in XXXXXX
+ *   OUTPUTS: fname -- the name of the file written
+ *   RETURN VALUE: 1 on success, 0 on failure
+ *   SIDE EFFECTS: creates a file
+ */
+static int32_t
+write_synthetic_photo (char* fname)
+{
+    photo_header_t hdr = {1024, 1024};     /* photo dimensions     */
+    static uint16_t row[1024];             /* one row of pixels    */
+    uint32_t noise = 12345;                /* pseudo-random state  */
+    uint32_t x;                            /* index over columns   */
+    uint32_t y;                            /* index over rows      */
+    uint32_t red, green, blue;             /* color of a pixel     */
+    int fd;                                /* file descriptor      */
+    FILE* out;                             /* output file          */
+
+    if (-1 == (fd = mkstemp (fname))) {
+	return 0;
+    }
+    if (NULL == (out = fdopen (fd, "wb"))) {
+	(void)close (fd);
+	(void)unlink (fname);
+	return 0;
+    }
+    (void)fwrite (&hdr, sizeof (hdr), 1, out);
+    for (y = 0; hdr.height > y; y++) {
+	for (x = 0; hdr.width > x; x++) {
+	    noise = noise * 1103515245 + 12345;
+	    red = ((x >> 5) + ((noise >> 16) & 1)) & 0x1F;
+	    green = ((y >> 4) + ((noise >> 17) & 3)) & 0x3F;
+	    blue = (((x + y) >> 6) + ((noise >> 19) & 1)) & 0x1F;
+	    row[x] = (red << 11) | (green << 5) | blue;
+	}
+	(void)fwrite (row, sizeof (row[0]), hdr.width, out);
+    }
+    if (0 != fclose (out)) {
+	(void)unlink (fname);
+	return 0;
+    }
+    return 1;
+}
+
+
+/*
+ * bench_threads
+ *   DESCRIPTION: Time quantization of a synthetic 1024x1024 room photo
+ *                with the pixel passes split among 1, 2, 4, and 8
+ *                threads.  The error is reported as well, and should be
+ *                the same for every thread count.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes and removes a temporary photo file
+ */
+static void
+bench_threads ()
+{
+    static const uint32_t n_threads[4] = {1, 2, 4, 8}; /* counts to try */
+    static const int32_t n_reps = 5;  /* times photo is read             */
+    char fname[] = "/tmp/bench-photo.XXXXXX"; /* synthetic photo file    */
+    double ms, mse;                   /* results for one thread count    */
+    double base_ms = 0;               /* result for one thread           */
+    uint32_t idx;                     /* index over thread counts        */
+
+    if (!write_synthetic_photo (fname)) {
+	puts ("  can't write synthetic photo");
+	return;
+    }
+    set_photo_cache (0);
+    for (idx = 0; 4 > idx; idx++) {
+	set_quantize_threads (n_threads[idx]);
+	if (!quantize_photo (fname, n_reps, &ms, &mse)) {
+	    puts ("  can't read synthetic photo");
+	    break;
+	}
+	if (0 == idx) {
+	    base_ms = ms;
+	}
+	printf ("  %u thread%s %10.3f ms  speedup %5.2f  MSE %8.3f\n",
+		n_threads[idx], (1 == n_threads[idx] ? " " : "s"), ms,
+		base_ms / ms, mse);
+    }
+    set_quantize_threads (0);
+    set_photo_cache (1);
+    (void)unlink (fname);
+}
+
+
+/*
+ * redraw_room
+ *   DESCRIPTION: Draw every row and every column of the screen for a
+ *                series of views of a room, moving the view over the 
+ *                whole room photo, and time the drawing.
+ *   INPUTS: r -- the room (already prepared with prep_room)
+ *           n_frames -- number of views to draw
+ *   OUTPUTS: check -- checksum of the pixels drawn (not calculated,
+ *                     and not included in the time, if NULL)
+ *   RETURN VALUE: average time to draw one view in milliseconds
+ *   SIDE EFFECTS: none
+ */
+static double
+redraw_room (const room_t* r, int32_t n_frames, uint32_t* check)
+{
+    unsigned char   hbuf[SCROLL_X_DIM]; /* one row of the screen         */
+    unsigned char   vbuf[SCROLL_Y_DIM]; /* one column of the screen      */
+    int32_t         x_range;  /* number of horizontal view positions     */
+    int32_t         y_range;  /* number of vertical view positions       */
+    int32_t         frame;    /* index over views                        */
+    int32_t         x, y;     /* upper left of view                      */
+    int32_t         idx;      /* index over rows/columns of view         */
+    int32_t         pix;      /* index over pixels in row/column         */
+    struct timespec start;    /* start of drawing                        */
+
+    x_range = room_photo_width (r) - SCROLL_X_DIM + 1;
+    y_range = room_photo_height (r) - SCROLL_Y_DIM + 1;
+    if (NULL != check) {
+	*check = 0;
+    }
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (frame = 0; n_frames > frame; frame++) {
+	x = (0 >= x_range ? 0 : (frame * 7) % x_range);
+	y = (0 >= y_range ? 0 : (frame * 5) % y_range);
+	for (idx = 0; SCROLL_Y_DIM > idx; idx++) {
+	    fill_horiz_buffer (x, y + idx, hbuf);
+	    for (pix = 0; NULL != check && SCROLL_X_DIM > pix; pix++) {
+		*check = *check * 31 + hbuf[pix];
+	    }
+	}
+	for (idx = 0; SCROLL_X_DIM > idx; idx++) {
+	    fill_vert_buffer (x + idx, y, vbuf);
+	    for (pix = 0; NULL != check && SCROLL_Y_DIM > pix; pix++) {
+		*check = *check * 31 + vbuf[pix];
+	    }
+	}
+    }
+    return elapsed_ms (&start) / n_frames;
+}
+
+
+/*
+ * bench_objects
+ *   DESCRIPTION: Time the drawing of a room into which every object
+ *                has been moved, blending object pixels with each 
+ *                kernel that the processor supports, and then copying
+ *                runs of opaque pixels.  The methods take turns over
+ *                several trials, and the best time of each is kept, so
+ *                that drift in the machine's speed does not favor any
+ *                of them.  Copying runs is compared with the fastest
+ *                kernel as well as the scalar one.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: builds the world and moves its objects; leaves the 
+ *                 fastest blending kernel in use
+ */
+static void
+bench_objects ()
+{
+    static const int32_t n_frames = 200; /* views drawn per method */
+    static const int32_t n_trials = 5;   /* timings of each method */
+    room_t*  r;                  /* the crowded room               */
+    int32_t  kernel;             /* index over blending kernels    */
+    				 /*    (NUM_BLEND_KERNELS for runs) */
+    int32_t  trial;              /* index over timings             */
+    double   ms;                 /* time per view, one timing      */
+    double   best_ms[NUM_BLEND_KERNELS + 1]; /* best time per view */
+    double   blend_ms = 0;       /* time per view, fastest kernel  */
+    uint32_t check[NUM_BLEND_KERNELS + 1];   /* checksum of each   */
+    int32_t  usable[NUM_BLEND_KERNELS + 1];  /* method supported?  */
+
+    set_photo_budget (0);
+    set_object_spans (1); /* so that the images have runs to copy */
+    if (!build_world ()) {
+	return;
+    }
+    srand (391);
+    r = start_in_room ();
+    gather_objects (r, MAX_LINE_OBJECTS);
+    prep_room (r);
+    printf ("  %s, %ux%u photo\n", room_name (r), room_photo_width (r),
+	    room_photo_height (r));
+
+    /* 
+     * Blend each pixel, with each kernel, or copy runs of opaque 
+     * pixels; the first trial also gathers checksums.
+     */
+    for (trial = 0; n_trials > trial; trial++) {
+	for (kernel = 0; NUM_BLEND_KERNELS >= kernel; kernel++) {
+	    set_object_spans (NUM_BLEND_KERNELS == kernel);
+	    usable[kernel] = (NUM_BLEND_KERNELS == kernel ||
+			      set_blend_kernel (kernel));
+	    if (!usable[kernel]) {
+		continue;
+	    }
+	    if (0 == trial) {
+		(void)redraw_room (r, n_frames, &check[kernel]);
+	    }
+	    ms = redraw_room (r, n_frames, NULL);
+	    if (0 == trial || best_ms[kernel] > ms) {
+		best_ms[kernel] = ms;
+	    }
+	}
+    }
+
+    for (kernel = 0; NUM_BLEND_KERNELS > kernel; kernel++) {
+	if (!usable[kernel]) {
+	    continue;
+	}
+	if (0 == blend_ms || blend_ms > best_ms[kernel]) {
+	    blend_ms = best_ms[kernel];
+	}
+	printf ("  blend %-6s       %8.3f ms/view  speedup %5.2f  %s\n", 
+		blend_kernel_name (kernel), best_ms[kernel], 
+		best_ms[BLEND_SCALAR] / best_ms[kernel],
+		(check[BLEND_SCALAR] == check[kernel] ? 
+		 "same pixels" : "PIXELS DIFFER"));
+    }
+    printf ("  copy opaque runs   %8.3f ms/view  speedup %5.2f  %s\n",
+	    best_ms[kernel], best_ms[BLEND_SCALAR] / best_ms[kernel],
+	    (check[BLEND_SCALAR] == check[kernel] ? 
+	     "same pixels" : "PIXELS DIFFER"));
+    printf ("  opaque runs vs fastest blend        %5.2f\n", 
+	    blend_ms / best_ms[kernel]);
+    set_object_spans (0);
+}
+
+
+/*
+ * bench_blend
+ *   DESCRIPTION: Check that every way of drawing objects gives the same
+ *                pixels as blending them one at a time from the photo's
+ *                and images' rows, for every room
+ *                holding every object.  Objects are placed randomly in
+ *                each room, several times over.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: builds the world and moves its objects; leaves the 
+ *                 fastest blending kernel and column copies in use
+ */
+static void
+bench_blend ()
+{
+    static const int32_t n_frames = 20;   /* views drawn per room      */
+    static const int32_t n_placings = 4;  /* placements of objects     */
+    int32_t  n_rooms = 0;        /* number of rooms checked        */
+    int32_t  n_bad = 0;          /* number of mismatches           */
+    int32_t  idx;                /* index over rooms               */
+    int32_t  place;              /* index over placements          */
+    int32_t  kernel;             /* index over blending kernels    */
+    int32_t  method;             /* 0 blending, 1 opaque runs, 2  */
+    				 /*    column copies               */
+    room_t*  r;                  /* the room being drawn           */
+    uint32_t base_check;         /* checksum, scalar kernel        */
+    uint32_t check;              /* checksum, one method           */
+
+    set_photo_budget (0);
+    set_object_spans (1); /* so that the images have runs to copy */
+    if (!build_world ()) {
+	return;
+    }
+    for (idx = 0; NULL != (r = nth_room (idx)); idx++, n_rooms++) {
+	for (place = 0; n_placings > place; place++) {
+	    srand (idx * n_placings + place);
+	    gather_objects (r, MAX_LINE_OBJECTS);
+	    prep_room (r);
+	    set_object_spans (0);
+	    set_column_copies (0);
+	    set_object_index (0);
+	    (void)set_blend_kernel (BLEND_SCALAR);
+	    (void)redraw_room (r, n_frames, &base_check);
+	    set_object_index (1);
+	    for (method = 0; 3 > method; method++) {
+		set_object_spans (1 == method);
+		set_column_copies (2 == method);
+		for (kernel = 0; NUM_BLEND_KERNELS > kernel; kernel++) {
+		    if (!set_blend_kernel (kernel)) {
+			continue;
+		    }
+		    (void)redraw_room (r, n_frames, &check);
+		    if (base_check != check) {
+			printf ("  %s differs in %s (placement %d%s)\n",
+				blend_kernel_name (kernel), room_name (r),
+				place, (1 == method ? ", opaque runs" : 
+					(2 == method ? ", column copies" :
+					 "")));
+			n_bad++;
+		    }
+		}
+	    }
+	}
+    }
+    set_object_spans (0);
+    printf ("  %d rooms, %d placements of every object: %d mismatches\n",
+	    n_rooms, n_placings, n_bad);
+}
+
+
+/*
+ * draw_columns
+ *   DESCRIPTION: Draw every column of the screen for a series of views 
+ *                of a room, as when scrolling horizontally across the
+ *                whole screen, and time the drawing.
+ *   INPUTS: r -- the room (already prepared with prep_room)
+ *           n_frames -- number of views to draw
+ *   OUTPUTS: check -- checksum of the pixels drawn
+ *   RETURN VALUE: average time to draw one view in milliseconds
+ *   SIDE EFFECTS: none
+ */
+static double
+draw_columns (const room_t* r, int32_t n_frames, uint32_t* check)
+{
+    unsigned char   vbuf[SCROLL_Y_DIM]; /* one column of the screen      */
+    int32_t         x_range;  /* number of horizontal view positions     */
+    int32_t         y_range;  /* number of vertical view positions       */
+    int32_t         frame;    /* index over views                        */
+    int32_t         x, y;     /* upper left of view                      */
+    int32_t         idx;      /* index over columns of view              */
+    double          ms;       /* time taken                              */
+    struct timespec start;    /* start of drawing                        */
+
+    x_range = room_photo_width (r) - SCROLL_X_DIM + 1;
+    y_range = room_photo_height (r) - SCROLL_Y_DIM + 1;
+    *check = 0;
+    ms = 0;
+    for (frame = 0; n_frames > frame; frame++) {
+	x = (0 >= x_range ? 0 : (frame * 7) % x_range);
+	y = (0 >= y_range ? 0 : (frame * 5) % y_range);
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	for (idx = 0; SCROLL_X_DIM > idx; idx++) {
+	    fill_vert_buffer (x + idx, y, vbuf);
+	}
+	ms += elapsed_ms (&start);
+	for (idx = 0; SCROLL_Y_DIM > idx; idx++) {
+	    *check = *check * 31 + vbuf[idx];
+	}
+    }
+    return ms / n_frames;
+}
+
+
+/*
+ * bench_columns
+ *   DESCRIPTION: Time the drawing of vertical lines in every room, first
+ *                reading down the columns of room photos and object 
+ *                images, then from column by column copies of them.
+ *                Report the time taken to make the copies (paid the 
+ *                first time that a room scrolls horizontally) and the
+ *                memory that they take.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: builds the world; leaves column copies in use
+ */
+static void
+bench_columns ()
+{
+    static const int32_t n_frames = 20; /* views drawn per room         */
+    room_t*   r;                   /* room being drawn                  */
+    object_t* obj;                 /* index over objects in room        */
+    int32_t   idx;                 /* index over rooms                  */
+    double    strided_ms = 0;      /* total time per view, originals    */
+    double    first_ms = 0;        /* total time for first view, copies */
+    double    copy_ms = 0;         /* total time per view, copies       */
+    size_t    photo_bytes = 0;     /* memory for photo copies           */
+    size_t    obj_bytes = 0;       /* memory for object image copies    */
+    uint32_t  strided_check;       /* checksum, originals               */
+    uint32_t  copy_check;          /* checksum, copies                  */
+    int32_t   n_bad = 0;           /* rooms where checksums differ      */
+
+    set_photo_budget (0);
+    if (!build_world ()) {
+	return;
+    }
+    for (idx = 0; NULL != (r = nth_room (idx)); idx++) {
+	prep_room (r);
+	set_column_copies (0);
+	(void)draw_columns (r, 1, &strided_check);
+	strided_ms += draw_columns (r, n_frames, &strided_check);
+	set_column_copies (1);
+	first_ms += draw_columns (r, 1, &copy_check);
+	copy_ms += draw_columns (r, n_frames, &copy_check);
+	n_bad += (strided_check != copy_check);
+	photo_bytes += room_photo_width (r) * room_photo_height (r);
+    }
+
+    /* Each object image is copied once, however many rooms show it. */
+    r = nth_room (0);
+    gather_objects (r, MAX_LINE_OBJECTS);
+    for (obj = room_contents_iterate (r); NULL != obj; obj = obj_next (obj)) {
+	obj_bytes += image_width (obj_image (obj)) * 
+		     image_height (obj_image (obj));
+    }
+
+    printf ("  %d rooms, %s\n", idx, 
+	    (0 == n_bad ? "same pixels" : "PIXELS DIFFER"));
+    printf ("  read down columns  %8.3f ms/view\n", strided_ms / idx);
+    printf ("  column copies      %8.3f ms/view  speedup %5.2f\n",
+	    copy_ms / idx, strided_ms / copy_ms);
+    printf ("  first view, making copies %8.3f ms\n", first_ms / idx);
+    printf ("  memory for copies  %8zu KB photos, %zu KB objects "
+	    "(at most)\n", photo_bytes / 1024, obj_bytes / 1024);
+}
+
+
+/*
+ * bench_index
+ *   DESCRIPTION: Time the drawing of a room holding more and more 
+ *                objects, finding the objects near each line through
+ *                the room's object index and by checking every object.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: builds the world and moves its objects; leaves the
+ *                 object index in use
+ */
+static void
+bench_index ()
+{
+    static const int32_t n_frames = 200;      /* views drawn per count */
+    static const int32_t n_objs[4] = {1, 5, 10, 20}; /* counts to try  */
+    room_t*  r;                  /* the room being drawn           */
+    int32_t  idx;                /* index over object counts       */
+    double   list_ms, index_ms;  /* time per view for each method  */
+    uint32_t list_check;         /* checksum of pixels drawn...    */
+    uint32_t index_check;        /*    ...by each method           */
+
+    set_photo_budget (0);
+    if (!build_world ()) {
+	return;
+    }
+    srand (391);
+    r = start_in_room ();
+    prep_room (r);
+    for (idx = 0; 4 > idx; idx++) {
+	gather_objects (r, n_objs[idx]);
+	set_object_index (0);
+	(void)redraw_room (r, n_frames, &list_check);
+	list_ms = redraw_room (r, n_frames, NULL);
+	set_object_index (1);
+	(void)redraw_room (r, n_frames, &index_check);
+	index_ms = redraw_room (r, n_frames, NULL);
+	printf ("  %2d objects  check all %8.3f ms/view  index %8.3f ms/view"
+		"  %s\n", n_objs[idx], list_ms, index_ms,
+		(list_check == index_check ? "same pixels" : "PIXELS DIFFER"));
+    }
+}
+
+
+/*
+ * bench_redraw
+ *   DESCRIPTION: Measure how many times per second the whole logical view
+ *                can be drawn into the mode X build buffer, as when the
+ *                player enters a room: first with a call to 
+ *                draw_horiz_line for each row, then with one call to 
+ *                draw_rect.  The VGA is not used.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: builds the world and moves its objects; sets up the
+ *                 build buffer
+ */
+static void
+bench_redraw ()
+{
+    static const int32_t n_frames = 500; /* redraws per method  */
+    room_t*         r;              /* the room drawn              */
+    int32_t         frame;          /* index over redraws          */
+    int32_t         row;            /* index over rows             */
+    double          line_ms;        /* time per redraw, by lines   */
+    double          rect_ms;        /* time per redraw, by rect    */
+    struct timespec start;          /* start of redraws            */
+
+    set_photo_budget (0);
+    if (!build_world () || 
+	0 != init_build_buffer (fill_horiz_buffer, fill_vert_buffer)) {
+	return;
+    }
+    srand (391);
+    r = start_in_room ();
+    gather_objects (r, MAX_LINE_OBJECTS);
+    prep_room (r);
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (frame = 0; n_frames > frame; frame++) {
+	for (row = 0; SCROLL_Y_DIM > row; row++) {
+	    (void)draw_horiz_line (row);
+	}
+    }
+    line_ms = elapsed_ms (&start) / n_frames;
+
+    set_rect_fill_fn (fill_rect);
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (frame = 0; n_frames > frame; frame++) {
+	(void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+    }
+    rect_ms = elapsed_ms (&start) / n_frames;
+    set_rect_fill_fn (NULL);
+
+    printf ("  %d draw_horiz_line %8.3f ms  %8.0f frames/s\n", 
+	    SCROLL_Y_DIM, line_ms, 1000 / line_ms);
+    printf ("  one draw_rect       %8.3f ms  %8.0f frames/s\n", 
+	    rect_ms, 1000 / rect_ms);
+}
+
+
+/*
+ * scroll_lines
+ *   DESCRIPTION: Scroll the logical view window down the whole height of
+ *                a room photo and back up again, one pixel at a time, 
+ *                drawing the row uncovered at each step with 
+ *                draw_horiz_line, and time the drawing.
+ *   INPUTS: r -- the room (already prepared with prep_room)
+ *           n_passes -- number of times to scroll down and up
+ *   OUTPUTS: none
+ *   RETURN VALUE: average time to draw one row in microseconds
+ *   SIDE EFFECTS: moves the logical view window; draws into the build
+ *                 buffer
+ */
+static double
+scroll_lines (room_t* r, int32_t n_passes)
+{
+    int32_t         y_range;  /* number of vertical view positions */
+    int32_t         pass;     /* index over passes                 */
+    int32_t         y;        /* top of view                       */
+    int32_t         n_rows;   /* number of rows drawn              */
+    struct timespec start;    /* start of drawing                  */
+
+    y_range = room_photo_height (r) - SCROLL_Y_DIM + 1;
+    if (1 > y_range) {
+	y_range = 1;
+    }
+    n_rows = 0;
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (pass = 0; n_passes > pass; pass++) {
+	for (y = 0; y_range > y; y++, n_rows++) {
+	    set_view_window (0, y);
+	    (void)draw_horiz_line (SCROLL_Y_DIM - 1);
+	}
+	for (y = y_range - 1; 0 <= y; y--, n_rows++) {
+	    set_view_window (0, y);
+	    (void)draw_horiz_line (0);
+	}
+    }
+    return elapsed_ms (&start) * 1000 / n_rows;
+}
+
+
+/*
+ * bench_planar
+ *   DESCRIPTION: Measure what keeping copies of room photos and object
+ *                images stored by mode X plane costs at load time, by
+ *                reading a synthetic 1024x1024 photo from the photo
+ *                cache with and without its copy, and what it saves 
+ *                while scrolling, by drawing rows of a room crowded with
+ *                objects as the view scrolls through it, again with and
+ *                without the copies.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes and removes a temporary photo file and its 
+ *                 cache file; builds the world twice and moves its 
+ *                 objects, leaking the photos of the first world; sets 
+ *                 up the build buffer
+ */
+static void
+bench_planar ()
+{
+    static const int32_t n_reps = 10;   /* times photo is read            */
+    static const int32_t n_passes = 20; /* times view scrolls through room */
+    char fname[] = "/tmp/bench-photo.XXXXXX"; /* synthetic photo file    */
+    char cname[sizeof (fname) + sizeof (PHOTO_CACHE_SUFFIX)]; /* and its */
+    					/*    photo cache file            */
+    double plain_ms, planar_ms, mse;    /* load results                   */
+    double plain_us, planar_us;         /* scroll results                 */
+    int32_t planar;                     /* whether copies are kept        */
+    room_t* r;                          /* the room drawn                 */
+
+    /* Time reads from the photo cache, after it has been written once. */
+    if (!write_synthetic_photo (fname)) {
+	puts ("  can't write synthetic photo");
+	return;
+    }
+    set_photo_cache (1);
+    set_planar_pixels (0);
+    if (!quantize_photo (fname, 1, &plain_ms, &mse) ||
+        !quantize_photo (fname, n_reps, &plain_ms, &mse)) {
+	puts ("  can't read synthetic photo");
+    } else {
+	set_planar_pixels (1);
+	if (!quantize_photo (fname, n_reps, &planar_ms, &mse)) {
+	    puts ("  can't read synthetic photo with planes");
+	} else {
+	    printf ("  read_photo 1024x1024    %8.3f ms  with planes %8.3f ms\n",
+		    plain_ms, planar_ms);
+	}
+    }
+    (void)unlink (fname);
+    (void)snprintf (cname, sizeof (cname), "%s%s", fname, PHOTO_CACHE_SUFFIX);
+    (void)unlink (cname);
+
+    /* Time scrolling through a crowded room, with and without planes. */
+    set_photo_budget (0);
+    set_rect_fill_fn (fill_rect);
+    for (planar = 0; 2 > planar; planar++) {
+	set_planar_pixels (planar);
+	if (!build_world () || 
+	    0 != init_build_buffer (fill_horiz_buffer, fill_vert_buffer)) {
+	    break;
+	}
+	srand (391);
+	r = start_in_room ();
+	gather_objects (r, MAX_LINE_OBJECTS);
+	prep_room (r);
+	if (planar) {
+	    planar_us = scroll_lines (r, n_passes);
+	    printf ("  scroll one row          %8.3f us  with planes %8.3f us\n",
+		    plain_us, planar_us);
+	} else {
+	    plain_us = scroll_lines (r, n_passes);
+	}
+    }
+    set_rect_fill_fn (NULL);
+    set_planar_pixels (1);
+}
+
+
+/*
+ * scroll_bands
+ *   DESCRIPTION: Scroll the logical view window diagonally across a room
+ *                photo and back, a fixed number of pixels per move along
+ *                each axis, drawing the bands uncovered at each move as
+ *                the game does, and time the drawing.
+ *   INPUTS: r -- the room (already prepared with prep_room)
+ *           speed -- pixels moved along each axis per move
+ *           by_strip -- 1 to draw each band with one call to 
+ *                       draw_horiz_strip or draw_vert_strip, or 0 to draw
+ *                       it one line at a time
+ *   OUTPUTS: none
+ *   RETURN VALUE: average time per move in microseconds
+ *   SIDE EFFECTS: moves the logical view window; draws into the build
+ *                 buffer
+ */
+static double
+scroll_bands (room_t* r, int32_t speed, int32_t by_strip)
+{
+    static const int32_t n_passes = 20; /* times view crosses the room */
+    int32_t         n_steps;  /* moves to cross the room              */
+    int32_t         pass;     /* index over passes                    */
+    int32_t         step;     /* index over moves                     */
+    int32_t         dir;      /* 1 to move right and down, -1 back    */
+    int32_t         x, y;     /* upper left of view                   */
+    int32_t         hx, vy;   /* first line of bands drawn            */
+    int32_t         idx;      /* index over lines in bands            */
+    struct timespec start;    /* start of drawing                     */
+
+    n_steps = (room_photo_width (r) - SCROLL_X_DIM) / speed;
+    idx = (room_photo_height (r) - SCROLL_Y_DIM) / speed;
+    n_steps = (idx < n_steps ? idx : n_steps);
+    if (1 > n_steps) {
+	return 0;
+    }
+    x = y = 0;
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (pass = 0; n_passes > pass; pass++) {
+	dir = (0 == (pass & 1) ? 1 : -1);
+	hx = (0 < dir ? SCROLL_X_DIM - speed : 0);
+	vy = (0 < dir ? SCROLL_Y_DIM - speed : 0);
+	for (step = 0; n_steps > step; step++) {
+	    x += dir * speed;
+	    y += dir * speed;
+	    set_view_window (x, y);
+	    if (by_strip) {
+		(void)draw_vert_strip (hx, speed);
+		(void)draw_horiz_strip (vy, speed);
+		continue;
+	    }
+	    for (idx = 0; speed > idx; idx++) {
+		(void)draw_vert_line (hx + idx);
+	    }
+	    for (idx = 0; speed > idx; idx++) {
+		(void)draw_horiz_line (vy + idx);
+	    }
+	}
+    }
+    return elapsed_ms (&start) * 1000 / (n_passes * n_steps);
+}
+
+
+/*
+ * bench_strips
+ *   DESCRIPTION: Time diagonal scrolling through a room crowded with 
+ *                objects at several speeds, drawing the bands uncovered
+ *                by each move one line at a time (with no rectangle 
+ *                function, as before strips) and then as strips.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: builds the world and moves its objects; sets up the 
+ *                 build buffer
+ */
+static void
+bench_strips ()
+{
+    static const int32_t speeds[4] = {2, 6, 10, 16}; /* pixels per move */
+    room_t*  r;                /* the room drawn                    */
+    room_t*  biggest;          /* room with the largest photo       */
+    int32_t  idx;              /* index over rooms, then speeds     */
+    double   line_us, strip_us; /* time per move                     */
+
+    set_photo_budget (0);
+    if (!build_world () || 
+	0 != init_build_buffer (fill_horiz_buffer, fill_vert_buffer)) {
+	return;
+    }
+
+    /* Scroll through the room with the largest photo. */
+    biggest = nth_room (0);
+    for (idx = 1; NULL != (r = nth_room (idx)); idx++) {
+	if (room_photo_width (r) * room_photo_height (r) > 
+	    room_photo_width (biggest) * room_photo_height (biggest)) {
+	    biggest = r;
+	}
+    }
+    srand (391);
+    gather_objects (biggest, MAX_LINE_OBJECTS);
+    prep_room (biggest);
+
+    for (idx = 0; 4 > idx; idx++) {
+	set_rect_fill_fn (NULL);
+	line_us = scroll_bands (biggest, speeds[idx], 0);
+	set_rect_fill_fn (fill_rect);
+	strip_us = scroll_bands (biggest, speeds[idx], 1);
+	printf ("  %2d pixels/move  lines %8.2f us  strips %8.2f us\n", 
+		speeds[idx], line_us, strip_us);
+    }
+    set_rect_fill_fn (NULL);
+}
+
+
+/*
+ * fill_pattern_row
+ *   DESCRIPTION: Horizontal line function for bench_scroll, which draws 
+ *                a fixed pattern rather than a room, so that the time 
+ *                measured is mostly that of moving the build buffer.
+ *   INPUTS: (x,y) -- map pixel coordinates of the leftmost pixel
+ *   OUTPUTS: buf -- the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+fill_pattern_row (int x, int y, unsigned char buf[SCROLL_X_DIM])
+{
+    (void)memset (buf, (x ^ y) & 0x3F, SCROLL_X_DIM);
+}
+
+
+/*
+ * fill_pattern_col
+ *   DESCRIPTION: Vertical line function for bench_scroll; see 
+ *                fill_pattern_row.
+ *   INPUTS: (x,y) -- map pixel coordinates of the top pixel
+ *   OUTPUTS: buf -- the line
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+fill_pattern_col (int x, int y, unsigned char buf[SCROLL_Y_DIM])
+{
+    (void)memset (buf, (x ^ y) & 0x3F, SCROLL_Y_DIM);
+}
+
+
+/*
+ * bench_scroll
+ *   DESCRIPTION: Time diagonal scrolling from one corner of a 1024x1024
+ *                map to the other and back at several speeds, as the 
+ *                game scrolls: each move calls set_view_window and then
+ *                draws the two bands uncovered as strips.  The time spent
+ *                in set_view_window, which moves the view's data within
+ *                the build buffer when the view nears either end of it,
+ *                is reported separately.  Both the linear and the 
+ *                toroidal build buffer are timed.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets up the build buffer; leaves it in linear mode
+ */
+static void
+bench_scroll ()
+{
+    static const int32_t speeds[4] = {1, 2, 6, 16}; /* pixels per move */
+    static const int32_t n_passes = 50; /* times view crosses the map */
+    static const int32_t map_dim = 1024; /* width and height of map    */
+    int32_t  torus;            /* 1 for a toroidal build buffer     */
+    int32_t  idx;              /* index over speeds                 */
+    int32_t  speed;            /* pixels per move                   */
+    int32_t  pass;             /* index over passes                 */
+    int32_t  n_moves;          /* moves made                        */
+    int32_t  x, y;             /* upper left of view                */
+    int32_t  dir;              /* 1 to move right and down, -1 back */
+    double   set_ms, total_ms; /* time in set_view_window, in all   */
+    struct timespec start;     /* start of one move                 */
+    struct timespec all_start; /* start of all moves at one speed   */
+
+    if (0 != init_build_buffer (fill_pattern_row, fill_pattern_col)) {
+	return;
+    }
+    set_rect_fill_fn (NULL);
+    for (idx = 0; 8 > idx; idx++) {
+	torus = idx / 4;
+	speed = speeds[idx % 4];
+	set_toroidal_build (torus);
+	set_view_window (0, 0);
+	(void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+	x = y = n_moves = 0;
+	set_ms = 0;
+	(void)clock_gettime (CLOCK_MONOTONIC, &all_start);
+	for (pass = 0; n_passes > pass; pass++) {
+	    dir = (0 == (pass & 1) ? 1 : -1);
+	    while (1) {
+		if ((0 < dir && (map_dim - SCROLL_Y_DIM < y + speed ||
+				 map_dim - SCROLL_X_DIM < x + speed)) ||
+		    (0 > dir && (0 > y - speed || 0 > x - speed))) {
+		    break;
+		}
+		x += dir * speed;
+		y += dir * speed;
+		(void)clock_gettime (CLOCK_MONOTONIC, &start);
+		set_view_window (x, y);
+		set_ms += elapsed_ms (&start);
+		(void)draw_vert_strip (0 < dir ? SCROLL_X_DIM - speed : 0, 
+				       speed);
+		(void)draw_horiz_strip (0 < dir ? SCROLL_Y_DIM - speed : 0, 
+					speed);
+		n_moves++;
+	    }
+	}
+	total_ms = elapsed_ms (&all_start);
+	printf ("  %s %2d pixels/move  %8.2f us/move  set_view_window "
+		"%8.2f us/move\n", (torus ? "toroidal" : "linear  "), speed, 
+		total_ms * 1000 / n_moves, set_ms * 1000 / n_moves);
+    }
+    set_toroidal_build (0);
+}
+
+
+/*
+ * bench_show
+ *   DESCRIPTION: Time the copies from the program to the (emulated) VGA
+ *                for one frame: show_screen, show_status_bar, and 
+ *                fill_my_palette, for the starting room crowded with
+ *                objects.  show_screen is timed with nothing drawn 
+ *                since the last frame, with an object-sized rectangle
+ *                drawn, and with the whole window drawn (the drawing 
+ *                is included in the latter two times).  Full frames are
+ *                also timed with each copy engine, after listing the 
+ *                bandwidths measured by set_mode_X.  The frame shown
+ *                is then written to bench.ppm so that it can be checked
+ *                by eye.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: builds the world and moves its objects; sets up and
+ *                 clears emulated mode X; writes bench.ppm
+ */
+static void
+bench_show ()
+{
+    static const int32_t n_frames = 2000; /* copies of each kind      */
+    static unsigned char palette[192][3]; /* palette for timing       */
+    room_t*         r;              /* the room shown                 */
+    int32_t         frame;          /* index over copies              */
+    double          idle_ms;        /* time per unchanged show_screen */
+    double          object_ms;      /* time per object and show       */
+    double          show_ms;        /* time per redraw and show       */
+    double          bar_ms;         /* time per show_status_bar       */
+    double          palette_ms;     /* time per fill_my_palette       */
+    double          engine_ms;      /* time per show with one engine  */
+    copy_engine_t   chosen;         /* engine picked by set_mode_X    */
+    copy_engine_t   engine;         /* index over copy engines        */
+    struct timespec start;          /* start of copies                */
+
+    set_photo_budget (0);
+    if (!build_world ()) {
+	return;
+    }
+    if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer)) {
+	puts ("  can't set up emulated mode X");
+	return;
+    }
+    srand (391);
+    r = start_in_room ();
+    gather_objects (r, MAX_LINE_OBJECTS);
+    prep_room (r);
+    set_rect_fill_fn (fill_rect);
+    (void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+    show_screen ();
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (frame = 0; n_frames > frame; frame++) {
+	show_screen ();
+    }
+    idle_ms = elapsed_ms (&start) / n_frames;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (frame = 0; n_frames > frame; frame++) {
+	(void)draw_rect (144, 84, 32, 32);
+	show_screen ();
+    }
+    object_ms = elapsed_ms (&start) / n_frames;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (frame = 0; n_frames > frame; frame++) {
+	(void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+	show_screen ();
+    }
+    show_ms = elapsed_ms (&start) / n_frames;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (frame = 0; n_frames > frame; frame++) {
+	show_status_bar (room_name (r), 1);
+    }
+    bar_ms = elapsed_ms (&start) / n_frames;
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (frame = 0; n_frames > frame; frame++) {
+	fill_my_palette (palette);
+    }
+    palette_ms = elapsed_ms (&start) / n_frames;
+
+    printf ("  idle show_screen %7.2f us\n", idle_ms * 1000);
+    printf ("  object and show %8.2f us\n", object_ms * 1000);
+    printf ("  redraw and show %8.2f us\n", show_ms * 1000);
+    printf ("  show_status_bar %8.2f us\n", bar_ms * 1000);
+    printf ("  fill_my_palette %8.2f us\n", palette_ms * 1000);
+
+    /* Time full frames with each copy engine. */
+    chosen = get_copy_engine ();
+    for (engine = 0; NUM_COPY_ENGINES > engine; engine++) {
+	if (0 != set_copy_engine (engine)) {
+	    printf ("  %-17s unsupported\n", copy_engine_name (engine));
+	    continue;
+	}
+	(void)clock_gettime (CLOCK_MONOTONIC, &start);
+	for (frame = 0; n_frames > frame; frame++) {
+	    (void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+	    show_screen ();
+	}
+	engine_ms = elapsed_ms (&start) / n_frames;
+	printf ("  %-17s %8.0f MB/s  redraw and show %8.2f us%s\n", 
+		copy_engine_name (engine), copy_engine_bandwidth (engine),
+		engine_ms * 1000, (chosen == engine ? "  (chosen)" : ""));
+    }
+    (void)set_copy_engine (chosen);
+
+    /* Show the room with its own palette, and save the frame. */
+    prep_room (r);
+    show_screen ();
+    if (0 != dump_frame_ppm ("bench.ppm")) {
+	puts ("  can't write bench.ppm");
+    }
+    set_rect_fill_fn (NULL);
+    clear_mode_X ();
+}
+
+
+/*
+ * pace_frames
+ *   DESCRIPTION: Run a second of 20 ms game ticks in emulated mode X, 
+ *                drawing an object-sized rectangle of the room already
+ *                shown and calling 
+ *                show_screen on each tick and polling for page flips 
+ *                while waiting for the next, as the game loop does.  
+ *                Prints the number of frames drawn and shown, the time
+ *                spent in show_screen, and the delay from show_screen 
+ *                until the frame reached the display.
+ *   INPUTS: triple -- 1 for triple buffering, 0 for double
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer and video memory
+ */
+static void
+pace_frames (int32_t triple)
+{
+    static const int32_t n_ticks = 50;  /* ticks run                   */
+    static const double tick_ms = 20;   /* length of a tick            */
+    int32_t         tick;               /* index over ticks            */
+    int32_t         n_shown;            /* frames that reached display */
+    double          show_ms;            /* time in one show_screen     */
+    double          total_ms;           /* time in all show_screens    */
+    double          max_ms;             /* longest show_screen         */
+    double          delay_ms;           /* delay of one frame          */
+    double          total_delay;        /* delay of all frames shown   */
+    double          max_delay;          /* longest delay               */
+    double          queued_ms;          /* when last frame was queued  */
+    struct timespec start;              /* start of ticks              */
+    struct timespec frame;              /* start of one show_screen    */
+
+    set_triple_buffering (triple);
+    n_shown = 0;
+    total_ms = max_ms = total_delay = max_delay = 0;
+    queued_ms = -1;
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    for (tick = 0; n_ticks > tick; tick++) {
+	(void)draw_rect ((tick * 37) % (SCROLL_X_DIM - 32), 
+			 (tick * 23) % (SCROLL_Y_DIM - 32), 32, 32);
+	(void)clock_gettime (CLOCK_MONOTONIC, &frame);
+	show_screen ();
+	show_ms = elapsed_ms (&frame);
+	total_ms += show_ms;
+	if (max_ms < show_ms) {
+	    max_ms = show_ms;
+	}
+
+	/* With double buffering, the frame is shown at once. */
+	if (!triple) {
+	    n_shown++;
+	    continue;
+	}
+	queued_ms = elapsed_ms (&start);
+	while (tick_ms * (tick + 1) > elapsed_ms (&start)) {
+	    if (1 == poll_page_flip () && 0 <= queued_ms) {
+		delay_ms = elapsed_ms (&start) - queued_ms;
+		total_delay += delay_ms;
+		if (max_delay < delay_ms) {
+		    max_delay = delay_ms;
+		}
+		n_shown++;
+		queued_ms = -1;
+	    }
+	}
+    }
+    set_triple_buffering (0);
+
+    printf ("  %s  %3d frames %3d shown  show_screen %6.2f us "
+	    "(max %6.2f)  delay %5.2f ms (max %5.2f)\n", 
+	    (triple ? "triple" : "double"), n_ticks, n_shown, 
+	    total_ms * 1000 / n_ticks, max_ms * 1000, 
+	    (0 < n_shown ? total_delay / n_shown : 0), max_delay);
+}
+
+
+/*
+ * bench_pace
+ *   DESCRIPTION: Compare frame pacing with double buffering, in which
+ *                show_screen changes pages at once (whatever the 
+ *                display is doing), and triple buffering, in which 
+ *                pages change at the next vertical retrace of the 
+ *                emulated 70 Hz display.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: builds the world and moves its objects; sets up and
+ *                 clears emulated mode X
+ */
+static void
+bench_pace ()
+{
+    room_t* r; /* the room shown */
+
+    set_photo_budget (0);
+    if (!build_world ()) {
+	return;
+    }
+    if (0 != set_mode_X (fill_horiz_buffer, fill_vert_buffer)) {
+	puts ("  can't set up emulated mode X");
+	return;
+    }
+    srand (391);
+    r = start_in_room ();
+    gather_objects (r, MAX_LINE_OBJECTS);
+    prep_room (r);
+    set_rect_fill_fn (fill_rect);
+    (void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+    show_screen ();
+
+    pace_frames (0);
+    pace_frames (1);
+
+    set_rect_fill_fn (NULL);
+    clear_mode_X ();
+}
+
+
+/*
+ * tick_frames
+ *   DESCRIPTION: Run 200 game ticks of 5 ms, scrolling the view window
+ *                6 pixels diagonally across a 1024x1024 pattern map on
+ *                each and writing the status bar, as the game loop does
+ *                when a direction is held.  Either the ticks draw and 
+ *                show the frame themselves, or they queue commands for 
+ *                the render thread.  Prints the time each tick spends 
+ *                on drawing (its average and maximum), and the total 
+ *                time until the last frame is shown.
+ *   INPUTS: threaded -- 1 to use the render thread, 0 to draw directly
+ *           triple -- 1 for triple buffering, 0 for double
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer and video memory; starts
+ *                 and stops the render thread
+ */
+static void
+tick_frames (int32_t threaded, int32_t triple)
+{
+    static pthread_mutex_t world_lock = PTHREAD_MUTEX_INITIALIZER;
+    static const int32_t n_ticks = 200;  /* ticks run                   */
+    static const long tick_ns = 5000000; /* length of a tick            */
+    static const int32_t speed = 6;      /* pixels moved per tick       */
+    int32_t         tick;                /* index over ticks            */
+    int32_t         x, y;                /* upper left of view          */
+    int32_t         dir;                 /* 1 to move right and down    */
+    double          tick_ms;             /* drawing time of one tick    */
+    double          total_ms;            /* drawing time of all ticks   */
+    double          max_ms;              /* longest drawing time        */
+    struct timespec start;               /* start of ticks              */
+    struct timespec now;                 /* start of one tick's drawing */
+    struct timespec wake;                /* end of one tick             */
+
+    set_triple_buffering (triple);
+    set_view_window (0, 0);
+    (void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+    show_screen ();
+    if (threaded && 0 != start_render_thread (&world_lock)) {
+	puts ("  can't start render thread");
+	set_triple_buffering (0);
+	return;
+    }
+
+    x = y = 0;
+    dir = 1;
+    total_ms = max_ms = 0;
+    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+    wake = start;
+    for (tick = 0; n_ticks > tick; tick++) {
+	if ((0 < dir && 1024 - SCROLL_Y_DIM < y + speed) || 
+	    (0 > dir && 0 > y - speed)) {
+	    dir = -dir;
+	}
+	x += dir * speed;
+	y += dir * speed;
+
+	(void)clock_gettime (CLOCK_MONOTONIC, &now);
+	if (threaded) {
+	    render_view (x, y);
+	    render_status ("a room with a view", 1);
+	} else {
+	    set_view_window (x, y);
+	    (void)draw_vert_strip (0 < dir ? SCROLL_X_DIM - speed : 0, 
+				   speed);
+	    (void)draw_horiz_strip (0 < dir ? SCROLL_Y_DIM - speed : 0, 
+				    speed);
+	    show_status_bar ("a room with a view", 1);
+	    show_screen ();
+	}
+	tick_ms = elapsed_ms (&now);
+	total_ms += tick_ms;
+	if (max_ms < tick_ms) {
+	    max_ms = tick_ms;
+	}
+
+	/* Sleep until the next tick. */
+	wake.tv_nsec += tick_ns;
+	if (1000000000 <= wake.tv_nsec) {
+	    wake.tv_nsec -= 1000000000;
+	    wake.tv_sec++;
+	}
+	while (0 != clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, 
+				     &wake, NULL)) {
+	}
+    }
+
+    /* Wait for the last frame. */
+    if (threaded) {
+	stop_render_thread (NULL);
+    } else {
+	while (0 <= poll_page_flip ()) {
+	}
+    }
+    printf ("  %s %s  draw %7.2f us/tick (max %7.2f)  all %7.2f ms\n", 
+	    (threaded ? "render thread" : "game loop    "),
+	    (triple ? "triple" : "double"), total_ms * 1000 / n_ticks, 
+	    max_ms * 1000, elapsed_ms (&start));
+    set_triple_buffering (0);
+}
+
+
+/*
+ * bench_render
+ *   DESCRIPTION: Compare the time that each game tick spends drawing 
+ *                when the game loop draws and shows frames itself and 
+ *                when it queues commands for the render thread, with 
+ *                double and triple buffering.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets up and clears emulated mode X
+ */
+static void
+bench_render ()
+{
+    if (0 != set_mode_X (fill_pattern_row, fill_pattern_col)) {
+	puts ("  can't set up emulated mode X");
+	return;
+    }
+    set_rect_fill_fn (NULL);
+    tick_frames (0, 0);
+    tick_frames (1, 0);
+    tick_frames (0, 1);
+    tick_frames (1, 1);
+    clear_mode_X ();
+}
+
+
+/*
+ * show_status (interface function; declared in world.h)
+ *   DESCRIPTION: Stand-in for the game's status message display, which
+ *                is not linked into this program.
+ *   INPUTS: s -- the string used for the status message
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+show_status (const char* s)
+{
+}
+
+
+/*
+ * main
+ *   DESCRIPTION: Run the benchmarks named on the command line, or all of
+ *                them if none are named.
+ *   INPUTS: argc, argv -- names of benchmarks to run
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, 2 if a benchmark name is unknown
+ */
+int
+main (int argc, char* argv[])
+{
+    int32_t arg; /* index over command line arguments */
+    int32_t idx; /* index over benchmark list         */
+
+    /* Complain about any names that we don't know. */
+    for (arg = 1; argc > arg; arg++) {
+	for (idx = 0; NULL != bench_list[idx].name; idx++) {
+	    if (0 == strcmp (argv[arg], bench_list[idx].name)) {
+		break;
+	    }
+	}
+	if (NULL == bench_list[idx].name) {
+	    fprintf (stderr, "unknown benchmark %s\n", argv[arg]);
+	    return 2;
+	}
+    }
+
+    /* Run the benchmarks requested. */
+    for (idx = 0; NULL != bench_list[idx].name; idx++) {
+	for (arg = 1; argc > arg; arg++) {
+	    if (0 == strcmp (argv[arg], bench_list[idx].name)) {
+		break;
+	    }
+	}
+	if (1 < argc && argc == arg) {
+	    continue;
+	}
+	printf ("%s: %s\n", bench_list[idx].name,
+		bench_list[idx].description);
+	(*bench_list[idx].run) ();
+    }
+    return 0;
+}
@@ -0,0 +1,310 @@
+/*									tab:8
+ *
+ * blend.c - transparent object pixel blending
+ *
+ * Version:	    1
+ * Filename:	    blend.c
+ * History:
+ *	1	First written.
+ */
+
+/*
+ * Object images are drawn over room photos by copying every pixel that
+ * is not transparent.  On x86 processors, blend_obj_pixels compares 16
+ * (SSE2) or 32 (AVX2) pixels at once against the transparent color and
+ * selects between the object and the background with the resulting
+ * mask.  The kernel is picked the first time pixels are blended,
+ * according to what the processor supports; the SIMD kernels are 
+ * compiled for their instruction sets individually, so the rest of the
+ * program need not be.  Other processors use the scalar kernel.
+ */
+
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "blend.h"
+#include "photo_headers.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define BLEND_X86 1
+#endif
+
+
+/* local functions--see function headers for details */
+static void blend_scalar (uint8_t* dst, const uint8_t* src, uint32_t n);
+#if defined(BLEND_X86)
+static inline void blend_16 (uint8_t* dst, const uint8_t* src, uint32_t n);
+static void blend_sse2 (uint8_t* dst, const uint8_t* src, uint32_t n);
+static void blend_avx2 (uint8_t* dst, const uint8_t* src, uint32_t n);
+#endif
+static void choose_kernel (void);
+
+
+/* the kernels, indexed by blend_kernel_t */
+static void (* const kernel_func[NUM_BLEND_KERNELS]) 
+	(uint8_t* dst, const uint8_t* src, uint32_t n) = {
+    blend_scalar,
+#if defined(BLEND_X86)
+    blend_sse2,
+    blend_avx2
+#else
+    blend_scalar,
+    blend_scalar
+#endif
+};
+
+/* names of the kernels, indexed by blend_kernel_t */
+static const char* const kernel_name[NUM_BLEND_KERNELS] = {
+    "scalar", "SSE2", "AVX2"
+};
+
+/* 
+ * The kernel in use, chosen through pthread_once (by choose_kernel) 
+ * unless set earlier with set_blend_kernel.
+ */
+static void (*blend_func) (uint8_t* dst, const uint8_t* src, uint32_t n);
+static pthread_once_t blend_once = PTHREAD_ONCE_INIT;
+
+
+/* 
+ * blend_scalar
+ *   DESCRIPTION: Blend object pixels one at a time.
+ *   INPUTS: src -- the object pixels
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- the background, with the object drawn over it
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+blend_scalar (uint8_t* dst, const uint8_t* src, uint32_t n)
+{
+    for (; 0 < n; n--, dst++, src++) {
+	/* Don't copy transparent pixels. */
+	if (OBJ_CLR_TRANSP != *src) {
+	    *dst = *src;
+	}
+    }
+}
+
+
+#if defined(BLEND_X86)
+
+/* 
+ * blend_16
+ *   DESCRIPTION: Blend object pixels 16 at a time.  Blending a pixel
+ *                twice gives the same result as blending it once, so a
+ *                final partial group of 16 is blended by backing up to
+ *                overlap the previous group.  The function is inlined
+ *                into each SIMD kernel so that the AVX2 kernel uses the
+ *                AVX encoding of these instructions; mixing in SSE 
+ *                encodings after 256-bit operations costs a state
+ *                transition on many processors.
+ *   INPUTS: src -- the object pixels
+ *           n -- number of pixels (at least 16)
+ *   OUTPUTS: dst -- the background, with the object drawn over it
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+__attribute__ ((target ("sse2"), always_inline))
+static inline void
+blend_16 (uint8_t* dst, const uint8_t* src, uint32_t n)
+{
+    const __m128i transp = _mm_set1_epi8 ((char)OBJ_CLR_TRANSP);
+    __m128i       obj;  /* object pixels                  */
+    __m128i       bg;   /* background pixels              */
+    __m128i       mask; /* all ones where obj transparent */
+    uint32_t      pos;  /* index of first pixel in group  */
+
+    for (pos = 0; n > pos; pos += 16) {
+	/* The last group may overlap the one before it. */
+        if (n < pos + 16) {
+	    pos = n - 16;
+	}
+	obj = _mm_loadu_si128 ((const __m128i*)&src[pos]);
+	bg = _mm_loadu_si128 ((const __m128i*)&dst[pos]);
+	mask = _mm_cmpeq_epi8 (obj, transp);
+	bg = _mm_or_si128 (_mm_and_si128 (mask, bg), 
+			   _mm_andnot_si128 (mask, obj));
+	_mm_storeu_si128 ((__m128i*)&dst[pos], bg);
+    }
+}
+
+
+/* 
+ * blend_sse2
+ *   DESCRIPTION: Blend object pixels 16 at a time with SSE2 (see 
+ *                blend_16).  Lines of fewer than 16 pixels are blended
+ *                one at a time.
+ *   INPUTS: src -- the object pixels
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- the background, with the object drawn over it
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+__attribute__ ((target ("sse2")))
+static void
+blend_sse2 (uint8_t* dst, const uint8_t* src, uint32_t n)
+{
+    if (16 > n) {
+        blend_scalar (dst, src, n);
+    } else {
+	blend_16 (dst, src, n);
+    }
+}
+
+
+/* 
+ * blend_avx2
+ *   DESCRIPTION: Blend object pixels 32 at a time with AVX2, handling
+ *                a final partial group as blend_16 does.  Shorter lines
+ *                are blended 16 at a time, or one at a time if fewer
+ *                than 16.
+ *   INPUTS: src -- the object pixels
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- the background, with the object drawn over it
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+__attribute__ ((target ("avx2")))
+static void
+blend_avx2 (uint8_t* dst, const uint8_t* src, uint32_t n)
+{
+    __m256i  transp;   /* transparent color in every byte */
+    __m256i  obj;      /* object pixels                   */
+    __m256i  bg;       /* background pixels               */
+    __m256i  mask;     /* all ones where obj transparent  */
+    uint32_t pos;      /* index of first pixel in group   */
+
+    if (16 > n) {
+        blend_scalar (dst, src, n);
+	return;
+    }
+    if (32 > n) {
+	blend_16 (dst, src, n);
+	return;
+    }
+    transp = _mm256_set1_epi8 ((char)OBJ_CLR_TRANSP);
+    for (pos = 0; n > pos; pos += 32) {
+	/* The last group may overlap the one before it. */
+        if (n < pos + 32) {
+	    pos = n - 32;
+	}
+	obj = _mm256_loadu_si256 ((const __m256i*)&src[pos]);
+	bg = _mm256_loadu_si256 ((const __m256i*)&dst[pos]);
+	mask = _mm256_cmpeq_epi8 (obj, transp);
+	_mm256_storeu_si256 ((__m256i*)&dst[pos], 
+			     _mm256_blendv_epi8 (obj, bg, mask));
+    }
+}
+
+#endif /* BLEND_X86 */
+
+
+/* 
+ * choose_kernel
+ *   DESCRIPTION: Pick the fastest kernel that the processor supports,
+ *                unless one has already been set.  Called once, through
+ *                pthread_once.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets blend_func
+ */
+static void
+choose_kernel ()
+{
+    int32_t kernel; /* index over kernels, fastest first */
+
+    if (NULL != blend_func) {
+        return;
+    }
+    for (kernel = NUM_BLEND_KERNELS - 1; 
+	 BLEND_SCALAR < kernel && !blend_kernel_supported (kernel); kernel--) {
+    }
+    blend_func = kernel_func[kernel];
+}
+
+
+/* 
+ * blend_obj_pixels
+ *   DESCRIPTION: Draw a line of object pixels over a line of background
+ *                pixels.  Transparent object pixels (OBJ_CLR_TRANSP)
+ *                leave the background unchanged.  The lines must not
+ *                overlap.
+ *   INPUTS: src -- the object pixels
+ *           n -- number of pixels
+ *   OUTPUTS: dst -- the background, with the object drawn over it
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: chooses a kernel on first call
+ */
+void
+blend_obj_pixels (uint8_t* dst, const uint8_t* src, uint32_t n)
+{
+    (void)pthread_once (&blend_once, choose_kernel);
+    (*blend_func) (dst, src, n);
+}
+
+
+/* 
+ * blend_kernel_supported
+ *   DESCRIPTION: Check whether the processor can run a blending kernel.
+ *   INPUTS: kernel -- the kernel
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it can, 0 if not
+ *   SIDE EFFECTS: none
+ */
+int32_t
+blend_kernel_supported (blend_kernel_t kernel)
+{
+    switch (kernel) {
+	case BLEND_SCALAR:
+	    return 1;
+#if defined(BLEND_X86)
+	case BLEND_SSE2:
+	    return (0 != __builtin_cpu_supports ("sse2"));
+	case BLEND_AVX2:
+	    return (0 != __builtin_cpu_supports ("avx2"));
+#endif
+	default:
+	    return 0;
+    }
+}
+
+
+/* 
+ * set_blend_kernel
+ *   DESCRIPTION: Make blend_obj_pixels use a particular kernel.  Must
+ *                not be called while other threads are blending.
+ *   INPUTS: kernel -- the kernel
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 on success, 0 if the processor can't run the kernel
+ *                 (in which case the kernel in use is not changed)
+ *   SIDE EFFECTS: changes the kernel used by blend_obj_pixels
+ */
+int32_t
+set_blend_kernel (blend_kernel_t kernel)
+{
+    if (!blend_kernel_supported (kernel)) {
+        return 0;
+    }
+    blend_func = kernel_func[kernel];
+    (void)pthread_once (&blend_once, choose_kernel);
+    return 1;
+}
+
+
+/* 
+ * blend_kernel_name
+ *   DESCRIPTION: Get the name of a blending kernel.
+ *   INPUTS: kernel -- the kernel
+ *   OUTPUTS: none
+ *   RETURN VALUE: the name
+ *   SIDE EFFECTS: none
+ */
+const char*
+blend_kernel_name (blend_kernel_t kernel)
+{
+    return (NUM_BLEND_KERNELS > (uint32_t)kernel ? kernel_name[kernel] : "?");
+}
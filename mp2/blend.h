@@ -0,0 +1,42 @@
+/*									tab:8
+ *
+ * blend.h - transparent object pixel blending header file
+ *
+ * Version:	    1
+ * Filename:	    blend.h
+ * History:
+ *	1	First written.
+ */
+
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <stdint.h>
+
+/* the ways of blending object pixels, from slowest to fastest */
+typedef enum {
+    BLEND_SCALAR, /* one pixel at a time, in C                  */
+    BLEND_SSE2,   /* 16 pixels at a time (x86 SSE2)             */
+    BLEND_AVX2,   /* 32 pixels at a time (x86 AVX2)             */
+    NUM_BLEND_KERNELS
+} blend_kernel_t;
+
+/* 
+ * Copy n object pixels from src over dst, except for transparent pixels
+ * (OBJ_CLR_TRANSP), which leave dst unchanged.
+ */
+extern void blend_obj_pixels (uint8_t* dst, const uint8_t* src, uint32_t n);
+
+/* Find whether the processor can use a kernel. */
+extern int32_t blend_kernel_supported (blend_kernel_t kernel);
+
+/* 
+ * Force blend_obj_pixels to use one kernel (for testing); returns 0 if
+ * the processor can't use it.  By default, the fastest one is used.
+ */
+extern int32_t set_blend_kernel (blend_kernel_t kernel);
+
+/* Name of a kernel, for printing. */
+extern const char* blend_kernel_name (blend_kernel_t kernel);
+
+#endif /* BLEND_H */
@@ -42,11 +42,20 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#if !defined(MODEX_HEADLESS)
 #include <sys/io.h>
+#endif
 #include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define MODEX_X86 1
+#endif
+
 #include "modex.h"
 #include "text.h"
 
@@ -138,11 +147,43 @@ static void set_CRTC_registers (unsigned short table[NUM_CRTC_REGS]);
 static void set_attr_registers (unsigned char table[NUM_ATTR_REGS * 2]);
 static void set_graphics_registers (unsigned short table[NUM_GRAPHICS_REGS]);
 static void fill_palette_mode_x ();
+static void mark_valid (int x, int y, int w, int h);
+static void mark_stale (int x, int y, int w, int h);
+static void mark_all_stale ();
+static void move_valid_rect (unsigned char* old_img3);
+static void place_build_image ();
+static int wrap_coord (int v, int n);
+static unsigned char* group_addr (int px, int py);
+static void write_row (int x, int y, int w, const unsigned char* buf);
+static void write_col (int x, int y, const unsigned char buf[SCROLL_Y_DIM]);
+static void copy_torus_plane (int px, unsigned short scr_addr, int first,
+			      int n_rows);
 static void fill_palette_text ();
 static void write_font_data ();
 static void set_text_mode_3 (int clear_scr);
-static void copy_image (unsigned char* img, unsigned short scr_addr);
+static void copy_image (unsigned char* img, unsigned short scr_addr, 
+			int n_bytes);
 static void copy_status_bar(unsigned char* bar, unsigned short scr_addr);
+#if defined(MODEX_X86)
+static void copy_movsb (unsigned char* dst, const unsigned char* src, 
+			int n_bytes);
+static void copy_movsd (unsigned char* dst, const unsigned char* src, 
+			int n_bytes);
+static void copy_sse2_nt (unsigned char* dst, const unsigned char* src, 
+			  int n_bytes);
+#endif
+static void copy_memcpy (unsigned char* dst, const unsigned char* src, 
+			 int n_bytes);
+static void calibrate_copy_engines ();
+static int in_vertical_retrace ();
+static void set_start_address (int page);
+#if defined(MODEX_HEADLESS)
+static void emu_outb (unsigned short port, unsigned char val);
+static void emu_outw (unsigned short port, unsigned short val);
+static unsigned char emu_inb (unsigned short port);
+static long long emu_line ();
+static void emu_latch_start ();
+#endif
 
 /* 
  * Images are built in this buffer, then copied to the video memory.
@@ -181,10 +222,102 @@ static int img3_off;		    /* offset of upper left pixel   */
 static unsigned char* img3;	    /* pointer to upper left pixel  */
 static int show_x, show_y;          /* logical view coordinates     */
 
+/*
+ * The part of the logical view window that holds drawn data, in logical
+ * coordinates: (valid_x,valid_y) is its upper left pixel and (valid_w,
+ * valid_h) its size, or valid_w and valid_h are 0 if nothing has been
+ * drawn.  It grows to hold the bounding box of everything drawn, and 
+ * shrinks to the view window when the window moves, so it may include
+ * undrawn pixels but never excludes drawn ones.  When set_view_window 
+ * moves the window within the build buffer, only this rectangle is 
+ * copied.
+ */
+static int valid_x, valid_y;
+static int valid_w, valid_h;
+
+/*
+ * In toroidal mode (see set_toroidal_build), the build buffer instead 
+ * holds four fixed plane images of SCROLL_X_WIDTH by SCROLL_Y_DIM bytes,
+ * again plane 3 first, starting at img3.  Pixel (px,py) of the logical
+ * view is stored at column (px >> 2) and row py of its plane image, 
+ * both taken modulo the image size, so each image is a torus that 
+ * holds exactly one view window wherever the window is.  Moving the 
+ * window never moves data; show_screen splits its copies at the edges
+ * of the images instead.
+ */
+static int torus_mode = 0;
+
+/*
+ * Rows of the logical view window that have changed since they were
+ * last copied to each display page.  Bit (4 * page + i) of 
+ * row_stale[row] is set if video plane i of the page (see PAGE_ADDR)
+ * differs from the build buffer in that row.  build_changed is set if
+ * anything has been drawn (or the window has moved) since show_screen
+ * last ran; if not, the page last shown or queued is up to date and 
+ * show_screen has nothing to copy.
+ */
+static unsigned short row_stale[SCROLL_Y_DIM];
+static int build_changed;
+
+
+/* shortest batch of copies timed when calibrating the copy engines */
+#define CALIBRATE_NSEC 1000000
+
+/* the copy engines, indexed by copy_engine_t */
+static void (* const copy_engine_func[NUM_COPY_ENGINES]) 
+	(unsigned char* dst, const unsigned char* src, int n_bytes) = {
+#if defined(MODEX_X86)
+    copy_movsb,
+    copy_movsd,
+    copy_sse2_nt,
+#else
+    copy_memcpy,
+    copy_memcpy,
+    copy_memcpy,
+#endif
+    copy_memcpy
+};
+
+/* names of the copy engines, indexed by copy_engine_t */
+static const char* const copy_engine_label[NUM_COPY_ENGINES] = {
+    "rep movsb", "rep movsd", "SSE2 non-temporal", "memcpy"
+};
+
+/* 
+ * The copy engine used by copy_image and copy_status_bar (chosen by 
+ * calibrate_copy_engines), and the bandwidth measured for each engine.
+ */
+#if defined(MODEX_X86)
+static copy_engine_t copy_engine = COPY_MOVSB;
+#else
+static copy_engine_t copy_engine = COPY_MEMCPY;
+#endif
+static double copy_mbps[NUM_COPY_ENGINES];
+
 
 /* displayed video memory variables */
 static unsigned char* mem_image;    /* pointer to start of video memory */
-static unsigned short target_img;   /* offset of displayed screen image */
+
+/*
+ * Screen images (pages) in video memory follow the status bar, which 
+ * starts at offset 0, and are 0x4000 bytes apart.  Double buffering 
+ * alternates between pages 0 and 1.  With triple buffering (see 
+ * set_triple_buffering), show_screen instead fills a page that is 
+ * neither on display nor about to be, then queues it.  The VGA latches
+ * the CRTC start address at the start of vertical retrace, so 
+ * poll_page_flip writes the queued page's address outside retrace; the
+ * page is then pending, and the page on display stays in use until a
+ * retrace is seen to start after the write.  A newer frame replaces 
+ * one still in the queue, so show_screen never waits for the display.
+ */
+#define PAGE_ADDR(page) (320 * 18 + (page) * 0x4000)
+#define NUM_PAGES       3
+static int triple_buffer = 0;       /* non-zero for triple buffering    */
+static int shown_page;              /* page on display                  */
+static int pending_page;            /* page in CRTC, not latched, or -1 */
+static int pending_armed;           /* display seen outside retrace     */
+                                    /*    since pending_page was set    */
+static int queued_page;             /* page awaiting retrace, or -1     */
 
 
 /* 
@@ -194,8 +327,64 @@ static unsigned short target_img;   /* offset of displayed screen image */
  */
 static void (*horiz_line_fn) (int, int, unsigned char[SCROLL_X_DIM]);
 static void (*vert_line_fn) (int, int, unsigned char[SCROLL_Y_DIM]);
+
+/* 
+ * optional function provided by the caller (see set_rect_fill_fn) and 
+ * used by draw_rect to draw rectangles straight into the build buffer 
+ * planes; NULL if none has been provided
+ */
+static void (*rect_fill_fn) (int, int, int, int, unsigned char* [4], int);
 	
 
+#if defined(MODEX_HEADLESS)
+
+/*
+ * In a headless build (MODEX_HEADLESS defined), there is no VGA: the
+ * macros below pass port writes to emu_outb, which records the 
+ * registers of interest, and video memory is four ordinary planes of
+ * VID_MEM_SIZE bytes each.  Choosing a single plane with the sequencer
+ * map mask points mem_image at that plane, so copies into video memory
+ * cost about what they would on a real VGA's linear mapping, and 
+ * dump_frame_ppm rebuilds the displayed frame from the planes, CRTC
+ * start address and split screen registers, and DAC palette.  As on a
+ * real VGA, the start address takes effect at the next vertical retrace
+ * (see emu_inb for the timing), when emu_latch_start copies it into 
+ * emu_start.
+ */
+static unsigned char* emu_planes;         /* four planes of video memory  */
+static unsigned char emu_seq[8];          /* sequencer registers          */
+static unsigned char emu_seq_index;       /* selected sequencer register  */
+static unsigned char emu_CRTC[NUM_CRTC_REGS]; /* CRTC registers           */
+static unsigned char emu_CRTC_index;      /* selected CRTC register       */
+static unsigned char emu_dac[256][3];     /* DAC palette (6-bit RGB)      */
+static int emu_dac_index;                 /* next DAC color component     */
+static int emu_start;                     /* start address latched by the */
+                                          /*    last vertical retrace     */
+static long long emu_retraces;            /* retraces begun when latched  */
+
+#define SET_WRITE_MASK(mask_hi_bits)                                    \
+    emu_outw (0x03C4, ((mask_hi_bits) & 0xFF00) | 0x02)
+#define OUTB(port,val)                                                  \
+    emu_outb ((port), (val))
+#define OUTW(port,val)                                                  \
+    emu_outw ((port), (val))
+#define REP_OUTSW(port,source,count)                                    \
+do {                                                                    \
+    const unsigned short* emu_src = (const unsigned short*)(source);    \
+    int emu_n;                                                          \
+    for (emu_n = (count); emu_n > 0; emu_n--)                           \
+        emu_outw ((port), *emu_src++);                                  \
+} while (0)
+#define REP_OUTSB(port,source,count)                                    \
+do {                                                                    \
+    const unsigned char* emu_src = (const unsigned char*)(source);      \
+    int emu_n;                                                          \
+    for (emu_n = (count); emu_n > 0; emu_n--)                           \
+        emu_outb ((port), *emu_src++);                                  \
+} while (0)
+
+#else /* !defined(MODEX_HEADLESS) */
+
 /* 
  * macro used to target a specific video plane or planes when writing
  * to video memory in mode X; bits 8-11 in the mask_hi_bits enable writes
@@ -262,6 +451,8 @@ do {                                                                    \
       : "eax", "memory", "cc");                                         \
 } while (0)
 
+#endif /* !defined(MODEX_HEADLESS) */
+
 
 /*
  * set_mode_X
@@ -283,30 +474,16 @@ int
 set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
             void (*vert_fill_fn) (int, int, unsigned char[SCROLL_Y_DIM]))
 {
-    int i; /* loop index for filling memory fence with magic numbers */
-
     /* 
      * Record callback functions for obtaining horizontal and vertical 
-     * line images.
+     * line images, and set up the build buffer.
      */
-    if (horiz_fill_fn == NULL || vert_fill_fn == NULL)
+    if (init_build_buffer (horiz_fill_fn, vert_fill_fn) == -1)
         return -1;
-    horiz_line_fn = horiz_fill_fn;
-    vert_line_fn = vert_fill_fn;
 
-    /* Initialize the logical view window to position (0,0). */
-    show_x = show_y = 0;
-    img3_off = BUILD_BASE_INIT;
-    img3 = build + img3_off + MEM_FENCE_WIDTH;
-
-    /* Set up the memory fence on the build buffer. */
-    for (i = 0; i < MEM_FENCE_WIDTH; i++) {
-        build[i] = MEM_FENCE_MAGIC;
-        build[BUILD_BUF_SIZE + MEM_FENCE_WIDTH + i] = MEM_FENCE_MAGIC;
-    }
-
-    /* One display page goes at the start of video memory. */
-    target_img = 320*18; 
+    /* Page 0 is shown first (filled with zeroes below). */
+    shown_page = 0;
+    pending_page = queued_page = -1;
 
     /* Map video memory and obtain permission for VGA port access. */
     if (open_memory_and_ports () == -1)
@@ -330,6 +507,7 @@ set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
     set_attr_registers (mode_X_attr);            /* attribute registers   */
     set_graphics_registers (mode_X_graphics);    /* graphics registers    */
     fill_palette_mode_x ();			 /* palette colors        */
+    calibrate_copy_engines ();			 /* pick fastest copy     */
     clear_screens ();				 /* zero video memory     */
     VGA_blank (0);			         /* unblank the screen    */
 
@@ -338,6 +516,120 @@ set_mode_X (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
 }
 
 
+/*
+ * init_build_buffer
+ *   DESCRIPTION: Sets up the build buffer and records the functions used
+ *                to draw lines into it, without touching the VGA.  
+ *                set_mode_X calls this function; programs that only
+ *                draw into the build buffer (to time the drawing, for
+ *                example) may call it instead.
+ *   INPUTS: horiz_fill_fn, vert_fill_fn -- as for set_mode_X
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: initializes the logical view window to (0,0)
+ */   
+int
+init_build_buffer (void (*horiz_fill_fn) (int, int, unsigned char[SCROLL_X_DIM]),
+		   void (*vert_fill_fn) (int, int, unsigned char[SCROLL_Y_DIM]))
+{
+    int i; /* loop index for filling memory fence with magic numbers */
+
+    /* 
+     * Record callback functions for obtaining horizontal and vertical 
+     * line images.
+     */
+    if (horiz_fill_fn == NULL || vert_fill_fn == NULL)
+        return -1;
+    horiz_line_fn = horiz_fill_fn;
+    vert_line_fn = vert_fill_fn;
+
+    /* Initialize the logical view window to position (0,0). */
+    show_x = show_y = 0;
+    place_build_image ();
+
+    /* Set up the memory fence on the build buffer. */
+    for (i = 0; i < MEM_FENCE_WIDTH; i++) {
+        build[i] = MEM_FENCE_MAGIC;
+        build[BUILD_BUF_SIZE + MEM_FENCE_WIDTH + i] = MEM_FENCE_MAGIC;
+    }
+
+    /* Return success. */
+    return 0;
+}
+
+
+/*
+ * set_rect_fill_fn
+ *   DESCRIPTION: Provide a function that draws a rectangle of the logical
+ *                view straight into the build buffer planes, for use by
+ *                draw_rect.  Without one, draw_rect draws with the 
+ *                horizontal line function given to set_mode_X.
+ *   INPUTS: fill_fn -- the function, or NULL for none; its arguments
+ *                      are the logical (x,y) of the upper left pixel of
+ *                      the rectangle, its width and height, and the
+ *                      planes and pitch in which to store it: pixel 
+ *                      (px,py) goes to plane[px & 3][(px >> 2) + 
+ *                      py * pitch]
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+void
+set_rect_fill_fn (void (*fill_fn) (int, int, int, int, unsigned char* [4], 
+				   int))
+{
+    rect_fill_fn = fill_fn;
+}
+
+
+/*
+ * set_toroidal_build
+ *   DESCRIPTION: Choose whether the build buffer holds the logical view
+ *                window as four toroidal plane images, or (by default) 
+ *                as plane images that move within a larger linear 
+ *                buffer.  In toroidal mode, set_view_window never copies
+ *                pixels, so the cost of scrolling does not depend on how
+ *                far the view has moved, and show_screen copies each
+ *                plane in up to four pieces.  The contents of the build
+ *                buffer are lost, so the whole view window must be drawn
+ *                again before calling show_screen.
+ *   INPUTS: enable -- non-zero for toroidal mode, 0 for linear mode
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the layout of the build buffer
+ */   
+void
+set_toroidal_build (int enable)
+{
+    torus_mode = enable;
+    place_build_image ();
+}
+
+
+/*
+ * place_build_image
+ *   DESCRIPTION: Place the image of the logical view window in the build
+ *                buffer: at its start in toroidal mode, or in the middle
+ *                of it in linear mode.  Nothing has been drawn there.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets img3 and img3_off; empties the valid rectangle;
+ *                 marks all rows stale
+ */   
+static void
+place_build_image ()
+{
+    if (torus_mode)
+        img3_off = 0;
+    else
+	img3_off = BUILD_BASE_INIT - (show_x >> 2) - show_y * SCROLL_X_WIDTH;
+    img3 = build + img3_off + MEM_FENCE_WIDTH;
+    valid_w = valid_h = 0;
+    mark_all_stale ();
+}
+
+
 /*
  * clear_mode_X
  *   DESCRIPTION: Puts the VGA into text mode 3 (color text).
@@ -355,8 +647,13 @@ clear_mode_X ()
     /* Put VGA into text mode, restore font data, and clear screens. */
     set_text_mode_3 (1);
 
-    /* Unmap video memory. */
+    /* Unmap (or free) video memory. */
+#if defined(MODEX_HEADLESS)
+    free (emu_planes);
+    emu_planes = mem_image = NULL;
+#else
     (void)munmap (mem_image, VID_MEM_SIZE);
+#endif
 
     /* Check validity of build buffer memory fence.  Report breakage. */
     for (i = 0; i < MEM_FENCE_WIDTH; i++) {
@@ -379,37 +676,55 @@ clear_mode_X ()
  *   DESCRIPTION: Set the logical view window, moving its location within
  *                the build buffer if necessary to keep all on-screen data
  *                in the build buffer.  If the location within the build
- *                buffer moves, this function copies all data from the old
- *                window that are within the new screen to the appropriate
- *                new location, so only data not previously on the screen 
- *                must be drawn before calling show_screen.
+ *                buffer moves, this function copies all drawn data from 
+ *                the old window that are within the new screen to the 
+ *                appropriate new location, so only data not previously 
+ *                on the screen must be drawn before calling show_screen.
  *   INPUTS: (scr_x,scr_y) -- new upper left pixel of logical view window
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: may shift position of logical view window within build 
- *                 buffer
+ *                 buffer (never in toroidal mode); clips the valid 
+ *                 rectangle to the new window; marks all rows stale if
+ *                 the window moves
  */   
 void
 set_view_window (int scr_x, int scr_y)
 {
-    int old_x, old_y;     /* old position of logical view window           */
-    int start_x, start_y; /* starting position for copying from old to new */ 
-    int end_x, end_y;     /* ending position for copying from old to new   */ 
-    int start_off;        /* offset of copy start relative to old build    */
-     		          /*    buffer start position                      */
-    int length;           /* amount of data to be copied                   */
-    int i;	          /* copy loop index                               */
-    unsigned char* start_addr;  /* starting memory address of copy     */
-    unsigned char* target_addr; /* destination memory address for copy */
-
-    /* Record the old position. */
-    old_x = show_x;
-    old_y = show_y;
+    unsigned char* old_img3; /* old position of build buffer image */
+    int x_hi, y_hi;          /* lower right limit of valid data    */
+
+    /* Every pixel on the display changes when the window moves. */
+    if (scr_x != show_x || scr_y != show_y)
+        mark_all_stale ();
 
     /* Keep track of the new view window. */
     show_x = scr_x;
     show_y = scr_y;
 
+    /* 
+     * Only data within the new window need be kept, so clip the valid 
+     * rectangle to it.  If the windows do not overlap, it is empty.
+     */
+    x_hi = valid_x + valid_w;
+    y_hi = valid_y + valid_h;
+    if (x_hi > scr_x + SCROLL_X_DIM)
+        x_hi = scr_x + SCROLL_X_DIM;
+    if (y_hi > scr_y + SCROLL_Y_DIM)
+        y_hi = scr_y + SCROLL_Y_DIM;
+    if (valid_x < scr_x)
+        valid_x = scr_x;
+    if (valid_y < scr_y)
+        valid_y = scr_y;
+    valid_w = x_hi - valid_x;
+    valid_h = y_hi - valid_y;
+    if (valid_w <= 0 || valid_h <= 0)
+        valid_w = valid_h = 0;
+
+    /* A toroidal build buffer holds any view window in place. */
+    if (torus_mode)
+        return;
+
     /*
      * If the new view window fits within the boundaries of the build 
      * buffer, we need move nothing around.
@@ -421,81 +736,292 @@ set_view_window (int scr_x, int scr_y)
 	return;
 
     /*
-     * If the new screen does not overlap at all with the old screen, none
-     * of the old data need to be saved, and we can simply reposition the
-     * valid window of the build buffer in the middle of that buffer.
+     * Otherwise, reposition the window in the middle of the build buffer,
+     * and copy any valid data from the old location to the new one.
      */
-    if (scr_x <= old_x - SCROLL_X_DIM || scr_x >= old_x + SCROLL_X_DIM ||
-	scr_y <= old_y - SCROLL_Y_DIM || scr_y >= old_y + SCROLL_Y_DIM) {
-	img3_off = BUILD_BASE_INIT - (scr_x >> 2) - scr_y * SCROLL_X_WIDTH;
-	img3 = build + img3_off + MEM_FENCE_WIDTH;
-	return;
-    }
+    old_img3 = img3;
+    img3_off = BUILD_BASE_INIT - (scr_x >> 2) - scr_y * SCROLL_X_WIDTH;
+    img3 = build + img3_off + MEM_FENCE_WIDTH;
+    if (valid_w > 0)
+        move_valid_rect (old_img3);
+}
 
-    /*
-     * Any still-visible portion of the old screen should be retained.
-     * Rather than clipping exactly, we copy all contiguous data between
-     * a clipped starting point to a clipped ending point (which may
-     * include non-visible data).
-     *
-     * The starting point is the maximum (x,y) coordinates between the
-     * new and old screens.  The ending point is the minimum (x,y)
-     * coordinates between the old and new screens (offset by the screen
-     * size).
-     */
-    if (scr_x > old_x) {
-        start_x = scr_x;
-	end_x = old_x;
+
+/*
+ * move_valid_rect
+ *   DESCRIPTION: Copy the valid rectangle of the logical view window from
+ *                an old position of the build buffer image to the 
+ *                current one (img3).  In each plane, the rows of the 
+ *                rectangle are SCROLL_X_WIDTH bytes apart, so unless the
+ *                rectangle is narrow, the plane's part is copied as one
+ *                block, including the few bytes between rows (which lie 
+ *                outside of the rectangle, but within the window).  
+ *                Narrow rectangles are copied row by row.  The old and 
+ *                new images may overlap, so blocks are copied in order
+ *                of decreasing address if the data move up in memory,
+ *                and of increasing address if they move down.  (You 
+ *                should be able to explain why!)
+ *   INPUTS: old_img3 -- old position of the upper left pixel of the
+ *                       build buffer image
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: copies data within the build buffer
+ */   
+static void
+move_valid_rect (unsigned char* old_img3)
+{
+    int start_off; /* offset of first byte of rectangle in a plane */
+    int width;     /* bytes in a row of the rectangle              */
+    int length;    /* bytes in each copy                           */
+    int n_copies;  /* number of copies per plane                   */
+    int stride;    /* distance between copies within a plane       */
+    int image;     /* index over plane images (0 holds plane 3)    */
+    int i;         /* index over copies within a plane             */
+    int off;       /* offset of one copy                           */
+
+    start_off = (valid_x >> 2) + valid_y * SCROLL_X_WIDTH;
+    width = ((valid_x + valid_w - 1) >> 2) - (valid_x >> 2) + 1;
+    if (2 * width < SCROLL_X_WIDTH) {
+        length = width;
+	n_copies = valid_h;
+	stride = SCROLL_X_WIDTH;
     } else {
-        start_x = old_x;
-	end_x = scr_x;
+        length = (valid_h - 1) * SCROLL_X_WIDTH + width;
+	n_copies = 1;
+	stride = 0;
     }
-    end_x += SCROLL_X_DIM - 1;
-    if (scr_y > old_y) {
-        start_y = scr_y;
-	end_y = old_y;
+
+    if (old_img3 > img3) {
+	for (image = 0; image < 4; image++) {
+	    for (i = 0; i < n_copies; i++) {
+		off = start_off + image * SCROLL_SIZE + i * stride;
+		(void)memmove (img3 + off, old_img3 + off, length);
+	    }
+	}
     } else {
-        start_y = old_y;
-	end_y = scr_y;
+	for (image = 4; image-- > 0; ) {
+	    for (i = n_copies; i-- > 0; ) {
+		off = start_off + image * SCROLL_SIZE + i * stride;
+		(void)memmove (img3 + off, old_img3 + off, length);
+	    }
+	}
     }
-    end_y += SCROLL_Y_DIM - 1;
+}
 
-    /* 
-     * We now calculate the starting and ending addresses for the copy
-     * as well as the new offsets for use with the build buffer.  The
-     * length to be copied is basically the ending offset minus the starting
-     * offset plus one (plus the three screens in between planes 3 and 0).
-     */
-    start_off = (start_x >> 2) + start_y * SCROLL_X_WIDTH;
-    start_addr = img3 + start_off;
-    length = (end_x >> 2) + end_y * SCROLL_X_WIDTH + 1 - start_off + 
-	     3 * SCROLL_SIZE;
-    img3_off = BUILD_BASE_INIT - (show_x >> 2) - show_y * SCROLL_X_WIDTH;
-    img3 = build + img3_off + MEM_FENCE_WIDTH;
-    target_addr = img3 + start_off;
 
-    /* 
-     * Copy the relevant portion of the screen from the old location to the
-     * new one.  The areas may overlap, so copy direction is important. 
-     * (You should be able to explain why!)
-     */
-    if (start_addr < target_addr)
-	for (i = length; i-- > 0; )
-	    target_addr[i] = start_addr[i];
-    else
-	for (i = 0; i < length; i++)
-	    target_addr[i] = start_addr[i];
+/*
+ * mark_valid
+ *   DESCRIPTION: Record that a rectangle of the logical view window has
+ *                been drawn, growing the valid rectangle to the bounding
+ *                box of the two.
+ *   INPUTS: (x,y) -- logical upper left pixel of the rectangle drawn
+ *           (w,h) -- its width and height (positive)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the valid rectangle
+ */   
+static void
+mark_valid (int x, int y, int w, int h)
+{
+    int x_hi, y_hi; /* lower right limit of bounding box */
+
+    if (valid_w <= 0) {
+        valid_x = x;
+	valid_y = y;
+	valid_w = w;
+	valid_h = h;
+	return;
+    }
+    x_hi = (valid_x + valid_w > x + w ? valid_x + valid_w : x + w);
+    y_hi = (valid_y + valid_h > y + h ? valid_y + valid_h : y + h);
+    if (valid_x > x)
+        valid_x = x;
+    if (valid_y > y)
+        valid_y = y;
+    valid_w = x_hi - valid_x;
+    valid_h = y_hi - valid_y;
+}
+
+
+/*
+ * mark_stale
+ *   DESCRIPTION: Record that a rectangle of the logical view window has
+ *                been drawn, so that its rows must be copied again to
+ *                every display page.  Only the video planes that show 
+ *                the rectangle's columns are marked.
+ *   INPUTS: (x,y) -- logical upper left pixel of the rectangle drawn
+ *           (w,h) -- its width and height (positive)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes row_stale; sets build_changed
+ */   
+static void
+mark_stale (int x, int y, int w, int h)
+{
+    unsigned short bits; /* stale bits for the rectangle's planes */
+    int row, end;       /* range of window rows to mark          */
+    int i;              /* loop index over columns               */
+
+    /* Logical pixel x is shown in video plane (x - show_x) & 3. */
+    bits = 0x0F;
+    if (w < 4) {
+	bits = 0;
+	for (i = 0; i < w; i++)
+	    bits |= 1 << ((x + i - show_x) & 3);
+    }
+    bits |= (bits << 4) | (bits << 8);
+
+    row = (y - show_y < 0 ? 0 : y - show_y);
+    end = (y + h - show_y > SCROLL_Y_DIM ? SCROLL_Y_DIM : y + h - show_y);
+    for (; row < end; row++)
+        row_stale[row] |= bits;
+    build_changed = 1;
+}
+
+
+/*
+ * mark_all_stale
+ *   DESCRIPTION: Record that every row of every display page must be 
+ *                copied again, as when the view window moves or video 
+ *                memory is cleared.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes row_stale; sets build_changed
+ */   
+static void
+mark_all_stale ()
+{
+    (void)memset (row_stale, 0xFF, sizeof (row_stale));
+    build_changed = 1;
+}
+
+
+/*
+ * wrap_coord
+ *   DESCRIPTION: Wrap a coordinate around a torus dimension.
+ *   INPUTS: v -- the coordinate (possibly negative)
+ *           n -- the size of the dimension
+ *   OUTPUTS: none
+ *   RETURN VALUE: v modulo n, in the range 0 to n - 1
+ *   SIDE EFFECTS: none
+ */   
+static int
+wrap_coord (int v, int n)
+{
+    v %= n;
+    return (v < 0 ? v + n : v);
+}
+
+
+/*
+ * group_addr
+ *   DESCRIPTION: Find the address in the build buffer of a logical pixel,
+ *                less its plane offset: the pixel itself is stored at
+ *                ((3 - (px & 3)) * SCROLL_SIZE) past the address given.
+ *                Successive groups of four pixels in a row are stored at
+ *                successive addresses, and successive rows at intervals
+ *                of SCROLL_X_WIDTH, except in toroidal mode where they 
+ *                wrap at the edges of the plane images.
+ *   INPUTS: (px,py) -- the logical pixel, which must lie in the logical
+ *                      view window
+ *   OUTPUTS: none
+ *   RETURN VALUE: the address
+ *   SIDE EFFECTS: none
+ */   
+static unsigned char*
+group_addr (int px, int py)
+{
+    if (torus_mode)
+        return img3 + wrap_coord (px >> 2, SCROLL_X_WIDTH) + 
+	       wrap_coord (py, SCROLL_Y_DIM) * SCROLL_X_WIDTH;
+    return img3 + (px >> 2) + py * SCROLL_X_WIDTH;
+}
+
+
+/*
+ * write_row
+ *   DESCRIPTION: Copy part of a row of logical pixels into the planes of
+ *                the build buffer.
+ *   INPUTS: (x,y) -- logical pixel of the first pixel of the row
+ *           w -- number of pixels in the row
+ *           buf -- the pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+static void
+write_row (int x, int y, int w, const unsigned char* buf)
+{
+    unsigned char* addr; /* address of pixel (without plane offset) */
+    int p_off;           /* offset of plane of pixel                */
+    int n;               /* pixels before row wraps (if it does)    */
+    int i;		 /* loop index over pixels                  */
+
+    while (w > 0) {
+	n = w;
+	if (torus_mode && n > SCROLL_X_DIM - wrap_coord (x, SCROLL_X_DIM))
+	    n = SCROLL_X_DIM - wrap_coord (x, SCROLL_X_DIM);
+	addr = group_addr (x, y);
+	p_off = (3 - (x & 3));
+	for (i = 0; i < n; i++) {
+	    addr[p_off * SCROLL_SIZE] = buf[i];
+	    if (--p_off < 0) {
+		p_off = 3;
+		addr++;
+	    }
+	}
+	x += n;
+	w -= n;
+	buf += n;
+    }
+}
+
+
+/*
+ * write_col
+ *   DESCRIPTION: Copy a column of logical pixels, as tall as the logical
+ *                view window, into its plane of the build buffer.
+ *   INPUTS: (x,y) -- logical pixel of the top pixel of the column
+ *           buf -- the pixels
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+static void
+write_col (int x, int y, const unsigned char buf[SCROLL_Y_DIM])
+{
+    unsigned char* addr; /* address of pixel                        */
+    int n;               /* pixels before column wraps (if it does) */
+    int i;		 /* loop index over pixels                  */
+
+    addr = group_addr (x, y) + (3 - (x & 3)) * SCROLL_SIZE;
+    n = (torus_mode ? SCROLL_Y_DIM - wrap_coord (y, SCROLL_Y_DIM) : 
+    	 SCROLL_Y_DIM);
+    for (i = 0; i < SCROLL_Y_DIM; i++, addr += SCROLL_X_WIDTH) {
+	if (i == n)
+	    addr -= SCROLL_SIZE;
+        *addr = buf[i];
+    }
 }
 
 
 /*
  * show_screen
- *   DESCRIPTION: Show the logical view window on the video display.
+ *   DESCRIPTION: Show the logical view window on the video display.  If
+ *                nothing has changed since the last call, the page last
+ *                shown or queued is already up to date, and nothing is
+ *                copied.  Otherwise, only the rows of each plane that 
+ *                are stale in a free page are copied to it.  The page 
+ *                is then shown at once, or, with triple buffering, 
+ *                queued for the next vertical retrace (replacing any 
+ *                page still queued).
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: copies from the build buffer to video memory;
  *                 shifts the VGA display source to point to the new image
+ *                 (or queues it); clears the new page's stale bits
  */ 
 
 extern unsigned char text_image[5760];	/*5760 is the result of IMAGE_X_WIDTH*STATUS_BAR_HEIGHT*/ 
@@ -503,34 +1029,213 @@ void
 show_screen ()
 {
     unsigned char* addr;  /* source address for copy             */
+    unsigned char* src;   /* source address of plane i's image   */
+    unsigned short mask;  /* stale bits of the target page       */
+    unsigned short bit;   /* stale bit of plane i in target page */
+    int page;             /* page to fill                        */
     int p_off;            /* plane offset of first display plane */
     int i;		  /* loop index over video planes        */
+    int row, end;         /* range of stale rows                 */
+
+    /* Flip to a queued page if the display is in retrace. */
+    if (triple_buffer)
+        (void)poll_page_flip ();
+
+    /* The page last shown or queued still matches the build buffer. */
+    if (!build_changed)
+        return;
+    build_changed = 0;
 
     /* 
      * Calculate offset of build buffer plane to be mapped into plane 0 
      * of display.
      */
     p_off = (3 - (show_x & 3));
-    /* Switch to the other target screen in video memory. */
-    target_img ^= 0x4000;
-	
+    /* 
+     * Switch to a page that is neither on display nor queued: with 
+     * double buffering, the other of pages 0 and 1.  While a page is
+     * pending, the only page free is the queued one, if any.
+     */
+    page = 0;
+    while (page == shown_page || page == pending_page || 
+    	   page == queued_page)
+        page++;
+    if (page == NUM_PAGES)
+        page = queued_page;
+    mask = 0x0F << (4 * page);
 
     /* Calculate the source address. */
     addr = img3 + (show_x >> 2) + show_y * SCROLL_X_WIDTH;
-    /* Draw to each plane in the video memory. */
+
+    /* Copy each run of stale rows to each plane in the video memory. */
     for (i = 0; i < 4; i++) {
+        bit = mask & (0x111 << i);
+	src = addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i);
 	SET_WRITE_MASK (1 << (i + 8));
-	copy_image (addr + ((p_off - i + 4) & 3) * SCROLL_SIZE + (p_off < i), 
-	            target_img);
+	for (row = 0; row < SCROLL_Y_DIM; row = end) {
+	    if (0 == (row_stale[row] & bit)) {
+	        end = row + 1;
+		continue;
+	    }
+	    end = row + 1;
+	    while (end < SCROLL_Y_DIM && (row_stale[end] & bit))
+	        end++;
+
+	    /* 
+	     * In toroidal mode, video plane i shows logical pixels 
+	     * show_x + i, show_x + i + 4, and so forth, wrapped around a
+	     * plane image.
+	     */
+	    if (torus_mode)
+		copy_torus_plane (show_x + i, PAGE_ADDR (page), row, 
+				  end - row);
+	    else
+		copy_image (src + row * SCROLL_X_WIDTH, 
+			    PAGE_ADDR (page) + row * SCROLL_X_WIDTH,
+			    (end - row) * SCROLL_X_WIDTH);
+	}
+    }
+    for (row = 0; row < SCROLL_Y_DIM; row++)
+        row_stale[row] &= ~mask;
+
+    /* Queue the page for the next retrace. */
+    if (triple_buffer) {
+        queued_page = page;
+	(void)poll_page_flip ();
+	return;
     }
-	
 	
     /* 
      * Change the VGA registers to point the top left of the screen
      * to the video memory that we just filled.
      */
-    OUTW (0x03D4, (target_img & 0xFF00) | 0x0C);
-    OUTW (0x03D4, ((target_img & 0x00FF) << 8) | 0x0D);
+    shown_page = page;
+    set_start_address (page);
+}
+
+
+/*
+ * poll_page_flip
+ *   DESCRIPTION: With triple buffering, move a queued page towards the
+ *                display, so that the page changes between frames 
+ *                rather than partway through one.  Outside vertical 
+ *                retrace, the queued page's address is written to the
+ *                CRTC and the page becomes pending.  The VGA uses the
+ *                address from the start of the next retrace, so the 
+ *                pending page is counted as shown once the display has
+ *                been seen outside retrace and then in retrace.  Never
+ *                waits; call it often (while waiting for the next tick,
+ *                for example) so as not to miss retraces.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if a page was shown, 0 if a page is still queued
+ *                 or pending, or -1 if neither
+ *   SIDE EFFECTS: may shift the VGA display source to the queued page
+ */ 
+int
+poll_page_flip ()
+{
+    int retrace; /* 1 if the display is in vertical retrace */
+
+    if (pending_page < 0 && queued_page < 0)
+        return -1;
+    retrace = in_vertical_retrace ();
+
+    /* 
+     * A retrace after the display is seen outside one must have started
+     * after the write, so the pending page is on display.
+     */
+    if (pending_page >= 0) {
+        if (!retrace) {
+	    pending_armed = 1;
+	    return 0;
+	}
+	if (!pending_armed)
+	    return 0;
+	shown_page = pending_page;
+	pending_page = -1;
+	return 1;
+    }
+
+    /* Write the queued page's address, but not during retrace. */
+    if (retrace)
+        return 0;
+    pending_page = queued_page;
+    pending_armed = 0;
+    queued_page = -1;
+    set_start_address (pending_page);
+    return 0;
+}
+
+
+/*
+ * set_triple_buffering
+ *   DESCRIPTION: Choose between triple buffering, in which show_screen
+ *                queues pages for poll_page_flip to show at the next
+ *                vertical retrace, and (by default) double buffering, 
+ *                in which show_screen shows each page at once.  Any
+ *                queued or pending page is shown at once when triple 
+ *                buffering is turned off.
+ *   INPUTS: enable -- non-zero for triple buffering, 0 for double
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may shift the VGA display source to the queued page
+ */ 
+void
+set_triple_buffering (int enable)
+{
+    triple_buffer = enable;
+    if (enable)
+        return;
+    if (queued_page >= 0) {
+	shown_page = queued_page;
+	set_start_address (shown_page);
+    } else if (pending_page >= 0) {
+	shown_page = pending_page;
+    }
+    pending_page = queued_page = -1;
+}
+
+
+/*
+ * in_vertical_retrace
+ *   DESCRIPTION: Check the vertical retrace bit (3) of the VGA input 
+ *                status register (emulated in a headless build).
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if the display is in vertical retrace, 0 if not
+ *   SIDE EFFECTS: resets the attribute controller to expect an index
+ */ 
+static int
+in_vertical_retrace ()
+{
+    unsigned char status; /* input status register 1 */
+
+#if defined(MODEX_HEADLESS)
+    status = emu_inb (0x03DA);
+#else
+    asm volatile (
+	"inb (%%dx),%%al"
+      : "=a" (status) : "d" (0x03DA) : "memory");
+#endif
+    return (0 != (status & 0x08));
+}
+
+
+/*
+ * set_start_address
+ *   DESCRIPTION: Point the top left of the screen (above the status bar)
+ *                to a page of video memory.
+ *   INPUTS: page -- the page
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the VGA CRTC start address registers
+ */ 
+static void
+set_start_address (int page)
+{
+    OUTW (0x03D4, (PAGE_ADDR (page) & 0xFF00) | 0x0C);
+    OUTW (0x03D4, ((PAGE_ADDR (page) & 0x00FF) << 8) | 0x0D);
 }
 
 
@@ -566,16 +1271,26 @@ show_status_bar (const char * input, int mode)
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: fills all 256kB of VGA video memory with zeroes
+ *   SIDE EFFECTS: fills all 256kB of VGA video memory with zeroes;
+ *                 marks all rows stale
  */   
 void 
 clear_screens ()
 {
+    mark_all_stale ();
+
+#if defined(MODEX_HEADLESS)
+    int i; /* loop index over planes */
+
+    for (i = 0; i < 4; i++)
+        memset (emu_planes + i * VID_MEM_SIZE, 0, MODE_X_MEM_SIZE);
+#else
     /* Write to all four planes at once. */ 
     SET_WRITE_MASK (0x0F00);
 
     /* Set 64kB to zero (times four planes = 256kB). */
     memset (mem_image, 0, MODE_X_MEM_SIZE);
+#endif
 }
 
 
@@ -606,11 +1321,6 @@ int
 draw_vert_line (int x)
 {
     unsigned char buf[SCROLL_Y_DIM]; /* buffer for graphical image of line */
-    unsigned char* addr;             /* address of first pixel in build    */
-   				     /*     buffer (without plane offset)  */
-    int p_off;                       /* offset of plane of first pixel     */
-	int p_off_size;					/*the size of the offset in the memory*/
-    int i;			     /* loop index over pixels             */
 
     /* Check whether requested line falls in the logical view window. */
     if (x < 0 || x >= SCROLL_X_DIM)
@@ -621,23 +1331,12 @@ draw_vert_line (int x)
 
     /* Get the image of the line. */
     (*vert_line_fn) (x, show_y, buf);
+    mark_valid (x, show_y, 1, SCROLL_Y_DIM);
+    mark_stale (x, show_y, 1, SCROLL_Y_DIM);
+
+    /* Copy image data into appropriate plane in build buffer. */
+    write_col (x, show_y, buf);
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (x >> 2) + show_y * SCROLL_X_WIDTH;
-
-    /* Calculate plane offset of first pixel. */
-    p_off = (3 - (x & 3));
-
-	/*Calculate the size that p_off occupy in the memory*/
-	p_off_size = p_off * SCROLL_SIZE;
-	
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_Y_DIM; i++) 
-	{
-        addr[p_off_size] = buf[i];
-		addr +=SCROLL_X_WIDTH;
-    }
-
     /* Return success. */
     return 0;
 }
@@ -647,7 +1346,9 @@ draw_vert_line (int x)
  * draw_horiz_line
  *   DESCRIPTION: Draw a horizontal map line into the build buffer.  The 
  *                line should be offset from the top of the logical view 
- *                window screen by the given number of pixels.  
+ *                window screen by the given number of pixels.  If a
+ *                rectangle function has been given to set_rect_fill_fn,
+ *                the line is drawn with draw_rect.
  *   INPUTS: y -- the 0-based pixel row number of the line to be drawn
  *                within the logical view window (equivalent to the number
  *                of pixels from the top pixel to the line to be drawn)
@@ -660,34 +1361,182 @@ int
 draw_horiz_line (int y)
 {
     unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of line */
-    unsigned char* addr;             /* address of first pixel in build    */
-   				     /*     buffer (without plane offset)  */
-    int p_off;                       /* offset of plane of first pixel     */
-    int i;			     /* loop index over pixels             */
 
     /* Check whether requested line falls in the logical view window. */
     if (y < 0 || y >= SCROLL_Y_DIM)
 	return -1;
 
+    /* 
+     * A rectangle function writes each plane's part of the line in one
+     * piece, rather than one pixel at a time through a buffer.
+     */
+    if (rect_fill_fn != NULL)
+        return draw_rect (0, y, SCROLL_X_DIM, 1);
+
     /* Adjust y to the logical row value. */
     y += show_y;
 
     /* Get the image of the line. */
     (*horiz_line_fn) (show_x, y, buf);
+    mark_valid (show_x, y, SCROLL_X_DIM, 1);
+    mark_stale (show_x, y, SCROLL_X_DIM, 1);
 
-    /* Calculate starting address in build buffer. */
-    addr = img3 + (show_x >> 2) + y * SCROLL_X_WIDTH;
+    /* Copy image data into appropriate planes in build buffer. */
+    write_row (show_x, y, SCROLL_X_DIM, buf);
 
-    /* Calculate plane offset of first pixel. */
-    p_off = (3 - (show_x & 3));
+    /* Return success. */
+    return 0;
+}
 
-    /* Copy image data into appropriate planes in build buffer. */
-    for (i = 0; i < SCROLL_X_DIM; i++) {
-        addr[p_off * SCROLL_SIZE] = buf[i];
-	if (--p_off < 0) {
-	    p_off = 3;
-	    addr++;
+
+/*
+ * draw_horiz_strip
+ *   DESCRIPTION: Draw a band of horizontal map lines into the build 
+ *                buffer, as uncovered by scrolling the logical view 
+ *                window vertically by h pixels.  The band is drawn as
+ *                one rectangle (see draw_rect), so a rectangle function
+ *                fills all of it in one call.
+ *   INPUTS: y -- the 0-based pixel row number of the first line of the
+ *                band within the logical view window
+ *           h -- the number of lines in the band
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If the band is empty or does 
+ *                 not lie within the SCROLL range, the function returns
+ *                 -1.  
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+int
+draw_horiz_strip (int y, int h)
+{
+    /* Check whether requested band falls in the logical view window. */
+    if (h <= 0 || y < 0 || y + h > SCROLL_Y_DIM)
+	return -1;
+
+    return draw_rect (0, y, SCROLL_X_DIM, h);
+}
+
+
+/*
+ * draw_vert_strip
+ *   DESCRIPTION: Draw a band of vertical map lines into the build 
+ *                buffer, as uncovered by scrolling the logical view 
+ *                window horizontally by w pixels.  The band is drawn 
+ *                column by column with the vertical line function, 
+ *                since each column of the build buffer lies in one 
+ *                plane and the line function can copy it from a column
+ *                by column copy of the photo, which is much faster than
+ *                reading one or two pixels from each of 200 photo rows.
+ *   INPUTS: x -- the 0-based pixel column number of the first line of
+ *                the band within the logical view window
+ *           w -- the number of lines in the band
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If the band is empty or does 
+ *                 not lie within the SCROLL range, the function returns
+ *                 -1.  
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+int
+draw_vert_strip (int x, int w)
+{
+    unsigned char buf[SCROLL_Y_DIM]; /* buffer for graphical image of line */
+    int col;                         /* index over columns                 */
+
+    /* Check whether requested band falls in the logical view window. */
+    if (w <= 0 || x < 0 || x + w > SCROLL_X_DIM)
+	return -1;
+
+    /* Copy each column's image into its plane of the build buffer. */
+    mark_valid (x + show_x, show_y, w, SCROLL_Y_DIM);
+    mark_stale (x + show_x, show_y, w, SCROLL_Y_DIM);
+    for (col = x + show_x; col < x + w + show_x; col++) {
+	(*vert_line_fn) (col, show_y, buf);
+	write_col (col, show_y, buf);
+    }
+
+    /* Return success. */
+    return 0;
+}
+
+
+/*
+ * draw_rect
+ *   DESCRIPTION: Draw a rectangle of the logical view window into the 
+ *                build buffer, with one call to the function given to
+ *                set_rect_fill_fn (or, if none was given, one call to
+ *                the horizontal line function per row).  The rectangle
+ *                is clipped to the logical view window.
+ *   INPUTS: (x,y) -- upper left pixel of the rectangle within the 
+ *                    logical view window
+ *           (w,h) -- width and height of the rectangle
+ *   OUTPUTS: none
+ *   RETURN VALUE: Returns 0 on success.  If no part of the rectangle
+ *                 falls in the logical view window, the function 
+ *                 returns -1.
+ *   SIDE EFFECTS: draws into the build buffer
+ */   
+int
+draw_rect (int x, int y, int w, int h)
+{
+    unsigned char buf[SCROLL_X_DIM]; /* buffer for graphical image of line */
+    unsigned char* plane[4];         /* build buffer planes, by (x & 3)    */
+    unsigned char* base;             /* address of logical (0,0) in plane  */
+    				     /*     image of plane 3               */
+    int px, py;                      /* upper left of one piece            */
+    int pw, ph;                      /* size of one piece                  */
+    int row;                         /* index over rows                    */
+    int i;			     /* loop index over planes             */
+
+    /* Clip the rectangle to the logical view window. */
+    if (x < 0) {
+        w += x;
+	x = 0;
+    }
+    if (y < 0) {
+        h += y;
+	y = 0;
+    }
+    if (x + w > SCROLL_X_DIM)
+        w = SCROLL_X_DIM - x;
+    if (y + h > SCROLL_Y_DIM)
+        h = SCROLL_Y_DIM - y;
+    if (w <= 0 || h <= 0)
+        return -1;
+
+    /* Adjust (x,y) to the logical values. */
+    x += show_x;
+    y += show_y;
+    mark_valid (x, y, w, h);
+    mark_stale (x, y, w, h);
+
+    /* 
+     * Let the rectangle function draw straight into the planes.  In 
+     * toroidal mode, the rectangle is drawn in up to four pieces, split
+     * where it wraps around the plane images; within a piece, the usual
+     * addressing holds once the planes are offset appropriately.
+     */
+    if (rect_fill_fn != NULL) {
+	for (py = y; py < y + h; py += ph) {
+	    ph = y + h - py;
+	    if (torus_mode && ph > SCROLL_Y_DIM - wrap_coord (py, SCROLL_Y_DIM))
+	        ph = SCROLL_Y_DIM - wrap_coord (py, SCROLL_Y_DIM);
+	    for (px = x; px < x + w; px += pw) {
+		pw = x + w - px;
+		if (torus_mode && 
+		    pw > SCROLL_X_DIM - wrap_coord (px, SCROLL_X_DIM))
+		    pw = SCROLL_X_DIM - wrap_coord (px, SCROLL_X_DIM);
+		base = group_addr (px, py) - (px >> 2) - py * SCROLL_X_WIDTH;
+		for (i = 0; i < 4; i++)
+		    plane[i] = base + (3 - i) * SCROLL_SIZE;
+		(*rect_fill_fn) (px, py, pw, ph, plane, SCROLL_X_WIDTH);
+	    }
 	}
+	return 0;
+    }
+
+    /* Otherwise, draw the rectangle's part of each row. */
+    for (row = y; row < y + h; row++) {
+	(*horiz_line_fn) (show_x, row, buf);
+	write_row (x, row, w, buf + (x - show_x));
     }
 
     /* Return success. */
@@ -703,12 +1552,24 @@ draw_horiz_line (int y)
  *                to access VGA ports.
  *   INPUTS: none
  *   OUTPUTS: none
+ *                In a headless build, allocate emulated video memory
+ *                instead.
  *   RETURN VALUE: 0 on success, -1 on failure
  *   SIDE EFFECTS: prints an error message to stdout on failure
  */   
 static int
 open_memory_and_ports ()
 {
+#if defined(MODEX_HEADLESS)
+    /* Allocate emulated video memory (once). */
+    if (emu_planes == NULL && 
+        (emu_planes = calloc (4, VID_MEM_SIZE)) == NULL) {
+	perror ("allocate emulated video memory");
+	return -1;
+    }
+    mem_image = emu_planes;
+    return 0;
+#else
     int mem_fd;  /* file descriptor for physical memory image */
 
     /* Obtain permission to access ports 0x03C0 through 0x03DA. */
@@ -733,6 +1594,7 @@ open_memory_and_ports ()
     /* Close /dev/mem file descriptor and return success. */
     (void)close (mem_fd);
     return 0;
+#endif
 }
 
 
@@ -753,6 +1615,10 @@ VGA_blank (int blank_bit)
      */
     blank_bit = ((blank_bit & 1) << 5);
 
+#if defined(MODEX_HEADLESS)
+    OUTB (0x03C4, 0x01);
+    OUTB (0x03C5, (emu_seq[1] & 0xDF) | blank_bit);
+#else
     asm volatile (
 	"movb $0x01,%%al         /* Set sequencer index to 1. */       ;"
 	"movw $0x03C4,%%dx                                             ;"
@@ -768,6 +1634,7 @@ VGA_blank (int blank_bit)
 	"movb $0x20,%%al                                               ;"
 	"outb %%al,(%%dx)                                               "
       : : "g" (blank_bit) : "eax", "edx", "memory");
+#endif
 }
 
 
@@ -835,9 +1702,11 @@ static void
 set_attr_registers (unsigned char table[NUM_ATTR_REGS * 2])
 {
     /* Reset attribute register to write index next rather than data. */
+#if !defined(MODEX_HEADLESS)
     asm volatile (
 	"inb (%%dx),%%al"
       : : "d" (0x03DA) : "eax", "memory");
+#endif
     REP_OUTSB (0x03C0, table, NUM_ATTR_REGS * 2);
 }
 
@@ -1022,7 +1891,7 @@ write_font_data ()
 static void
 set_text_mode_3 (int clear_scr)
 {
-    unsigned long* txt_scr; /* pointer to text screens in video memory */
+    unsigned int* txt_scr;  /* pointer to text screens in video memory */
     int i;                  /* loop over text screen words             */
 
     VGA_blank (1);                               /* blank the screen        */
@@ -1037,7 +1906,7 @@ set_text_mode_3 (int clear_scr)
     set_graphics_registers (text_graphics);      /* graphics registers      */
     fill_palette_text ();			 /* palette colors          */
     if (clear_scr) {				 /* clear screens if needed */
-	txt_scr = (unsigned long*)(mem_image + 0x18000); 
+	txt_scr = (unsigned int*)(mem_image + 0x18000); 
 	for (i = 0; i < 8192; i++)
 	    *txt_scr++ = 0x07200720;
     }
@@ -1048,30 +1917,72 @@ set_text_mode_3 (int clear_scr)
 
 /*
  * copy_image
- *   DESCRIPTION: Copy one plane of a screen from the build buffer to the 
- *                video memory.
- *   INPUTS: img -- a pointer to a single screen plane in the build buffer
+ *   DESCRIPTION: Copy rows of one plane of a screen from the build buffer
+ *                to the video memory.
+ *   INPUTS: img -- a pointer to the first row in a single screen plane 
+ *                  in the build buffer
  *           scr_addr -- the destination offset in video memory
+ *           n_bytes -- the number of bytes to copy (SCROLL_SIZE for a 
+ *                      whole plane)
  *   OUTPUTS: none
  *   RETURN VALUE: none
  *   SIDE EFFECTS: copies a plane from the build buffer to video memory
  */   
 static void
-copy_image (unsigned char* img, unsigned short scr_addr)
+copy_image (unsigned char* img, unsigned short scr_addr, int n_bytes)
 {
-    /* 
-     * memcpy is actually probably good enough here, and is usually
-     * implemented using ISA-specific features like those below,
-     * but the code here provides an example of x86 string moves
-     */
-    asm volatile (
-        "cld                                                 ;"
-       	"movl $16000,%%ecx                                   ;"
-       	"rep movsb    # copy ECX bytes from M[ESI] to M[EDI]  "
-      : /* no outputs */
-      : "S" (img), "D" (mem_image + scr_addr) 
-      : "eax", "ecx", "memory"
-    );
+    (*copy_engine_func[copy_engine]) (mem_image + scr_addr, img, n_bytes);
+}
+
+
+/*
+ * copy_torus_plane
+ *   DESCRIPTION: Copy rows of one plane of the logical view window from
+ *                a toroidal build buffer to the video memory.  The window
+ *                starts at some row and column of the plane image and 
+ *                wraps around it, so the rows are copied in up to four
+ *                pieces: two blocks of whole rows if the window starts
+ *                at the first column of the image, or two pieces of 
+ *                each row otherwise, each with the selected copy engine.
+ *   INPUTS: px -- the first logical pixel of the plane's part of the 
+ *                 window (on its top row)
+ *           scr_addr -- the offset in video memory of the plane's page
+ *           first -- the first window row to copy
+ *           n_rows -- the number of rows to copy
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: copies a plane from the build buffer to video memory
+ */
+static void
+copy_torus_plane (int px, unsigned short scr_addr, int first, int n_rows)
+{
+    unsigned char* image; /* plane image holding the plane       */
+    unsigned char* dst;   /* destination of next copy            */
+    int col;              /* column of image in which rows start */
+    int row;              /* row of image of first row copied    */
+    int n;                /* rows copied before wrapping         */
+    int i;                /* loop index over rows                */
+
+    image = img3 + (3 - (px & 3)) * SCROLL_SIZE;
+    col = wrap_coord (px >> 2, SCROLL_X_WIDTH);
+    row = wrap_coord (show_y + first, SCROLL_Y_DIM);
+    dst = mem_image + scr_addr + first * SCROLL_X_WIDTH;
+    if (col == 0) {
+        n = (n_rows < SCROLL_Y_DIM - row ? n_rows : SCROLL_Y_DIM - row);
+	(*copy_engine_func[copy_engine]) (dst, image + row * SCROLL_X_WIDTH,
+					  n * SCROLL_X_WIDTH);
+	(*copy_engine_func[copy_engine]) (dst + n * SCROLL_X_WIDTH, image,
+					  (n_rows - n) * SCROLL_X_WIDTH);
+	return;
+    }
+    for (i = 0; i < n_rows; i++, dst += SCROLL_X_WIDTH) {
+	(*copy_engine_func[copy_engine]) (dst, image + row * SCROLL_X_WIDTH + col, 
+					  SCROLL_X_WIDTH - col);
+	(*copy_engine_func[copy_engine]) (dst + SCROLL_X_WIDTH - col, 
+					  image + row * SCROLL_X_WIDTH, col);
+	if (++row == SCROLL_Y_DIM)
+	    row = 0;
+    }
 }
 
 
@@ -1089,21 +2000,484 @@ copy_image (unsigned char* img, unsigned short scr_addr)
 static void
 copy_status_bar (unsigned char* bar, unsigned short scr_addr)
 {
-    /* 
-     * memcpy is actually probably good enough here, and is usually
-     * implemented using ISA-specific features like those below,
-     * but the code here provides an example of x86 string moves
-     */
+    (*copy_engine_func[copy_engine]) (mem_image + scr_addr, bar, 
+    				      STATUS_BAR_SCROLL_SIZE);
+}
+
+
+#if defined(MODEX_X86)
+
+/*
+ * copy_movsb
+ *   DESCRIPTION: Copy bytes to video memory with a single x86 string 
+ *                move of one byte per iteration.  In a virtual machine
+ *                that emulates the VGA, this is often much faster than
+ *                anything else, since the whole copy is one instruction.
+ *   INPUTS: src -- the source
+ *           n_bytes -- the number of bytes to copy
+ *   OUTPUTS: dst -- the destination
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+copy_movsb (unsigned char* dst, const unsigned char* src, int n_bytes)
+{
+    /* rep uses all of RCX on x86-64, so the count must fill it. */
+    unsigned long n = n_bytes; /* number of bytes */
+
+    asm volatile (
+        "cld                                                 ;"
+       	"rep movsb    # copy CX bytes from M[SI] to M[DI]     "
+      : "+S" (src), "+D" (dst), "+c" (n)
+      : /* no other inputs */
+      : "memory"
+    );
+}
+
+
+/*
+ * copy_movsd
+ *   DESCRIPTION: Copy bytes to video memory with an x86 string move of 
+ *                four bytes per iteration, followed by one of a byte 
+ *                per iteration for any remaining bytes.
+ *   INPUTS: src -- the source
+ *           n_bytes -- the number of bytes to copy
+ *   OUTPUTS: dst -- the destination
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+copy_movsd (unsigned char* dst, const unsigned char* src, int n_bytes)
+{
+    /* rep uses all of RCX on x86-64, so the counts must fill it. */
+    unsigned long n_words = n_bytes >> 2; /* number of four-byte words */
+    unsigned long n_left = n_bytes & 3;   /* number of bytes left over */
+
     asm volatile (
         "cld                                                 ;"
-       	"movl $1440,%%ecx                                   ;"
-       	"rep movsb    # copy ECX bytes from M[ESI] to M[EDI]  "
-      : /* no outputs */
-      : "S" (bar), "D" (mem_image + scr_addr) 
-      : "eax", "ecx", "memory"
+       	"rep movsl    # copy CX words from M[SI] to M[DI]     "
+      : "+S" (src), "+D" (dst), "+c" (n_words)
+      : /* no other inputs */
+      : "memory"
+    );
+    asm volatile (
+       	"rep movsb    # copy the remaining bytes              "
+      : "+S" (src), "+D" (dst), "+c" (n_left)
+      : /* no other inputs */
+      : "memory"
     );
 }
 
+
+/*
+ * copy_sse2_nt
+ *   DESCRIPTION: Copy bytes to video memory 16 at a time with SSE2 
+ *                non-temporal stores, which write around the cache 
+ *                rather than reading each destination line into it.
+ *                Bytes before the first 16-byte boundary of the 
+ *                destination, and after the last, are copied with 
+ *                memcpy.  The function is compiled for SSE2 by itself,
+ *                so the rest of the program need not be.
+ *   INPUTS: src -- the source
+ *           n_bytes -- the number of bytes to copy
+ *   OUTPUTS: dst -- the destination
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+__attribute__ ((target ("sse2")))
+static void
+copy_sse2_nt (unsigned char* dst, const unsigned char* src, int n_bytes)
+{
+    int head; /* bytes before the first 16-byte boundary */
+
+    head = (16 - ((unsigned long)dst & 15)) & 15;
+    if (head > n_bytes)
+        head = n_bytes;
+    (void)memcpy (dst, src, head);
+    dst += head;
+    src += head;
+    n_bytes -= head;
+    for (; n_bytes >= 16; n_bytes -= 16, dst += 16, src += 16)
+        _mm_stream_si128 ((__m128i*)dst, 
+			  _mm_loadu_si128 ((const __m128i*)src));
+    _mm_sfence ();
+    (void)memcpy (dst, src, n_bytes);
+}
+
+#endif /* MODEX_X86 */
+
+
+/*
+ * copy_memcpy
+ *   DESCRIPTION: Copy bytes to video memory with the C library's memcpy,
+ *                which usually picks among wide copies itself.
+ *   INPUTS: src -- the source
+ *           n_bytes -- the number of bytes to copy
+ *   OUTPUTS: dst -- the destination
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */   
+static void
+copy_memcpy (unsigned char* dst, const unsigned char* src, int n_bytes)
+{
+    (void)memcpy (dst, src, n_bytes);
+}
+
+
+/*
+ * calibrate_copy_engines
+ *   DESCRIPTION: Time each copy engine that the processor supports by 
+ *                copying a plane of the build buffer to the page of 
+ *                video memory not on display (real or emulated), and 
+ *                use the fastest.  A single copy takes about as long as
+ *                the clock's resolution, so each timing covers a batch
+ *                of copies lasting at least CALIBRATE_NSEC; the best
+ *                of a few batches, divided by the bytes copied, is kept
+ *                as the engine's bandwidth.  Must be called in mode X,
+ *                before video memory is cleared.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory; sets copy_engine and copy_mbps
+ */   
+static void
+calibrate_copy_engines ()
+{
+    static const int n_reps = 4; /* batches timed per engine     */
+    unsigned char* dst;          /* destination of copies        */
+    struct timespec start, end;  /* times around one batch       */
+    double secs, best;           /* time per byte; best time     */
+    long n_copies;               /* copies in a batch            */
+    int engine;                  /* index over engines           */
+    int fastest;                 /* fastest engine so far        */
+    int i;                       /* index over batches           */
+    long j;                      /* index over copies in batch   */
+
+    SET_WRITE_MASK (0x0100);
+    dst = mem_image + PAGE_ADDR (shown_page == 0 ? 1 : 0);
+    fastest = COPY_MEMCPY;
+    (void)memset (copy_mbps, 0, sizeof (copy_mbps));
+    for (engine = 0; engine < NUM_COPY_ENGINES; engine++) {
+	if (!copy_engine_supported (engine))
+	    continue;
+	best = 0;
+	n_copies = 1;
+	for (i = 0; i < n_reps; i++) {
+	    (void)clock_gettime (CLOCK_MONOTONIC, &start);
+	    for (j = 0; j < n_copies; j++)
+		(*copy_engine_func[engine]) (dst, img3, SCROLL_SIZE);
+	    (void)clock_gettime (CLOCK_MONOTONIC, &end);
+	    secs = (end.tv_sec - start.tv_sec) + 
+	    	   (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+	    /* Batches too short to time well are doubled, not counted. */
+	    if (secs < CALIBRATE_NSEC * 1e-9) {
+	        n_copies *= 2;
+		i--;
+		continue;
+	    }
+	    secs /= (double)n_copies * SCROLL_SIZE;
+	    if (best == 0 || secs < best)
+	        best = secs;
+	}
+	copy_mbps[engine] = 1 / best / 1e6;
+	if (copy_mbps[engine] > copy_mbps[fastest])
+	    fastest = engine;
+    }
+    copy_engine = fastest;
+}
+
+
+/*
+ * copy_engine_supported
+ *   DESCRIPTION: Check whether the processor can run a copy engine.
+ *   INPUTS: engine -- the engine
+ *   OUTPUTS: none
+ *   RETURN VALUE: 1 if it can, 0 if not
+ *   SIDE EFFECTS: none
+ */   
+int
+copy_engine_supported (copy_engine_t engine)
+{
+    switch (engine) {
+        case COPY_MEMCPY:
+	    return 1;
+#if defined(MODEX_X86)
+	case COPY_MOVSB:
+	case COPY_MOVSD:
+	    return 1;
+	case COPY_SSE2_NT:
+	    return (0 != __builtin_cpu_supports ("sse2"));
+#endif
+	default:
+	    return 0;
+    }
+}
+
+
+/*
+ * set_copy_engine
+ *   DESCRIPTION: Make copies to video memory use a particular engine 
+ *                until the next call to set_mode_X.
+ *   INPUTS: engine -- the engine
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the processor can't run the engine
+ *                 (in which case the engine in use is not changed)
+ *   SIDE EFFECTS: changes the engine used by show_screen and 
+ *                 show_status_bar
+ */   
+int
+set_copy_engine (copy_engine_t engine)
+{
+    if (!copy_engine_supported (engine))
+        return -1;
+    copy_engine = engine;
+    return 0;
+}
+
+
+/*
+ * get_copy_engine
+ *   DESCRIPTION: Find the engine used for copies to video memory.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the engine
+ *   SIDE EFFECTS: none
+ */   
+copy_engine_t
+get_copy_engine ()
+{
+    return copy_engine;
+}
+
+
+/*
+ * copy_engine_bandwidth
+ *   DESCRIPTION: Get the bandwidth of a copy engine measured by the last
+ *                call to set_mode_X.
+ *   INPUTS: engine -- the engine
+ *   OUTPUTS: none
+ *   RETURN VALUE: the bandwidth in MB/s, or 0 if it was not measured
+ *   SIDE EFFECTS: none
+ */   
+double
+copy_engine_bandwidth (copy_engine_t engine)
+{
+    return (NUM_COPY_ENGINES > (unsigned)engine ? copy_mbps[engine] : 0);
+}
+
+
+/*
+ * copy_engine_name
+ *   DESCRIPTION: Get the name of a copy engine.
+ *   INPUTS: engine -- the engine
+ *   OUTPUTS: none
+ *   RETURN VALUE: the name
+ *   SIDE EFFECTS: none
+ */   
+const char*
+copy_engine_name (copy_engine_t engine)
+{
+    return (NUM_COPY_ENGINES > (unsigned)engine ? 
+	    copy_engine_label[engine] : "?");
+}
+
+#if defined(MODEX_HEADLESS)
+
+/*
+ * emu_outb
+ *   DESCRIPTION: Emulate a byte write to a VGA port in a headless build.
+ *                Sequencer, CRTC, and DAC writes are recorded; writes to
+ *                other ports are ignored.  Selecting a single plane with
+ *                the sequencer map mask points mem_image at that plane.
+ *   INPUTS: port -- the port
+ *           val -- the value written
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes emulated VGA state
+ */   
+static void
+emu_outb (unsigned short port, unsigned char val)
+{
+    int i; /* index over planes */
+
+    switch (port) {
+        case 0x03C4: emu_seq_index = val & 7; break;
+	case 0x03C5:
+	    emu_seq[emu_seq_index] = val;
+	    if (emu_seq_index == 2 && emu_planes != NULL) {
+		for (i = 0; i < 4 && (val & (1 << i)) == 0; i++);
+		if (i < 4)
+		    mem_image = emu_planes + i * VID_MEM_SIZE;
+	    }
+	    break;
+	case 0x03D4: emu_CRTC_index = val; break;
+	case 0x03D5:
+	    /* Latch the old start address if a retrace has begun. */
+	    if (emu_CRTC_index == 0x0C || emu_CRTC_index == 0x0D)
+	        emu_latch_start ();
+	    if (emu_CRTC_index < NUM_CRTC_REGS)
+		emu_CRTC[emu_CRTC_index] = val;
+	    break;
+	case 0x03C8: emu_dac_index = val * 3; break;
+	case 0x03C9:
+	    emu_dac[emu_dac_index / 3][emu_dac_index % 3] = val & 0x3F;
+	    emu_dac_index = (emu_dac_index + 1) % (256 * 3);
+	    break;
+	default: break;
+    }
+}
+
+
+/*
+ * emu_outw
+ *   DESCRIPTION: Emulate a word write to two consecutive VGA ports in a
+ *                headless build.
+ *   INPUTS: port -- the first port (which receives the low byte)
+ *           val -- the value written
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes emulated VGA state
+ */   
+static void
+emu_outw (unsigned short port, unsigned short val)
+{
+    emu_outb (port, val & 0xFF);
+    emu_outb (port + 1, val >> 8);
+}
+
+
+/*
+ * emu_inb
+ *   DESCRIPTION: Emulate a byte read from a VGA port in a headless build.
+ *                Only input status register 1 (0x3DA) is emulated, for
+ *                a display of 449 lines of 31.778 microseconds each 
+ *                (70 Hz), with lines 400 to 448 blanked and vertical
+ *                retrace during lines 412 and 413, as set up by the 
+ *                mode X CRTC registers.  Frames start at every multiple
+ *                of the frame time on the monotonic clock.  Other ports
+ *                read as 0.
+ *   INPUTS: port -- the port
+ *   OUTPUTS: none
+ *   RETURN VALUE: the value read
+ *   SIDE EFFECTS: none
+ */   
+static unsigned char
+emu_inb (unsigned short port)
+{
+    long long line; /* index of current line in frame */
+
+    if (port != 0x03DA)
+        return 0;
+    emu_latch_start ();
+    line = emu_line () % 449;
+    return ((line >= 400 ? 0x01 : 0x00) | 
+    	    (line >= 412 && line < 414 ? 0x08 : 0x00));
+}
+
+
+/*
+ * emu_line
+ *   DESCRIPTION: Find the number of lines that the emulated display has
+ *                begun (see emu_inb) since time 0 of the monotonic clock.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the number of lines
+ *   SIDE EFFECTS: none
+ */   
+static long long
+emu_line ()
+{
+    struct timespec now; /* current time */
+
+    (void)clock_gettime (CLOCK_MONOTONIC, &now);
+    return ((long long)now.tv_sec * 1000000000 + now.tv_nsec) / 31778;
+}
+
+
+/*
+ * emu_latch_start
+ *   DESCRIPTION: Latch the CRTC start address into emu_start if a 
+ *                vertical retrace (line 412 of a frame) has begun since
+ *                the last call.  Called before the start address 
+ *                registers change and before the display is read, so 
+ *                the registers have not changed since that retrace.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may change emu_start
+ */   
+static void
+emu_latch_start ()
+{
+    long long retraces; /* retraces begun so far */
+
+    retraces = (emu_line () + 449 - 412) / 449;
+    if (retraces != emu_retraces) {
+	emu_retraces = retraces;
+	emu_start = (emu_CRTC[0x0C] << 8) | emu_CRTC[0x0D];
+    }
+}
+
+
+/*
+ * dump_frame_ppm
+ *   DESCRIPTION: Write the frame that the emulated VGA would display to a
+ *                binary PPM file, in a headless build.  The frame is 
+ *                read from emulated video memory at the start address
+ *                latched at the last vertical retrace, switching to address 0 at the line compare 
+ *                row (where the status bar is shown), and colored with
+ *                the emulated DAC palette.  Horizontal pixel panning is
+ *                not emulated.  A blanked display is dumped as black.
+ *   INPUTS: fname -- the file name
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: writes the file
+ */   
+int
+dump_frame_ppm (const char* fname)
+{
+    unsigned char rgb[IMAGE_X_DIM * 3]; /* one row of the frame       */
+    FILE* f;          /* the file                                     */
+    int start;        /* CRTC start address                           */
+    int pitch;        /* bytes between rows in video memory           */
+    int scan;         /* scan lines per row                           */
+    int split;        /* first row shown from address 0               */
+    int addr;         /* address of row in video memory               */
+    int x, y;         /* pixel in frame                               */
+    int c;            /* index over color components                  */
+    unsigned char v;  /* pixel value                                  */
+
+    if (emu_planes == NULL || (f = fopen (fname, "wb")) == NULL)
+        return -1;
+    emu_latch_start ();
+    start = emu_start;
+    pitch = 2 * emu_CRTC[0x13];
+    scan = (emu_CRTC[0x09] & 0x1F) + 1;
+    split = (emu_CRTC[0x18] | ((emu_CRTC[0x07] & 0x10) << 4) | 
+    	     ((emu_CRTC[0x09] & 0x40) << 3)) + 1;
+    split = (split + scan - 1) / scan;
+    fprintf (f, "P6\n%d %d\n255\n", IMAGE_X_DIM, IMAGE_Y_DIM);
+    for (y = 0; y < IMAGE_Y_DIM; y++) {
+	addr = (y < split ? start + y * pitch : (y - split) * pitch);
+	for (x = 0; x < IMAGE_X_DIM; x++) {
+	    v = emu_planes[(x & 3) * VID_MEM_SIZE + 
+	    		   ((addr + (x >> 2)) & (MODE_X_MEM_SIZE - 1))];
+	    for (c = 0; c < 3; c++)
+		rgb[x * 3 + c] = ((emu_seq[1] & 0x20) != 0 ? 0 :
+				  (emu_dac[v][c] << 2) | (emu_dac[v][c] >> 4));
+	}
+	if (fwrite (rgb, sizeof (rgb), 1, f) != 1) {
+	    (void)fclose (f);
+	    return -1;
+	}
+    }
+    return (fclose (f) == 0 ? 0 : -1);
+}
+
+#endif /* defined(MODEX_HEADLESS) */
+
+
 #if defined(TEXT_RESTORE_PROGRAM)
 
 /*
@@ -60,7 +60,7 @@
 #define SCROLL_Y_DIM    IMAGE_Y_DIM                /* full image width      */
 #define SCROLL_X_WIDTH  (IMAGE_X_DIM / 4)          /* addresses (bytes)     */
 #define STATUS_BAR_SCROLL_SIZE			1440	   /* the size of one plane status bar*/
-unsigned char text_image[5760];	/*the buffer of the status bar*/
+extern unsigned char text_image[5760];	/*the buffer of the status bar (text.c)*/
 
 
 
@@ -115,12 +115,64 @@ unsigned char text_image[5760];	/*the buffer of the status bar*/
  * is drawn.  Other data are left untouched in most cases.
  */
 
+/* the ways of copying the build buffer to video memory */
+typedef enum {
+    COPY_MOVSB,   /* one byte per iteration of REP MOVSB (x86)       */
+    COPY_MOVSD,   /* four bytes per iteration of REP MOVSD (x86)     */
+    COPY_SSE2_NT, /* 16 bytes per non-temporal store (x86 SSE2)      */
+    COPY_MEMCPY,  /* the C library's memcpy                          */
+    NUM_COPY_ENGINES
+} copy_engine_t;
+
 /* configure VGA for mode X; initializes logical view to (0,0) */
 extern int set_mode_X (void (*horiz_fill_fn)
                             (int, int, unsigned char[SCROLL_X_DIM]),
 		       void (*vert_fill_fn) 
 		            (int, int, unsigned char[SCROLL_Y_DIM]));
 
+/* 
+ * set up the build buffer and line callbacks without touching the VGA 
+ * (done by set_mode_X as well)
+ */
+extern int init_build_buffer (void (*horiz_fill_fn)
+                                   (int, int, unsigned char[SCROLL_X_DIM]),
+		              void (*vert_fill_fn) 
+		                   (int, int, unsigned char[SCROLL_Y_DIM]));
+
+/* 
+ * provide a callback that draws rectangles straight into the build buffer
+ * planes (NULL for none)
+ */
+extern void set_rect_fill_fn (void (*fill_fn) (int, int, int, int, 
+					       unsigned char* [4], int));
+
+/* 
+ * keep the build buffer as four toroidal plane images (non-zero) or in 
+ * linear mode (0, the default); the view must then be redrawn
+ */
+extern void set_toroidal_build (int enable);
+
+/* 
+ * find whether the processor can use a copy engine; set_mode_X times 
+ * each one that it can and picks the fastest
+ */
+extern int copy_engine_supported (copy_engine_t engine);
+
+/* force use of one copy engine (for testing); returns -1 if unsupported */
+extern int set_copy_engine (copy_engine_t engine);
+
+/* copy engine in use */
+extern copy_engine_t get_copy_engine ();
+
+/* 
+ * bandwidth of a copy engine in MB/s, as measured by set_mode_X (0 if
+ * it was not measured)
+ */
+extern double copy_engine_bandwidth (copy_engine_t engine);
+
+/* name of a copy engine, for printing */
+extern const char* copy_engine_name (copy_engine_t engine);
+
 /* return to text mode */
 extern void clear_mode_X ();
 
@@ -130,6 +182,18 @@ extern void set_view_window (int scr_x, int scr_y);
 /* show the logical view window on the monitor */
 extern void show_screen ();
 
+/* 
+ * queue pages for the next vertical retrace (non-zero) rather than 
+ * showing them at once (0, the default)
+ */
+extern void set_triple_buffering (int enable);
+
+/* 
+ * move a queued page towards the display (see modex.c); returns 1 if one
+ * was shown, 0 if one is still queued or pending, or -1 if neither
+ */
+extern int poll_page_flip ();
+
 /* show the status bar*/
 extern void show_status_bar (const char * input, int mode);
 
@@ -142,4 +206,19 @@ extern int draw_horiz_line (int y);
 /* draw a vertical line at horizontal pixel x within the logical view window */
 extern int draw_vert_line (int x);
 
+/* draw h horizontal lines from vertical pixel y within the logical view window */
+extern int draw_horiz_strip (int y, int h);
+
+/* draw w vertical lines from horizontal pixel x within the logical view window */
+extern int draw_vert_strip (int x, int w);
+
+/* draw a rectangle (w x h pixels at (x,y)) within the logical view window */
+extern int draw_rect (int x, int y, int w, int h);
+
+/* 
+ * write the frame shown by the emulated VGA to a PPM file (only in 
+ * headless builds, with MODEX_HEADLESS defined)
+ */
+extern int dump_frame_ppm (const char* fname);
+
 #endif /* MODEX_H */
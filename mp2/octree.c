@@ -0,0 +1,442 @@
+/*									tab:8
+ *
+ * octree.c - reducible octree color quantizer
+ *
+ * Version:	    1
+ * Filename:	    octree.c
+ * History:
+ *	1	First written.
+ */
+
+/*
+ * The quantizer places the colors of a photo into an octree up to
+ * OCTREE_MAX_DEPTH levels deep, then merges the children of the least
+ * populated nodes into their parents, deepest level first, until no
+ * more leaves remain than the palette can hold.  Each leaf becomes one
+ * palette color, the average of the pixels beneath it.
+ *
+ * Pixels are first counted by 5:6:5 color, so the tree is built from
+ * the distinct colors of a photo rather than from every pixel.  The
+ * number of nodes at each level is also found from those colors before
+ * the tree is built.  Whenever a whole level would have to be merged
+ * into the level above it, the tree is simply not built that deep,
+ * which gives the same palette for much less work.  At most one level
+ * is then merged node by node.
+ *
+ * The nodes of a tree are carved out of a single allocation (an arena)
+ * and referred to by index within it.  Arenas are kept in a pool when
+ * not in use so that photos read one after another (or by a few threads
+ * at once) do not allocate and fault in fresh memory each time.
+ */
+
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "octree.h"
+
+
+/* one node of the octree */
+typedef struct oct_node_t oct_node_t;
+struct oct_node_t {
+    int32_t  child[8];		/* arena index of each child, or -1  */
+    uint32_t count;		/* pixels beneath node               */
+    uint32_t red;		/* sum of 6-bit red over those       */
+    uint32_t green;		/* sum of 6-bit green over those     */
+    uint32_t blue;		/* sum of 6-bit blue over those      */
+    uint8_t  level;		/* depth in tree, 0 for root         */
+    uint8_t  leaf;		/* 1 if a leaf (possibly by merging) */
+    int16_t  palette_idx;	/* palette entry of leaf, or -1      */
+};
+
+/* the colors present in the pixels, kept off the stack (384 kB) */
+typedef struct oct_tally_t oct_tally_t;
+struct oct_tally_t {
+    uint32_t     counts[65536];	/* pixels of each 5:6:5 color        */
+    uint16_t     colors[65536];	/* the colors present, in order      */
+};
+
+/* the nodes of one octree, along with space to sort them */
+typedef struct oct_arena_t oct_arena_t;
+struct oct_arena_t {
+    oct_node_t*  node;		/* space for the nodes               */
+    uint64_t*    key;		/* space for sorting nodes           */
+    uint32_t     n_alloc;	/* number of nodes (and keys) room   */
+    uint32_t     n_used;	/* number of nodes handed out        */
+    uint8_t      depth;		/* level of the deepest nodes        */
+    oct_arena_t* next;		/* next arena in pool                */
+};
+
+
+/* local functions--see function headers for details */
+static oct_arena_t* get_arena (uint32_t n_nodes);
+static void put_arena (oct_arena_t* a);
+static void count_levels (const uint16_t* colors, uint32_t n_colors,
+			  uint32_t n_nodes[OCTREE_MAX_DEPTH + 1]);
+static int32_t new_node (oct_arena_t* a, uint8_t level);
+static uint32_t child_index (uint16_t color, uint8_t level);
+static void insert_color (oct_arena_t* a, uint16_t color, uint32_t count);
+static void reduce_tree (oct_arena_t* a, uint32_t n_leaves,
+			 uint32_t n_colors);
+static int compare_keys (const void* a, const void* b);
+
+
+/* arenas not in use, and a lock for the list */
+static oct_arena_t* arena_pool = NULL;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * octree_quantize (interface function; declared in octree.h)
+ *   DESCRIPTION: Select a palette for an array of 5:6:5 pixels using
+ *                a reducible octree, and find the palette entry to use
+ *                for each color in the pixels.
+ *   INPUTS: pixels -- the 5:6:5 pixels
+ *           n_pixels -- number of pixels
+ *           n_colors -- most palette entries to use (at least 1)
+ *   OUTPUTS: palette -- n_colors 6-bit RGB palette entries; those not
+ *                       needed are set to black
+ *            map -- palette entry for each 5:6:5 color present in the
+ *                   pixels
+ *   RETURN VALUE: 1 on success, 0 if memory cannot be allocated
+ *   SIDE EFFECTS: none
+ */
+int32_t
+octree_quantize (const uint16_t* pixels, uint32_t n_pixels,
+		 uint32_t n_colors, uint8_t palette[][3], uint8_t map[65536])
+{
+    oct_tally_t* t;		/* pixel counts and colors present    */
+    uint32_t*    counts;	/* pixels of each 5:6:5 color         */
+    uint16_t*    colors;	/* the colors present, in order       */
+    uint32_t     n_distinct;	/* number of colors present           */
+    uint32_t     n_nodes[OCTREE_MAX_DEPTH + 1]; /* nodes at each level */
+    uint32_t     total;		/* nodes in tree as built             */
+    uint8_t      depth;		/* level of the deepest nodes built   */
+    uint32_t     i;		/* index over pixels and colors       */
+    uint32_t     next_idx;	/* next palette entry to hand out     */
+    oct_arena_t* a;		/* the octree                         */
+    oct_node_t*  n;		/* current node                       */
+
+    if (1 > n_colors) {
+        n_colors = 1;
+    }
+
+    if (NULL == (t = malloc (sizeof (*t)))) {
+        return 0;
+    }
+    counts = t->counts;
+    colors = t->colors;
+
+    /* Count the pixels of each color, and list the colors present. */
+    (void)memset (counts, 0, sizeof (t->counts));
+    for (i = 0; n_pixels > i; i++) {
+        counts[pixels[i]]++;
+    }
+    for (i = n_distinct = 0; 65536 > i; i++) {
+        if (0 != counts[i]) {
+	    colors[n_distinct++] = i;
+	}
+    }
+
+    /*
+     * Once the levels below it are merged, a level with at least
+     * n_colors nodes is either the answer or must be merged too, so
+     * build the tree only down to the shallowest such level.
+     */
+    count_levels (colors, n_distinct, n_nodes);
+    for (depth = OCTREE_MAX_DEPTH; 0 < depth && n_colors <= n_nodes[depth - 1];
+	 depth--) {
+    }
+    for (i = total = 0; depth >= i; i++) {
+        total += n_nodes[i];
+    }
+    if (NULL == (a = get_arena (total + 1))) {
+        free (t);
+        return 0;
+    }
+    a->depth = depth;
+
+    /* Build the tree, then merge nodes until the palette is big enough. */
+    (void)new_node (a, 0);
+    for (i = 0; n_distinct > i; i++) {
+	insert_color (a, colors[i], counts[colors[i]]);
+    }
+    reduce_tree (a, n_nodes[depth], n_colors);
+
+    /*
+     * Find the leaf for each color, handing out palette entries to
+     * the leaves in the order in which they are reached.
+     */
+    for (i = next_idx = 0; n_distinct > i; i++) {
+	for (n = &a->node[0]; !n->leaf; ) {
+	    n = &a->node[n->child[child_index (colors[i], n->level)]];
+	}
+	if (0 > n->palette_idx) {
+	    n->palette_idx = next_idx++;
+	    palette[n->palette_idx][0] = (n->red + n->count / 2) / n->count;
+	    palette[n->palette_idx][1] = (n->green + n->count / 2) / n->count;
+	    palette[n->palette_idx][2] = (n->blue + n->count / 2) / n->count;
+	}
+	map[colors[i]] = n->palette_idx;
+    }
+    for (; n_colors > next_idx; next_idx++) {
+        palette[next_idx][0] = palette[next_idx][1] = palette[next_idx][2] = 0;
+    }
+
+    put_arena (a);
+    free (t);
+    return 1;
+}
+
+
+/*
+ * get_arena
+ *   DESCRIPTION: Take an arena from the pool (or allocate a new one),
+ *                making sure that it has room for a number of nodes.
+ *   INPUTS: n_nodes -- number of nodes needed
+ *   OUTPUTS: none
+ *   RETURN VALUE: an empty arena, or NULL if memory cannot be allocated
+ *   SIDE EFFECTS: may allocate memory
+ */
+static oct_arena_t*
+get_arena (uint32_t n_nodes)
+{
+    oct_arena_t* a;  /* the arena           */
+    oct_node_t*  nn; /* new space for nodes */
+    uint64_t*    nk; /* new space for keys  */
+
+    (void)pthread_mutex_lock (&arena_lock);
+    if (NULL != (a = arena_pool)) {
+        arena_pool = a->next;
+    }
+    (void)pthread_mutex_unlock (&arena_lock);
+
+    if (NULL == a) {
+        if (NULL == (a = malloc (sizeof (*a)))) {
+	    return NULL;
+	}
+	a->node = NULL;
+	a->key = NULL;
+	a->n_alloc = 0;
+    }
+    if (n_nodes > a->n_alloc) {
+        if (NULL != (nn = realloc (a->node, n_nodes * sizeof (nn[0])))) {
+	    a->node = nn;
+	}
+        if (NULL != (nk = realloc (a->key, n_nodes * sizeof (nk[0])))) {
+	    a->key = nk;
+	}
+	if (NULL == nn || NULL == nk) {
+	    put_arena (a);
+	    return NULL;
+	}
+	a->n_alloc = n_nodes;
+    }
+    a->n_used = 0;
+    return a;
+}
+
+
+/*
+ * put_arena
+ *   DESCRIPTION: Return an arena to the pool.
+ *   INPUTS: a -- the arena
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: a may be handed out again by get_arena
+ */
+static void
+put_arena (oct_arena_t* a)
+{
+    (void)pthread_mutex_lock (&arena_lock);
+    a->next = arena_pool;
+    arena_pool = a;
+    (void)pthread_mutex_unlock (&arena_lock);
+}
+
+
+/*
+ * count_levels
+ *   DESCRIPTION: Find how many nodes each level of the octree of a set
+ *                of colors would hold if fully built.
+ *   INPUTS: colors -- the distinct 5:6:5 colors
+ *           n_colors -- number of colors
+ *   OUTPUTS: n_nodes -- number of nodes at each level
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+count_levels (const uint16_t* colors, uint32_t n_colors,
+	      uint32_t n_nodes[OCTREE_MAX_DEPTH + 1])
+{
+    uint8_t  seen[1 << (3 * (OCTREE_MAX_DEPTH - 1))]; /* nodes found */
+    uint32_t level;   /* level being counted          */
+    uint32_t shift;   /* low bits dropped per channel */
+    uint32_t node;    /* a color's node at the level  */
+    uint32_t i;       /* index over colors            */
+
+    n_nodes[0] = (0 < n_colors);
+    n_nodes[OCTREE_MAX_DEPTH] = n_colors;
+    for (level = 1; OCTREE_MAX_DEPTH > level; level++) {
+        (void)memset (seen, 0, 1 << (3 * level));
+	shift = 6 - level;
+	for (i = n_nodes[level] = 0; n_colors > i; i++) {
+	    node = ((((colors[i] >> 10) & 0x3E) >> shift) << (2 * level)) |
+		   ((((colors[i] >> 5) & 0x3F) >> shift) << level) |
+		   (((colors[i] << 1) & 0x3E) >> shift);
+	    n_nodes[level] += !seen[node];
+	    seen[node] = 1;
+	}
+    }
+}
+
+
+/*
+ * new_node
+ *   DESCRIPTION: Hand out an empty node from the arena.
+ *   INPUTS: a -- the arena
+ *           level -- depth of the new node in the tree
+ *   OUTPUTS: none
+ *   RETURN VALUE: arena index of the new node
+ *   SIDE EFFECTS: uses up one node of the arena
+ */
+static int32_t
+new_node (oct_arena_t* a, uint8_t level)
+{
+    oct_node_t* n = &a->node[a->n_used]; /* the new node */
+
+    (void)memset (n->child, 0xFF, sizeof (n->child));
+    n->count = n->red = n->green = n->blue = 0;
+    n->level = level;
+    n->leaf = (a->depth == level);
+    n->palette_idx = -1;
+    return a->n_used++;
+}
+
+
+/*
+ * child_index
+ *   DESCRIPTION: Find which child of a node lies on a color's path.
+ *                The 5:6:5 color is treated as 6 bits per channel (with
+ *                the lowest bit of red and blue always zero), and a node
+ *                at level l splits on bit (5 - l) of each channel.
+ *   INPUTS: color -- the 5:6:5 color
+ *           level -- level of the node
+ *   OUTPUTS: none
+ *   RETURN VALUE: index of the child, from 0 to 7
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+child_index (uint16_t color, uint8_t level)
+{
+    uint32_t red = (color >> 10) & 0x3E;   /* 6-bit red       */
+    uint32_t green = (color >> 5) & 0x3F;  /* 6-bit green     */
+    uint32_t blue = (color << 1) & 0x3E;   /* 6-bit blue      */
+    uint32_t bit = 5 - level;              /* bit to split on */
+
+    return ((((red >> bit) & 1) << 2) | (((green >> bit) & 1) << 1) |
+	    ((blue >> bit) & 1));
+}
+
+
+/*
+ * insert_color
+ *   DESCRIPTION: Add the pixels of one color to the octree, creating
+ *                nodes on its path as necessary.
+ *   INPUTS: a -- the arena holding the tree
+ *           color -- the 5:6:5 color
+ *           count -- number of pixels of that color
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: adds to the sums of every node on the color's path
+ */
+static void
+insert_color (oct_arena_t* a, uint16_t color, uint32_t count)
+{
+    uint32_t red = (color >> 10) & 0x3E;   /* 6-bit red                 */
+    uint32_t green = (color >> 5) & 0x3F;  /* 6-bit green               */
+    uint32_t blue = (color << 1) & 0x3E;   /* 6-bit blue                */
+    int32_t  idx = 0;                      /* current node              */
+    uint32_t next;                         /* child on the color's path */
+    uint8_t  level;                        /* depth of current node     */
+
+    for (level = 0; ; level++) {
+        a->node[idx].count += count;
+	a->node[idx].red += red * count;
+	a->node[idx].green += green * count;
+	a->node[idx].blue += blue * count;
+	if (a->depth == level) {
+	    return;
+	}
+	next = child_index (color, level);
+	if (0 > a->node[idx].child[next]) {
+	    a->node[idx].child[next] = new_node (a, level + 1);
+	}
+	idx = a->node[idx].child[next];
+    }
+}
+
+
+/*
+ * reduce_tree
+ *   DESCRIPTION: Merge the children of the nodes just above the deepest
+ *                level of the tree into their parents, least populated
+ *                node first, until the tree has no more than n_colors
+ *                leaves.  Nodes with equal counts are merged in the
+ *                order in which they were created.  The tree must have
+ *                been built shallow enough that merging the whole
+ *                level would leave fewer than n_colors leaves.
+ *   INPUTS: a -- the arena holding the tree
+ *           n_leaves -- number of leaves in the tree
+ *           n_colors -- most leaves wanted
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks merged nodes as leaves
+ */
+static void
+reduce_tree (oct_arena_t* a, uint32_t n_leaves, uint32_t n_colors)
+{
+    uint32_t    n_keys; /* number of nodes at the level */
+    uint32_t    idx;    /* index over nodes             */
+    uint32_t    k;      /* index over keys              */
+    uint32_t    c;      /* index over children          */
+    oct_node_t* n;      /* node being merged            */
+
+    if (n_colors >= n_leaves) {
+        return;
+    }
+    for (idx = n_keys = 0; a->n_used > idx; idx++) {
+	if (a->depth - 1 == a->node[idx].level) {
+	    a->key[n_keys++] = ((uint64_t)a->node[idx].count << 32) | idx;
+	}
+    }
+    qsort (a->key, n_keys, sizeof (a->key[0]), compare_keys);
+    for (k = 0; n_keys > k && n_colors < n_leaves; k++) {
+	n = &a->node[(uint32_t)a->key[k]];
+	n->leaf = 1;
+	for (c = 0; 8 > c; c++) {
+	    n_leaves -= (0 <= n->child[c]);
+	}
+	n_leaves++;
+    }
+}
+
+
+/*
+ * compare_keys
+ *   DESCRIPTION: Order two node sort keys for qsort.
+ *   INPUTS: a, b -- pointers to the keys
+ *   OUTPUTS: none
+ *   RETURN VALUE: negative if a comes first, positive if b comes first,
+ *                 zero if the keys are equal
+ *   SIDE EFFECTS: none
+ */
+static int
+compare_keys (const void* a, const void* b)
+{
+    uint64_t ka = *(const uint64_t*)a; /* first key  */
+    uint64_t kb = *(const uint64_t*)b; /* second key */
+
+    return (ka < kb ? -1 : (ka > kb));
+}
@@ -0,0 +1,36 @@
+/*									tab:8
+ *
+ * octree.h - reducible octree color quantizer header file
+ *
+ * Version:	    1
+ * Filename:	    octree.h
+ * History:
+ *	1	First written.
+ */
+
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <stdint.h>
+
+/*
+ * Depth of the leaves of a fully built octree.  The VGA palette holds
+ * 6 bits per color channel, so six levels distinguish every color that
+ * the VGA can show.
+ */
+#define OCTREE_MAX_DEPTH 6
+
+/*
+ * Choose a palette of at most n_colors colors for an array of 5:6:5
+ * pixels.  Palette entries are 6-bit RGB triples, as loaded into the
+ * VGA; entries past the number of colors used are set to black.
+ * The map array is filled with the palette entry chosen for each
+ * 5:6:5 color that appears in the pixels (other entries are left
+ * unchanged).  Returns 1 on success, or 0 if memory cannot be
+ * allocated.
+ */
+extern int32_t octree_quantize (const uint16_t* pixels, uint32_t n_pixels,
+				uint32_t n_colors, uint8_t palette[][3],
+				uint8_t map[65536]);
+
+#endif /* OCTREE_H */
@@ -36,10 +36,18 @@
  */
 
 
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "assert.h"
+#include "blend.h"
 #include "modex.h"
+#include "octree.h"
 #include "photo.h"
 #include "photo_headers.h"
 #include "world.h"
@@ -47,6 +55,23 @@
 
 /* types local to this file (declared in types.h) */
 
+/* 
+ * A run of opaque (not OBJ_CLR_TRANSP) pixels in one row or one column
+ * of an object image.  When an image is read while use_object_spans is
+ * set, its runs are found for every row and every column, so that 
+ * drawing the image can copy the runs and skip transparent pixels 
+ * without looking at them.  The runs
+ * of row r are span[first_span[r]] up to (not including)
+ * span[first_span[r + 1]]; those of column c are found in the same way
+ * starting from first_span[height + c].  An image holds at most 16,000
+ * runs, so 16-bit indices are enough.
+ */
+typedef struct obj_span_t obj_span_t;
+struct obj_span_t {
+    uint8_t start;			/* first opaque pixel        */
+    uint8_t len;			/* number of opaque pixels   */
+};
+
 /* 
  * A room photo.  Note that you must write the code that selects the
  * optimized palette colors and fills in the pixel data using them as 
@@ -59,6 +84,14 @@ struct photo_t {
     photo_header_t hdr;			/* defines height and width */
     uint8_t        palette[192][3];     /* optimized palette colors */
     uint8_t*       img;                 /* pixel data               */
+    void*          cache;		/* mapped cache file holding */
+    					/*    img, or NULL           */
+    size_t         cache_len;		/* length of cache mapping   */
+    uint8_t*       col_img;		/* pixel data by column, or  */
+    					/*    NULL (see col_pixels)  */
+    uint8_t*       plane_img;		/* pixel data by mode X      */
+    					/*    plane, or NULL (see    */
+    					/*    plane_pixels)          */
 };
 
 /* 
@@ -73,6 +106,14 @@ struct photo_t {
 struct image_t {
     photo_header_t hdr;			/* defines height and width */
     uint8_t*       img;                 /* pixel data               */
+    uint16_t*      first_span;		/* opaque spans of each row, */
+    					/*    then of each column    */
+    obj_span_t*    span;		/* the opaque spans          */
+    uint8_t*       col_img;		/* pixel data by column, or  */
+    					/*    NULL (see col_pixels)  */
+    uint8_t*       plane_img;		/* pixel data by mode X      */
+    					/*    plane, or NULL (see    */
+    					/*    plane_pixels)          */
 };
 
 
@@ -87,9 +128,154 @@ struct image_t {
  */
 static const room_t* cur_room = NULL; 
 
+/* 
+ * Whether read_photo should look for (and write) quantized photo cache
+ * files next to the room photos.  See set_photo_cache.
+ */
+static int32_t use_photo_cache = 1;
+
+/* 
+ * Number of palette colors to be chosen by the reducible octree in
+ * octree.c, or 0 to use the fixed 128 level 4 plus 64 level 2 scheme.
+ * See set_palette_budget.
+ */
+static uint32_t palette_budget = 0;
+
+/* 
+ * Whether object images read from now on get lists of their runs of
+ * opaque pixels, and whether fill_horiz_buffer and fill_vert_buffer 
+ * (when not using column copies) draw objects by copying those runs 
+ * rather than by checking every pixel.  See set_object_spans.  The 
+ * runs exist only for the benchmarks: with the SIMD blending kernels,
+ * bench objects finds copying runs no faster (0.88-1.28 times the 
+ * speed of the fastest kernel), so the game never turns them on and
+ * reads its images without them.
+ */
+static int32_t use_object_spans = 0;
+
+/* 
+ * Whether fill_vert_buffer reads room photos and object images from
+ * copies stored column by column (top to bottom, then left to right),
+ * so that the pixels of a vertical line are next to each other in
+ * memory.  A photo's copy is made the first time that the photo is 
+ * drawn by fill_vert_buffer, which happens only when the view scrolls
+ * horizontally, and is then counted against the photo budget (see 
+ * room_photo_grew); an object image's copy is made when the image is
+ * read.  See set_column_copies.
+ */
+static int32_t use_column_copies = 1;
+
+/* 
+ * Whether fill_horiz_buffer and fill_vert_buffer find the objects that
+ * may cover a line through the room's index of objects by rows and
+ * columns, rather than by checking every object in the room.  See 
+ * set_object_index.
+ */
+static int32_t use_object_index = 1;
+
+/* 
+ * Whether room photos and object images are also stored as four mode X
+ * planes when they are read, so that fill_rect can copy (or blend) each
+ * plane's part of a row in one piece.  See set_planar_pixels.
+ */
+static int32_t use_planar_pixels = 1;
+
+/* 
+ * Number of threads among which read_photo splits the pixel passes of
+ * a photo, or 0 to choose automatically.  See set_quantize_threads.
+ * When choosing automatically, each thread is given at least
+ * QUANTIZE_BAND_PIXELS pixels, so only oversized photos are split.
+ */
+static uint32_t quantize_threads = 0;
+#define MAX_QUANTIZE_THREADS 16
+#define QUANTIZE_BAND_PIXELS (256 * 1024)
+
+/* 
+ * Lookup tables from a 5:6:5 pixel to its level 4 and level 2 octree
+ * nodes, filled once by init_octree_tables (and unused when the program
+ * is compiled with -DNO_OCTREE_TABLES).  Photos may be read by several
+ * threads at once, so the tables are filled through pthread_once.
+ */
+#if !defined(NO_OCTREE_TABLES)
+static uint16_t octree_level_4_table[65536];
+static uint8_t octree_level_2_table[65536];
+static pthread_once_t octree_tables_once = PTHREAD_ONCE_INIT;
+#endif
+
+/* 
+ * Number of sub-histograms over which read_photo spreads consecutive
+ * pixels, so that runs of pixels in the same octree node do not wait
+ * on each other's updates.  The lanes are added up once all pixels
+ * have been counted.
+ */
+#define OCTREE_HIST_LANES 4
+
+/*
+ *the level 4 statistics gathered from the pixels; each record fits in 16 bytes
+ *so that a pixel touches a single cache line (32 bits hold the sums for even
+ *the largest photo: 63 * 1024 * 1024 < 2^32, as green has 6 bits)
+ */
+struct octree_count {
+		uint32_t	pixel_number;
+		uint32_t	red_sum;
+		uint32_t	green_sum;
+		uint32_t	blue_sum;
+};
+struct octree_hist {
+		struct octree_count	lane[OCTREE_HIST_LANES][OCTREE_LEVEL4_NODES_NUM];
+};
+
+/* a band of rows for one thread of the histogram pass */
+typedef struct hist_band_t hist_band_t;
+struct hist_band_t {
+    const uint16_t*     pixels;	/* first pixel of band      */
+    uint32_t            n_pixels; /* number of pixels in band */
+    struct octree_hist* hist;	/* statistics for band      */
+};
+
+/* a band of rows for one thread of the remap pass */
+typedef struct remap_band_t remap_band_t;
+struct remap_band_t {
+    photo_t*        p;		/* photo being filled in          */
+    const uint16_t* pixels;	/* all pixels, in file row order  */
+    const uint8_t*  map;	/* palette entry of each color    */
+    uint16_t        first;	/* first file row of band         */
+    uint16_t        end;	/* file row after last of band    */
+};
+
+/* local functions--see function headers for details */
+static photo_t* decode_photo (const char* fname);
+static int32_t read_obj_pixels (FILE* in, const photo_header_t* hdr,
+				uint8_t* img);
+static size_t find_obj_spans (image_t* img, uint16_t* first_span);
+static uint8_t* col_pixels (const uint8_t* img, uint32_t width, 
+			    uint32_t height);
+static uint8_t* plane_pixels (const uint8_t* img, uint32_t width, 
+			      uint32_t height, uint8_t pad);
+static int32_t find_line_objects (int32_t pos, int32_t is_row, 
+				  object_t* objs[MAX_LINE_OBJECTS]);
+static int32_t octree_photo (photo_t* p, const uint16_t* pixels);
+static void remap_photo (photo_t* p, const uint16_t* pixels,
+			 const uint8_t map[65536]);
+static void* remap_band (void* arg);
+static void* histogram_band (void* arg);
+static uint32_t quantize_bands (uint16_t width, uint16_t height);
+static void run_bands (void* (*fn) (void*), void* bands, size_t band_size,
+		       uint32_t n_bands);
+static uint32_t hash_photo_file (const char* fname);
+static photo_t* map_photo_cache (const char* cname, const char* fname,
+				 const struct stat* src);
+static void write_photo_cache (const char* cname, const photo_t* p,
+			       const struct stat* src, uint32_t src_hash);
+#if !defined(NO_OCTREE_TABLES)
+static void init_octree_tables (void);
+#endif
+static void accumulate_octree_hist (struct octree_hist* hist,
+				    const uint16_t* pixels,
+				    const uint16_t* nodes, uint32_t n);
+
 /*the basic structure for octree nodes*/
 struct octree_node {
-		uint16_t	idx_by_RGB;
 		uint16_t	idx_in_level_2;
 		unsigned long int	red_sum;
 		unsigned long int	green_sum;
@@ -97,8 +283,50 @@ struct octree_node {
 		unsigned int pixel_number;
 		uint16_t	palette_idx;
 };
+
+/*
+ *the large arrays used by decode_photo, allocated on the heap so that the
+ *threads that read photos (see build_world) keep small stacks
+ */
+struct decode_scratch {
+		struct octree_node	level_4[OCTREE_LEVEL4_NODES_NUM];	//the 4th level of octree, has 8^4 nodes
+		unsigned int	counts[OCTREE_LEVEL4_NODES_NUM];	//copy of level 4 pixel counts
+		uint8_t		map[65536];	//palette entry (less PALETTE_USED) of each 5:6:5 color
+};
 	
 	
+/* 
+ * find_line_objects
+ *   DESCRIPTION: List the objects in the current room that may cover a
+ *                line of the room photo, in drawing order.  With the 
+ *                room's object index, these are the objects near the
+ *                line; without it, all objects in the room.
+ *   INPUTS: pos -- y value of a row, or x value of a column
+ *           is_row -- 1 for a row, 0 for a column
+ *   OUTPUTS: objs -- the objects
+ *   RETURN VALUE: number of objects
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+find_line_objects (int32_t pos, int32_t is_row, 
+		   object_t* objs[MAX_LINE_OBJECTS])
+{
+    object_t* obj;    /* loop index over objects in the current room */
+    int32_t   n_objs; /* number of objects found                     */
+
+    if (use_object_index) {
+	return (is_row ? room_row_objects (cur_room, pos, objs) :
+		room_col_objects (cur_room, pos, objs));
+    }
+    n_objs = 0;
+    for (obj = room_contents_iterate (cur_room); 
+	 NULL != obj && MAX_LINE_OBJECTS > n_objs; obj = obj_next (obj)) {
+        objs[n_objs++] = obj;
+    }
+    return n_objs;
+}
+
+
 /* 
  * fill_horiz_buffer
  *   DESCRIPTION: Given the (x,y) map pixel coordinate of the leftmost 
@@ -119,9 +347,16 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 {
     int            idx;   /* loop index over pixels in the line          */ 
     object_t*      obj;   /* loop index over objects in the current room */
+    object_t*      objs[MAX_LINE_OBJECTS]; /* objects that may be drawn  */
+    int32_t        n_objs;  /* number of objects that may be drawn       */
+    int32_t        obj_idx; /* index over objects that may be drawn      */
     int            imgx;  /* loop index over pixels in object image      */ 
     int            yoff;  /* y offset into object image                  */ 
-    uint8_t        pixel; /* pixel from object image                     */
+    int            row;   /* row of object image on the line             */
+    int            end;   /* end of object image pixels on the line      */
+    int            first; /* first pixel of an opaque run to copy        */
+    int            last;  /* end of an opaque run to copy                */
+    const obj_span_t* sp; /* loop index over opaque runs                 */
     const photo_t* view;  /* room photo                                  */
     int32_t        obj_x; /* object x position                           */
     int32_t        obj_y; /* object y position                           */
@@ -136,9 +371,13 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 		    view->img[view->hdr.width * y + x + idx] : 0);
     }
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
+    /* 
+     * Loop over objects in the current room that may cover the line
+     * (or over all of them, without the room's index).
+     */
+    n_objs = find_line_objects (y, 1, objs);
+    for (obj_idx = 0; n_objs > obj_idx; obj_idx++) {
+	obj = objs[obj_idx];
 	obj_x = obj_get_x (obj);
 	obj_y = obj_get_y (obj);
 	img = obj_image (obj);
@@ -164,15 +403,33 @@ fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM])
 	    imgx = x - obj_x;
 	}
 
-	/* Copy the object's pixel data. */
-	for (; SCROLL_X_DIM > idx && img->hdr.width > imgx; idx++, imgx++) {
-	    pixel = img->img[yoff + imgx];
+	/* Find the end of the part of the object's row on the line. */
+	end = imgx + SCROLL_X_DIM - idx;
+	if (img->hdr.width < end) {
+	    end = img->hdr.width;
+	}
 
-	    /* Don't copy transparent pixels. */
-	    if (OBJ_CLR_TRANSP != pixel) {
-		buf[idx] = pixel;
+	/* 
+	 * Copy the object's runs of opaque pixels that fall on the line,
+	 * clipping the first and last to the part of the row shown.
+	 */
+	if (use_object_spans && NULL != img->first_span) {
+	    row = y - obj_y;
+	    for (sp = &img->span[img->first_span[row]]; 
+	    	 &img->span[img->first_span[row + 1]] > sp && 
+		 end > sp->start; sp++) {
+	        first = (imgx > sp->start ? imgx : sp->start);
+		last = (end < sp->start + sp->len ? end : sp->start + sp->len);
+		if (first < last) {
+		    (void)memcpy (&buf[idx - imgx + first], 
+		    		  &img->img[yoff + first], last - first);
+		}
 	    }
+	    continue;
 	}
+
+	/* Copy the object's pixel data, except for transparent pixels. */
+	blend_obj_pixels (&buf[idx], &img->img[yoff + imgx], end - imgx);
     }
 }
 
@@ -197,26 +454,63 @@ fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
 {
     int            idx;   /* loop index over pixels in the line          */ 
     object_t*      obj;   /* loop index over objects in the current room */
+    object_t*      objs[MAX_LINE_OBJECTS]; /* objects that may be drawn  */
+    int32_t        n_objs;  /* number of objects that may be drawn       */
+    int32_t        obj_idx; /* index over objects that may be drawn      */
     int            imgy;  /* loop index over pixels in object image      */ 
     int            xoff;  /* x offset into object image                  */ 
+    int            col;   /* column of object image (run list index)     */
+    int            end;   /* end of object image pixels on the line      */
+    int            first; /* first pixel of an opaque run to copy        */
+    int            last;  /* end of an opaque run to copy                */
+    const obj_span_t* sp; /* loop index over opaque runs                 */
     uint8_t        pixel; /* pixel from object image                     */
-    const photo_t* view;  /* room photo                                  */
+    photo_t*       view;  /* room photo                                  */
     int32_t        obj_x; /* object x position                           */
     int32_t        obj_y; /* object y position                           */
-    const image_t* img;   /* object image                                */
+    image_t*       img;   /* object image                                */
+    const uint8_t* col_p; /* column x of room photo                      */
 
     /* Get pointer to current photo of current room. */
     view = room_photo (cur_room);
 
-    /* Loop over pixels in line. */
-    for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
-        buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
-		    view->img[view->hdr.width * (y + idx) + x] : 0);
+    /* 
+     * Copy the photo's column if a column by column copy of the photo
+     * can be had, filling with black above and below the photo.
+     * Otherwise, loop over pixels in line.
+     */
+    if (use_column_copies && NULL == view->col_img &&
+	NULL != (view->col_img = col_pixels (view->img, view->hdr.width, 
+					     view->hdr.height))) {
+	room_photo_grew (cur_room);
+    }
+    if (use_column_copies && NULL != view->col_img) {
+	col_p = &view->col_img[view->hdr.height * x];
+	first = (0 > y ? -y : 0);
+	last = view->hdr.height - y;
+	if (SCROLL_Y_DIM < last) {
+	    last = SCROLL_Y_DIM;
+	}
+	if (first >= last) {
+	    first = last = SCROLL_Y_DIM;
+	}
+	(void)memset (buf, 0, first);
+	(void)memcpy (&buf[first], &col_p[y + first], last - first);
+	(void)memset (&buf[last], 0, SCROLL_Y_DIM - last);
+    } else {
+	for (idx = 0; idx < SCROLL_Y_DIM; idx++) {
+	    buf[idx] = (0 <= y + idx && view->hdr.height > y + idx ?
+			view->img[view->hdr.width * (y + idx) + x] : 0);
+	}
     }
 
-    /* Loop over objects in the current room. */
-    for (obj = room_contents_iterate (cur_room); NULL != obj;
-    	 obj = obj_next (obj)) {
+    /* 
+     * Loop over objects in the current room that may cover the line
+     * (or over all of them, without the room's index).
+     */
+    n_objs = find_line_objects (x, 0, objs);
+    for (obj_idx = 0; n_objs > obj_idx; obj_idx++) {
+	obj = objs[obj_idx];
 	obj_x = obj_get_x (obj);
 	obj_y = obj_get_y (obj);
 	img = obj_image (obj);
@@ -242,6 +536,43 @@ fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
 	    imgy = y - obj_y;
 	}
 
+	/* Find the end of the part of the object's column on the line. */
+	end = imgy + SCROLL_Y_DIM - idx;
+	if (img->hdr.height < end) {
+	    end = img->hdr.height;
+	}
+
+	/* 
+	 * With a column by column copy of the image, the pixels of the
+	 * object's column can be blended in the same way as those of a
+	 * row (see fill_horiz_buffer).
+	 */
+	if (use_column_copies && NULL != img->col_img) {
+	    blend_obj_pixels (&buf[idx], 
+			      &img->col_img[img->hdr.height * xoff + imgy],
+			      end - imgy);
+	    continue;
+	}
+
+	/* 
+	 * Copy the object's runs of opaque pixels that fall on the line,
+	 * clipping the first and last to the part of the column shown.
+	 */
+	if (use_object_spans && NULL != img->first_span) {
+	    col = img->hdr.height + xoff;
+	    for (sp = &img->span[img->first_span[col]]; 
+	    	 &img->span[img->first_span[col + 1]] > sp && 
+		 end > sp->start; sp++) {
+	        first = (imgy > sp->start ? imgy : sp->start);
+		last = (end < sp->start + sp->len ? end : sp->start + sp->len);
+		for (; last > first; first++) {
+		    buf[idx - imgy + first] = 
+		    	img->img[xoff + img->hdr.width * first];
+		}
+	    }
+	    continue;
+	}
+
 	/* Copy the object's pixel data. */
 	for (; SCROLL_Y_DIM > idx && img->hdr.height > imgy; idx++, imgy++) {
 	    pixel = img->img[xoff + img->hdr.width * imgy];
@@ -255,6 +586,161 @@ fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM])
 }
 
 
+/* 
+ * fill_rect
+ *   DESCRIPTION: Given a rectangle of map pixel coordinates, draw the 
+ *                room photo and the objects in the room straight into
+ *                the four planes of the mode X build buffer.  Each 
+ *                plane is written completely (top row to bottom row)
+ *                before the next is started, so writes go to one area
+ *                of memory at a time; the photo rows are read four 
+ *                times, once for each plane, unless the photo has a
+ *                copy stored by plane (see plane_pixels).
+ *   INPUTS: (x,y) -- upper left pixel of the rectangle
+ *           (w,h) -- width and height of the rectangle
+ *           plane -- pixel (px,py) of the map is stored in plane
+ *                    px & 3, at plane[px & 3][(px >> 2) + py * pitch]
+ *           pitch -- distance between rows within a plane
+ *   OUTPUTS: pixels of rectangle in plane
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+fill_rect (int x, int y, int w, int h, unsigned char* plane[4], int pitch)
+{
+    int            k;     /* index over planes                           */
+    int            px;    /* x value of pixel drawn                      */
+    int            py;    /* y value of row drawn                        */
+    int            first; /* first x value in plane                      */
+    int            x_lo, x_hi; /* part of rectangle covered by photo or  */
+    int            y_lo, y_hi; /*    object                              */
+    unsigned char* dst;   /* next pixel written                          */
+    const uint8_t* src;   /* row of photo or object image                */
+    uint8_t        pixel; /* pixel from object image                     */
+    object_t*      obj;   /* loop index over objects in the current room */
+    int32_t        obj_x; /* object x position                           */
+    int32_t        obj_y; /* object y position                           */
+    const image_t* img;   /* object image                                */
+    const photo_t* view;  /* room photo                                  */
+    int            n;     /* pixels of rectangle row in plane            */
+    int            pw;    /* pixels in a row of a plane copy             */
+    int            lead;  /* pixels of plane row left of photo           */
+    int            n_in;  /* pixels of plane row not right of photo      */
+
+    /* Get pointer to current photo of current room. */
+    view = room_photo (cur_room);
+
+    /* 
+     * Draw the photo, plane by plane.  Pixels outside of the photo are
+     * black.
+     */
+    x_lo = (0 > x ? 0 : x);
+    x_hi = (view->hdr.width < x + w ? view->hdr.width : x + w);
+    for (k = 0; 4 > k; k++) {
+	first = x + ((k - x) & 3);
+	n = (x + w > first ? (x + w - first + 3) >> 2 : 0);
+
+	/* 
+	 * With a copy of the photo by plane, the pixels of the plane that
+	 * lie in the photo are adjacent in both copies: the first lead
+	 * pixels lie left of the photo, and pixels from index n_in on lie
+	 * right of it.
+	 */
+	if (NULL != view->plane_img) {
+	    pw = (view->hdr.width + 3) >> 2;
+	    lead = (0 > first ? (3 - first) >> 2 : 0);
+	    n_in = (view->hdr.width > first ? 
+	    	    (view->hdr.width - first + 3) >> 2 : 0);
+	    lead = (n < lead ? n : lead);
+	    n_in = (n < n_in ? n : n_in);
+	    n_in = (lead > n_in ? lead : n_in);
+	    src = &view->plane_img[k * pw * view->hdr.height + 
+				   ((first + 4 * lead) >> 2)];
+	    for (py = y; y + h > py; py++) {
+		dst = &plane[k][(first >> 2) + py * pitch];
+		if (0 > py || view->hdr.height <= py) {
+		    memset (dst, 0, n);
+		    continue;
+		}
+		memset (dst, 0, lead);
+		memcpy (dst + lead, src + py * pw, n_in - lead);
+		memset (dst + n_in, 0, n - n_in);
+	    }
+	    continue;
+	}
+	for (py = y; y + h > py; py++) {
+	    dst = &plane[k][(first >> 2) + py * pitch];
+	    if (0 > py || view->hdr.height <= py) {
+		memset (dst, 0, n);
+		continue;
+	    }
+	    src = &view->img[view->hdr.width * py];
+	    for (px = first; x + w > px; px += 4) {
+		*dst++ = (x_lo <= px && x_hi > px ? src[px] : 0);
+	    }
+	}
+    }
+
+    /* 
+     * Draw each object over the photo, in the same order as 
+     * fill_horiz_buffer, and again plane by plane.
+     */
+    for (obj = room_contents_iterate (cur_room); NULL != obj;
+    	 obj = obj_next (obj)) {
+	obj_x = obj_get_x (obj);
+	obj_y = obj_get_y (obj);
+	img = obj_image (obj);
+
+	/* Find the part of the rectangle covered by the object. */
+	x_lo = (x > obj_x ? x : obj_x);
+	x_hi = (x + w < obj_x + img->hdr.width ? x + w : 
+		obj_x + img->hdr.width);
+	y_lo = (y > obj_y ? y : obj_y);
+	y_hi = (y + h < obj_y + img->hdr.height ? y + h : 
+		obj_y + img->hdr.height);
+	if (x_lo >= x_hi || y_lo >= y_hi) {
+	    continue;
+	}
+
+	/* Copy the object's pixel data, except for transparent pixels. */
+	for (k = 0; 4 > k; k++) {
+	    first = x_lo + ((k - x_lo) & 3);
+	    if (x_hi <= first) {
+		continue;
+	    }
+
+	    /* 
+	     * Pixels of map plane k come from a single plane of the 
+	     * object's copy, so they can be blended in one call per row.
+	     */
+	    if (NULL != img->plane_img) {
+		n = (x_hi - first + 3) >> 2;
+		pw = (img->hdr.width + 3) >> 2;
+		src = &img->plane_img[((first - obj_x) & 3) * pw * 
+				      img->hdr.height + 
+				      (y_lo - obj_y) * pw +
+				      ((first - obj_x) >> 2)];
+		for (py = y_lo; y_hi > py; py++, src += pw) {
+		    blend_obj_pixels (&plane[k][(first >> 2) + py * pitch],
+		    		      src, n);
+		}
+		continue;
+	    }
+	    for (py = y_lo; y_hi > py; py++) {
+		dst = &plane[k][(first >> 2) + py * pitch];
+		src = &img->img[img->hdr.width * (py - obj_y)];
+		for (px = first; x_hi > px; px += 4, dst++) {
+		    pixel = src[px - obj_x];
+		    if (OBJ_CLR_TRANSP != pixel) {
+			*dst = pixel;
+		    }
+		}
+	    }
+	}
+    }
+}
+
+
 /* 
  * image_height
  *   DESCRIPTION: Get height of object image in pixels.
@@ -349,23 +835,27 @@ read_obj_image (const char* fname)
 {
     FILE*    in;		/* input file               */
     image_t* img = NULL;	/* image structure          */
-    uint16_t x;			/* index over image columns */
-    uint16_t y;			/* index over image rows    */
-    uint8_t  pixel;		/* one pixel from the file  */
 
     /* 
      * Open the file, allocate the structure, read the header, do some
      * sanity checks on it, and allocate space to hold the image pixels.
-     * If anything fails, clean up as necessary and return NULL.
+     * Then read the pixels and (if requested) find the runs of opaque 
+     * pixels.  If anything fails, clean up as necessary and return NULL.
      */
     if (NULL == (in = fopen (fname, "r+b")) ||
 	NULL == (img = malloc (sizeof (*img))) ||
 	NULL != (img->img = NULL) || /* false clause for initialization */
+	NULL != (img->first_span = NULL) || /* and another */
+	NULL != (img->col_img = NULL) || /* and another */
+	NULL != (img->plane_img = NULL) || /* and another */
 	1 != fread (&img->hdr, sizeof (img->hdr), 1, in) ||
 	MAX_OBJECT_WIDTH < img->hdr.width ||
 	MAX_OBJECT_HEIGHT < img->hdr.height ||
 	NULL == (img->img = malloc 
-		 (img->hdr.width * img->hdr.height * sizeof (img->img[0])))) {
+		 (img->hdr.width * img->hdr.height * sizeof (img->img[0]))) ||
+	!read_obj_pixels (in, &img->hdr, img->img) ||
+	(use_object_spans &&
+	 NULL == (img->first_span = malloc (find_obj_spans (img, NULL))))) {
 	if (NULL != img) {
 	    if (NULL != img->img) {
 	        free (img->img);
@@ -378,75 +868,748 @@ read_obj_image (const char* fname)
 	return NULL;
     }
 
+    /* All done.  Return success. */
+    if (use_object_spans) {
+	(void)find_obj_spans (img, img->first_span);
+    }
+    if (use_planar_pixels) {
+	img->plane_img = plane_pixels (img->img, img->hdr.width, 
+				       img->hdr.height, OBJ_CLR_TRANSP);
+    }
+    if (use_column_copies) {
+	img->col_img = col_pixels (img->img, img->hdr.width, 
+				   img->hdr.height);
+    }
+    (void)fclose (in);
+    return img;
+}
+
+
+/* 
+ * read_obj_atlas
+ *   DESCRIPTION: Read a set of object images into a single block of
+ *                memory (an atlas) holding both the image structures and
+ *                their pixel data; their runs of opaque pixels are kept
+ *                together in a second block.  A file named more than once is read
+ *                only once, and the same image is returned for each of
+ *                its names.  Images read in this way cannot be freed.
+ *   INPUTS: fname -- the file names
+ *           n_images -- number of file names
+ *   OUTPUTS: img -- the image for each file name
+ *   RETURN VALUE: n_images on success; OBJ_ATLAS_NO_MEMORY if memory
+ *                 could not be allocated; otherwise the index of a file
+ *                 that could not be read
+ *   SIDE EFFECTS: allocates memory
+ */
+uint32_t
+read_obj_atlas (const char* const fname[], uint32_t n_images, image_t* img[])
+{
+    FILE**         in;		/* open input files (NULL for repeats) */
+    photo_header_t hdr;		/* header of one file                  */
+    uint32_t*      first;	/* first name of the same file         */
+    uint32_t       n_unique;	/* number of different files           */
+    size_t         n_pixels;	/* total pixels in all images          */
+    image_t*       atlas = NULL; /* the images, then their pixels      */
+    uint8_t*       pixels;	/* where next image's pixels go        */
+    size_t         span_bytes;	/* space for all opaque run lists      */
+    uint8_t*       spans = NULL; /* where next image's run lists go    */
+    uint32_t       idx;		/* index over names                    */
+    uint32_t       prev;	/* index over earlier names            */
+    uint32_t       bad = n_images; /* name of file that failed         */
+
+    if (NULL == (in = calloc (n_images, sizeof (in[0]))) ||
+	NULL == (first = malloc (n_images * sizeof (first[0])))) {
+	if (NULL != in) {
+	    free (in);
+	}
+	return OBJ_ATLAS_NO_MEMORY;
+    }
+
     /* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
+     * Open each file named for the first time and read its header to
+     * find out how much space is needed for all of the images.
      */
-    for (y = img->hdr.height; y-- > 0; ) {
+    n_unique = 0;
+    n_pixels = 0;
+    for (idx = 0; n_images > idx; idx++) {
+	for (prev = 0; idx > prev && 0 != strcmp (fname[prev], fname[idx]); 
+	     prev++) {
+	}
+	first[idx] = prev;
+	if (idx != prev) {
+	    continue;
+	}
+	if (NULL == (in[idx] = fopen (fname[idx], "r+b")) ||
+	    1 != fread (&hdr, sizeof (hdr), 1, in[idx]) ||
+	    MAX_OBJECT_WIDTH < hdr.width || MAX_OBJECT_HEIGHT < hdr.height) {
+	    bad = idx;
+	    break;
+	}
+	n_unique++;
+	n_pixels += hdr.width * hdr.height;
+    }
+
+    /* Allocate the atlas, then read the pixels into it. */
+    if (n_images == bad &&
+	NULL == (atlas = malloc (n_unique * sizeof (atlas[0]) + n_pixels))) {
+	bad = OBJ_ATLAS_NO_MEMORY;
+    }
+    if (n_images == bad) {
+	pixels = (uint8_t*)&atlas[n_unique];
+	for (idx = 0, n_unique = 0; n_images > idx; idx++) {
+	    if (first[idx] != idx) {
+		img[idx] = img[first[idx]];
+		continue;
+	    }
+	    img[idx] = &atlas[n_unique++];
+	    img[idx]->first_span = NULL;
+	    img[idx]->span = NULL;
+	    img[idx]->col_img = NULL;
+	    img[idx]->plane_img = NULL;
+	    if (0 != fseek (in[idx], 0, SEEK_SET) ||
+		1 != fread (&img[idx]->hdr, sizeof (img[idx]->hdr), 1, 
+			    in[idx]) ||
+		!read_obj_pixels (in[idx], &img[idx]->hdr, pixels)) {
+		bad = idx;
+		break;
+	    }
+	    img[idx]->img = pixels;
+	    pixels += img[idx]->hdr.width * img[idx]->hdr.height;
+	}
+    }
 
-	/* Loop over columns from left to right. */
-	for (x = 0; img->hdr.width > x; x++) {
+    /* Find the runs of opaque pixels in the images, if requested. */
+    if (n_images == bad && use_object_spans) {
+	for (idx = 0, span_bytes = 0; n_images > idx; idx++) {
+	    if (first[idx] == idx) {
+		span_bytes += find_obj_spans (img[idx], NULL);
+	    }
+	}
+	if (0 != span_bytes && NULL == (spans = malloc (span_bytes))) {
+	    bad = OBJ_ATLAS_NO_MEMORY;
+	}
+    }
+    if (n_images == bad) {
+	for (idx = 0; n_images > idx; idx++) {
+	    if (first[idx] == idx) {
+		if (use_object_spans) {
+		    spans += find_obj_spans (img[idx], (uint16_t*)spans);
+		}
+		if (use_planar_pixels) {
+		    img[idx]->plane_img = plane_pixels 
+			    (img[idx]->img, img[idx]->hdr.width, 
+			     img[idx]->hdr.height, OBJ_CLR_TRANSP);
+		}
+		if (use_column_copies) {
+		    img[idx]->col_img = col_pixels 
+			    (img[idx]->img, img[idx]->hdr.width, 
+			     img[idx]->hdr.height);
+		}
+	    }
+	}
+    }
 
-	    /* 
-	     * Try to read one 8-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-	    if (1 != fread (&pixel, sizeof (pixel), 1, in)) {
-		free (img->img);
-		free (img);
-	        (void)fclose (in);
-		return NULL;
+    /* Clean up. */
+    for (idx = 0; n_images > idx; idx++) {
+	if (NULL != in[idx]) {
+	    (void)fclose (in[idx]);
+	}
+    }
+    free (in);
+    free (first);
+    if (n_images != bad && NULL != atlas) {
+	free (atlas);
+    }
+    return bad;
+}
+
+
+/* 
+ * read_obj_pixels
+ *   DESCRIPTION: Read the pixel data of an object image file with a
+ *                single block read, then put the rows in memory order.
+ *                Note that the file is stored from bottom to top, 
+ *                whereas in memory we store the data in the reverse
+ *                order (top to bottom).
+ *   INPUTS: in -- the file, positioned just after the header
+ *           hdr -- the image's header
+ *   OUTPUTS: img -- the image's pixel data
+ *   RETURN VALUE: 1 on success, 0 if the pixels can't be read
+ *   SIDE EFFECTS: advances the file position
+ */
+static int32_t
+read_obj_pixels (FILE* in, const photo_header_t* hdr, uint8_t* img)
+{
+    uint8_t  row[MAX_OBJECT_WIDTH]; /* row being swapped          */
+    uint8_t* top;                   /* upper row of a pair        */
+    uint8_t* bot;                   /* lower row of a pair        */
+
+    if (hdr->width * hdr->height != 
+	fread (img, sizeof (img[0]), hdr->width * hdr->height, in)) {
+	return 0;
+    }
+    if (0 == hdr->height) {
+	return 1;
+    }
+    for (top = img, bot = img + hdr->width * (hdr->height - 1); top < bot;
+	 top += hdr->width, bot -= hdr->width) {
+	(void)memcpy (row, top, hdr->width);
+	(void)memcpy (top, bot, hdr->width);
+	(void)memcpy (bot, row, hdr->width);
+    }
+    return 1;
+}
+
+
+/* 
+ * find_obj_spans
+ *   DESCRIPTION: Find the runs of opaque pixels in each row and each 
+ *                column of an object image (see obj_span_t).  The
+ *                run lists are written to a block of memory that starts
+ *                with the index of the first run of each row and column,
+ *                followed by the runs themselves.  If no block is given,
+ *                only the size of the block is calculated.
+ *   INPUTS: img -- the image, with its pixels already read
+ *           first_span -- block to hold run lists, or NULL
+ *   OUTPUTS: img -- run list fields point into the block (if given)
+ *   RETURN VALUE: size of the block in bytes
+ *   SIDE EFFECTS: none
+ */
+static size_t
+find_obj_spans (image_t* img, uint16_t* first_span)
+{
+    obj_span_t* span;     /* the runs, after the run indices      */
+    uint32_t    n_spans;  /* number of runs found                 */
+    uint32_t    n_lines;  /* number of rows and columns           */
+    uint32_t    line;     /* index over rows, then columns        */
+    uint32_t    len;      /* pixels in current row or column      */
+    uint32_t    stride;   /* distance between pixels of the line  */
+    uint32_t    pos;      /* index over pixels in line            */
+    uint32_t    start;    /* first pixel of current run           */
+    const uint8_t* pixel; /* first pixel of line                  */
+
+    n_lines = img->hdr.height + img->hdr.width;
+    span = (NULL == first_span ? NULL : 
+	    (obj_span_t*)&first_span[n_lines + 1]);
+    n_spans = 0;
+    for (line = 0; n_lines > line; line++) {
+	if (img->hdr.height > line) {
+	    pixel = &img->img[img->hdr.width * line];
+	    len = img->hdr.width;
+	    stride = 1;
+	} else {
+	    pixel = &img->img[line - img->hdr.height];
+	    len = img->hdr.height;
+	    stride = img->hdr.width;
+	}
+	if (NULL != first_span) {
+	    first_span[line] = n_spans;
+	}
+	for (pos = 0; len > pos; ) {
+	    /* Skip the transparent pixels, then find the end of the run. */
+	    for (; len > pos && OBJ_CLR_TRANSP == pixel[stride * pos]; pos++) {
 	    }
+	    for (start = pos; 
+	    	 len > pos && OBJ_CLR_TRANSP != pixel[stride * pos]; pos++) {
+	    }
+	    if (start < pos) {
+		if (NULL != first_span) {
+		    span[n_spans].start = start;
+		    span[n_spans].len = pos - start;
+		}
+		n_spans++;
+	    }
+	}
+    }
+    if (NULL != first_span) {
+	first_span[n_lines] = n_spans;
+	img->first_span = first_span;
+	img->span = span;
+    }
+    return (n_lines + 1) * sizeof (first_span[0]) + 
+	   n_spans * sizeof (span[0]);
+}
+
 
-	    /* Store the pixel in the image data. */
-	    img->img[img->hdr.width * y + x] = pixel;
+/* 
+ * col_pixels
+ *   DESCRIPTION: Make a copy of a photo's or image's pixel data that is
+ *                stored column by column, so that pixel (x,y) of the 
+ *                original is found at index (height * x + y) of the 
+ *                copy.  The copy is made in square tiles so that reads 
+ *                and writes both stay within a few cache lines at a
+ *                time.
+ *   INPUTS: img -- the pixel data, stored row by row
+ *           width -- width of the pixel data
+ *           height -- height of the pixel data
+ *   OUTPUTS: none
+ *   RETURN VALUE: the copy, or NULL if memory could not be allocated
+ *   SIDE EFFECTS: allocates memory
+ */
+static uint8_t*
+col_pixels (const uint8_t* img, uint32_t width, uint32_t height)
+{
+    static const uint32_t tile = 32; /* width and height of a tile   */
+    uint8_t* col_img;                /* the copy                     */
+    uint32_t tx, ty;                 /* upper left corner of a tile  */
+    uint32_t x, y;                   /* index over pixels in a tile  */
+    uint32_t x_end, y_end;           /* lower right of a tile        */
+
+    if (NULL == (col_img = malloc (width * height))) {
+        return NULL;
+    }
+    for (tx = 0; width > tx; tx += tile) {
+	x_end = (width < tx + tile ? width : tx + tile);
+	for (ty = 0; height > ty; ty += tile) {
+	    y_end = (height < ty + tile ? height : ty + tile);
+	    for (x = tx; x_end > x; x++) {
+		for (y = ty; y_end > y; y++) {
+		    col_img[height * x + y] = img[width * y + x];
+		}
+	    }
 	}
     }
+    return col_img;
+}
 
-    /* All done.  Return success. */
-    (void)fclose (in);
-    return img;
+
+/* 
+ * plane_pixels
+ *   DESCRIPTION: Make a copy of a photo's or image's pixel data that is
+ *                stored as four planes, in the same way as mode X 
+ *                video memory: plane k holds pixels k, k + 4, k + 8, and
+ *                so forth of each row.  Each plane row holds 
+ *                (width + 3) / 4 pixels, with any beyond the width of 
+ *                the original set to a padding value.  Plane k starts
+ *                at index (k * height * ((width + 3) / 4)) of the copy.
+ *   INPUTS: img -- the pixel data, stored row by row
+ *           width -- width of the pixel data
+ *           height -- height of the pixel data
+ *           pad -- padding value
+ *   OUTPUTS: none
+ *   RETURN VALUE: the copy, or NULL if memory could not be allocated
+ *   SIDE EFFECTS: allocates memory
+ */
+static uint8_t*
+plane_pixels (const uint8_t* img, uint32_t width, uint32_t height, 
+	      uint8_t pad)
+{
+    uint32_t       pw;        /* pixels in a plane row            */
+    uint8_t*       plane_img; /* the copy                         */
+    uint8_t*       dst;       /* next pixel of copy               */
+    const uint8_t* src;       /* row of original                  */
+    uint32_t       k;         /* index over planes                */
+    uint32_t       y;         /* index over rows                  */
+    uint32_t       px;        /* index over pixels in row         */
+
+    pw = (width + 3) >> 2;
+    if (NULL == (plane_img = malloc (4 * pw * height))) {
+        return NULL;
+    }
+    dst = plane_img;
+    for (k = 0; 4 > k; k++) {
+	for (y = 0, src = img; height > y; y++, src += width) {
+	    for (px = k; width > px; px += 4) {
+		*dst++ = src[px];
+	    }
+	    if (px < 4 * pw) {
+		*dst++ = pad;
+	    }
+	}
+    }
+    return plane_img;
 }
 
 
 /* 
  * read_photo
  *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
- *                photo file and create a photo structure from it.
- *                Code provided simply maps to 2:2:2 RGB.  You must
- *                replace this code with palette color selection, and
- *                must map the image pixels into the palette colors that
- *                you have defined.
+ *                photo file and create a photo structure from it.  If
+ *                a quantized cache file for the photo exists and still
+ *                matches the photo file (by size and modification time,
+ *                or failing that by hash), the palette and pixel data
+ *                are simply mapped from the cache.  Otherwise, the photo
+ *                is decoded and quantized, and a new cache file is 
+ *                written for use next time.
  *   INPUTS: fname -- file name for input
  *   OUTPUTS: none
  *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
  *                 on failure
- *   SIDE EFFECTS: dynamically allocates memory for the photo
+ *   SIDE EFFECTS: dynamically allocates memory for the photo; may map
+ *                 or write a cache file
  */
 photo_t*
 read_photo (const char* fname)
 {
-    FILE*    in;	/* input file               */
-    photo_t* p = NULL;	/* photo structure          */
-    uint16_t x;		/* index over image columns */
-    uint16_t y;		/* index over image rows    */
-    uint16_t pixel;	/* one pixel from the file  */
-	uint32_t image_size;
+    struct stat src;			    /* status of photo file      */
+    char        cname[PHOTO_CACHE_NAME_LEN]; /* name of cache file        */
+    photo_t*    p;			    /* photo structure           */
 
     /* 
-     * Open the file, allocate the structure, read the header, do some
-     * sanity checks on it, and allocate space to hold the photo pixels.
-     * If anything fails, clean up as necessary and return NULL.
+     * Without a cache (or if we can't name one), decode and quantize
+     * the photo file directly.
      */
-    if (NULL == (in = fopen (fname, "r+b")) ||
-	NULL == (p = malloc (sizeof (*p))) ||
-	NULL != (p->img = NULL) || /* false clause for initialization */
-	1 != fread (&p->hdr, sizeof (p->hdr), 1, in) ||
-	MAX_PHOTO_WIDTH < p->hdr.width ||
+    if (!use_photo_cache || 0 != stat (fname, &src) ||
+	sizeof (cname) <= snprintf (cname, sizeof (cname), "%s%s", fname,
+				    PHOTO_CACHE_SUFFIX)) {
+	p = decode_photo (fname);
+
+    /* 
+     * Use the cache if it is still valid.  Otherwise, quantize the 
+     * photo and save the result.
+     */
+    } else if (NULL == (p = map_photo_cache (cname, fname, &src)) &&
+	       NULL != (p = decode_photo (fname))) {
+	write_photo_cache (cname, p, &src, hash_photo_file (fname));
+    }
+
+    /* 
+     * Keep a copy of the pixels by plane as well, if requested.  Photos
+     * are drawn correctly (but more slowly) without one, so failure to
+     * allocate it is not an error.
+     */
+    if (NULL != p && use_planar_pixels) {
+	p->plane_img = plane_pixels (p->img, p->hdr.width, p->hdr.height, 0);
+    }
+    return p;
+}
+
+
+/* 
+ * read_photo_header
+ *   DESCRIPTION: Read only the header (dimensions) of a room photo file,
+ *                without reading or quantizing the pixel data.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: hdr -- the photo's header
+ *   RETURN VALUE: 1 on success, or 0 if the file cannot be read or the
+ *                 photo is too large
+ *   SIDE EFFECTS: none
+ */
+int32_t
+read_photo_header (const char* fname, photo_header_t* hdr)
+{
+    FILE*   in; /* input file     */
+    int32_t ok; /* header is good */
+
+    if (NULL == (in = fopen (fname, "r+b"))) {
+	return 0;
+    }
+    ok = (1 == fread (hdr, sizeof (*hdr), 1, in) &&
+	  MAX_PHOTO_WIDTH >= hdr->width && MAX_PHOTO_HEIGHT >= hdr->height);
+    (void)fclose (in);
+    return ok;
+}
+
+
+/* 
+ * free_photo
+ *   DESCRIPTION: Release a room photo created by read_photo, including
+ *                its pixel data (or its mapping of a photo cache file)
+ *                and any column by column or plane by plane copy of 
+ *                them.
+ *   INPUTS: p -- the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees memory; p is no longer valid
+ */
+void
+free_photo (photo_t* p)
+{
+    if (NULL != p->col_img) {
+	free (p->col_img);
+    }
+    if (NULL != p->plane_img) {
+	free (p->plane_img);
+    }
+    if (NULL != p->cache) {
+	(void)munmap (p->cache, p->cache_len);
+    } else {
+	free (p->img);
+    }
+    free (p);
+}
+
+
+/* 
+ * photo_bytes
+ *   DESCRIPTION: Calculate the memory held by a room photo: its palette
+ *                and pixel data (whether allocated or mapped from a 
+ *                cache file), and any column by column or plane by 
+ *                plane copy of the pixels.
+ *   INPUTS: p -- the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: size of the photo in bytes
+ *   SIDE EFFECTS: none
+ */
+uint32_t
+photo_bytes (const photo_t* p)
+{
+    uint32_t n_pixels = p->hdr.width * p->hdr.height; /* bytes per copy */
+    uint32_t bytes;                                   /* total so far   */
+
+    bytes = sizeof (p->palette) + n_pixels;
+    if (NULL != p->col_img) {
+        bytes += n_pixels;
+    }
+    if (NULL != p->plane_img) {
+        bytes += 4 * ((p->hdr.width + 3) / 4) * p->hdr.height;
+    }
+    return bytes;
+}
+
+
+/* 
+ * set_photo_cache
+ *   DESCRIPTION: Enable or disable use of quantized photo cache files by
+ *                read_photo.  The cache is enabled by default.
+ *   INPUTS: enable -- non-zero to use the cache, 0 to always quantize
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes behavior of later calls to read_photo
+ */
+void
+set_photo_cache (int32_t enable)
+{
+    use_photo_cache = enable;
+}
+
+
+/* 
+ * set_object_spans
+ *   DESCRIPTION: Choose how fill_horiz_buffer and fill_vert_buffer draw
+ *                objects: by copying runs of opaque pixels or by checking
+ *                each pixel for transparency (the default; several
+ *                at a time in rows; see blend.c).  Both give the same
+ *                result; the choice exists only for the benchmarks.
+ *                Runs are found only for object images read while 
+ *                copying runs is enabled, so enable it before calling
+ *                build_world; images without runs are always checked
+ *                pixel by pixel.
+ *   INPUTS: enable -- non-zero to copy runs, 0 to check each pixel
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes behavior of later calls to the fill routines,
+ *                 read_obj_image, and read_obj_atlas
+ */
+void
+set_object_spans (int32_t enable)
+{
+    use_object_spans = enable;
+}
+
+
+/* 
+ * set_column_copies
+ *   DESCRIPTION: Choose whether fill_vert_buffer keeps and reads column
+ *                by column copies of room photos and object images 
+ *                (the default) or reads down the columns of the 
+ *                originals.  A copy takes as much memory as the 
+ *                original.  Copies already made are kept either way;
+ *                object images read while copies are off get none.
+ *   INPUTS: enable -- non-zero to use column copies, 0 not to
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes behavior of later calls to fill_vert_buffer,
+ *                 read_obj_image, and read_obj_atlas
+ */
+void
+set_column_copies (int32_t enable)
+{
+    use_column_copies = enable;
+}
+
+
+/* 
+ * set_object_index
+ *   DESCRIPTION: Choose whether fill_horiz_buffer and fill_vert_buffer
+ *                use the room's index of objects by rows and columns
+ *                (the default) or check every object in the room for
+ *                each line.  Both give the same result; the choice 
+ *                exists for timing.
+ *   INPUTS: enable -- non-zero to use the index, 0 not to
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes behavior of later calls to the fill routines
+ */
+void
+set_object_index (int32_t enable)
+{
+    use_object_index = enable;
+}
+
+
+/* 
+ * set_planar_pixels
+ *   DESCRIPTION: Choose whether room photos and object images read from
+ *                now on also keep a copy of their pixels stored as mode
+ *                X planes (the default).  The copy takes as much memory
+ *                as the original and some time to make, but lets 
+ *                fill_rect copy whole pieces of rows into the build
+ *                buffer.
+ *   INPUTS: enable -- non-zero to make plane copies, 0 not to
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes behavior of later calls to read_photo, 
+ *                 read_obj_image, and read_obj_atlas
+ */
+void
+set_planar_pixels (int32_t enable)
+{
+    use_planar_pixels = enable;
+}
+
+
+/* 
+ * set_palette_budget
+ *   DESCRIPTION: Choose how read_photo selects the palette of a room
+ *                photo.  By default (0), the 128 most common level 4
+ *                octree colors and all 64 level 2 colors are used.  A
+ *                budget from 1 to 192 instead uses the reducible octree
+ *                in octree.c to choose at most that many colors.  Call
+ *                before reading photos, not while they are being read.
+ *   INPUTS: n_colors -- palette budget, or 0 for the fixed scheme
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes behavior of later calls to read_photo
+ */
+void
+set_palette_budget (uint32_t n_colors)
+{
+    palette_budget = (192 < n_colors ? 192 : n_colors);
+}
+
+
+/* 
+ * set_quantize_threads
+ *   DESCRIPTION: Choose how many threads read_photo uses for the pixel
+ *                passes over a photo.  Each thread handles one band of
+ *                rows, and the results are combined in a fixed order,
+ *                so the photo read does not depend on the choice.  By
+ *                default (0), one thread per processor is used, but
+ *                only for photos big enough to be worth splitting.  Call
+ *                before reading photos, not while they are being read.
+ *   INPUTS: n_threads -- number of threads, or 0 to choose automatically
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes behavior of later calls to read_photo
+ */
+void
+set_quantize_threads (uint32_t n_threads)
+{
+    quantize_threads = n_threads;
+}
+
+
+/* 
+ * photo_mse
+ *   DESCRIPTION: Measure how well a room photo's palette represents the
+ *                photo file from which it was read, as the mean over
+ *                all pixels of the squared difference between original
+ *                and displayed color, summed over the three channels.
+ *                Colors are compared as 6-bit VGA channel values.
+ *   INPUTS: p -- the photo, as returned by read_photo
+ *           fname -- the photo file from which p was read
+ *   OUTPUTS: none
+ *   RETURN VALUE: the mean squared error, or -1 if the file cannot be
+ *                 read or does not match p
+ *   SIDE EFFECTS: none
+ */
+double
+photo_mse (const photo_t* p, const char* fname)
+{
+    FILE*          in;		  /* input file                  */
+    photo_header_t hdr;		  /* header from input file      */
+    uint16_t*      pixels = NULL; /* 5:6:5 pixel data            */
+    uint16_t       x;		  /* index over image columns    */
+    uint16_t       y;		  /* index over image rows       */
+    const uint8_t* rgb;		  /* displayed color of a pixel  */
+    int32_t        diff;	  /* difference in one channel   */
+    double         sum = 0;	  /* sum of squared differences  */
+    uint32_t       n;		  /* number of pixels            */
+
+    if (NULL == (in = fopen (fname, "r+b")) ||
+	1 != fread (&hdr, sizeof (hdr), 1, in) ||
+	p->hdr.width != hdr.width || p->hdr.height != hdr.height ||
+	NULL == (pixels = malloc (hdr.width * hdr.height * 
+				  sizeof (pixels[0]))) ||
+	hdr.width * hdr.height != 
+	    fread (pixels, sizeof (pixels[0]), hdr.width * hdr.height, in)) {
+	if (NULL != pixels) {
+	    free (pixels);
+	}
+	if (NULL != in) {
+	    (void)fclose (in);
+	}
+	return -1;
+    }
+    (void)fclose (in);
+
+    /* The file is stored bottom to top; the image, top to bottom. */
+    n = hdr.width * hdr.height;
+    for (y = 0; hdr.height > y; y++) {
+	for (x = 0; hdr.width > x; x++) {
+	    rgb = p->palette[p->img[hdr.width * (hdr.height - 1 - y) + x] - 
+			     PALETTE_USED];
+	    diff = ((pixels[hdr.width * y + x] >> 10) & 0x3E) - rgb[0];
+	    sum += diff * diff;
+	    diff = ((pixels[hdr.width * y + x] >> 5) & 0x3F) - rgb[1];
+	    sum += diff * diff;
+	    diff = ((pixels[hdr.width * y + x] << 1) & 0x3E) - rgb[2];
+	    sum += diff * diff;
+	}
+    }
+    free (pixels);
+    return (0 == n ? 0 : sum / n);
+}
+
+
+/* 
+ * decode_photo
+ *   DESCRIPTION: Read size and pixel data in 5:6:5 RGB format from a
+ *                photo file and create a photo structure from it.
+ *                The pixel data are read with a single block read into
+ *                a heap buffer (never onto the stack), then used to
+ *                select the optimized palette colors and mapped row by
+ *                row into those colors.
+ *   INPUTS: fname -- file name for input
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 on failure
+ *   SIDE EFFECTS: dynamically allocates memory for the photo
+ */
+static photo_t*
+decode_photo (const char* fname)
+{
+    FILE*     in;		/* input file                          */
+    photo_t*  p = NULL;		/* photo structure                     */
+    uint16_t* pixels = NULL;	/* 5:6:5 pixel data, in file row order */
+
+    /* 
+     * Open the file, allocate the structure, read the header, do some
+     * sanity checks on it, and allocate space to hold the photo pixels.
+     * All of the 5:6:5 pixel data are then pulled in with one fread
+     * rather than one call per pixel.  If anything fails, clean up as 
+     * necessary and return NULL.
+     */
+    if (NULL == (in = fopen (fname, "r+b")) ||
+	NULL == (p = malloc (sizeof (*p))) ||
+	NULL != (p->img = NULL) || /* false clause for initialization */
+	NULL != (p->cache = NULL) || /* false clause for initialization */
+	NULL != (p->col_img = NULL) || /* false clause for initialization */
+	NULL != (p->plane_img = NULL) || /* false clause for initialization */
+	1 != fread (&p->hdr, sizeof (p->hdr), 1, in) ||
+	MAX_PHOTO_WIDTH < p->hdr.width ||
 	MAX_PHOTO_HEIGHT < p->hdr.height ||
 	NULL == (p->img = malloc 
-		 (p->hdr.width * p->hdr.height * sizeof (p->img[0])))) {
+		 (p->hdr.width * p->hdr.height * sizeof (p->img[0]))) ||
+	NULL == (pixels = malloc 
+		 (p->hdr.width * p->hdr.height * sizeof (pixels[0]))) ||
+	p->hdr.width * p->hdr.height != 
+	    fread (pixels, sizeof (pixels[0]), 
+		   p->hdr.width * p->hdr.height, in)) {
+	if (NULL != pixels) {
+	    free (pixels);
+	}
 	if (NULL != p) {
 	    if (NULL != p->img) {
 	        free (p->img);
@@ -458,35 +1621,84 @@ read_photo (const char* fname)
 	}
 	return NULL;
     }
+
+    /* no need for the file anymore */
+    (void)fclose (in);
+
+    /* Use the reducible octree if a palette budget has been set. */
+    if (0 != palette_budget) {
+	if (!octree_photo (p, pixels)) {
+	    free (p->img);
+	    free (p);
+	    p = NULL;
+	}
+	free (pixels);
+	return p;
+    }
+
 	/*declare variables for the following codes*/
-	image_size = p->hdr.width * p->hdr.height;
-	struct octree_node level_2[OCTREE_LEVEL2_NODES_NUM];	//the 4th level of octree, has 8^4 nodes
-	struct octree_node level_4[OCTREE_LEVEL4_NODES_NUM];	//the 4th level of octree, has 8^4 nodes
-	/*have the same order of original level_4, keeps the position of the first 128 nodes in sorted level_4,
-	* all the other places are -1*/
-	int	new_position_of_level_4[OCTREE_LEVEL4_NODES_NUM];
+	struct octree_node level_2[OCTREE_LEVEL2_NODES_NUM];	//the 2nd level of octree, has 8^2 nodes
+	struct decode_scratch*	scratch;	//level 4 nodes, counts and map, on the heap
+	struct octree_node*	level_4;	//the 4th level of octree, has 8^4 nodes
+	struct octree_hist*	hist;	//level 4 statistics, one per band of pixels
+	hist_band_t	band[MAX_QUANTIZE_THREADS];	//bands of rows for the histogram pass
+	uint32_t	n_bands;	//number of bands
+	uint32_t	b;		//index over bands
+	/*scratch copy of the level 4 pixel counts, reordered to find the 128 largest*/
+	unsigned int*	counts;
+	unsigned int	threshold;	//the 128th largest pixel count among level 4 nodes
+	uint32_t	n_ties;		//how many nodes with exactly threshold pixels still get a palette entry
+	uint16_t	next_palette_idx;	//palette index for the next level 4 node chosen
 	uint32_t	i;		//general index for looping
+	uint32_t	lane;		//index over sub-histograms
+	uint32_t	j;		//index over colors in a level 4 node
 	uint32_t		red_average;	//used to caluate the average for red
 	uint32_t		green_average;	//used to caluate the average for green	
 	uint32_t		blue_average;	//used to caluate the average for blue
-	uint16_t	pixels_array[image_size];	//recorded the photo pixels
+	uint8_t*	map;	//palette entry (less PALETTE_USED) of each 5:6:5 color
+	/*the 16 colors in a level 4 node differ only in these bits*/
+	static const uint16_t	node_color_bits[16] = {
+		0x0000, 0x0001, 0x0020, 0x0021, 0x0040, 0x0041, 0x0060, 0x0061,
+		0x0800, 0x0801, 0x0820, 0x0821, 0x0840, 0x0841, 0x0860, 0x0861
+	};
+	uint16_t	node_color;	//first 5:6:5 color in a level 4 node
+	
+	/*allocate the scratch space and one histogram per band, falling back
+	 *to a single band if there is not enough memory for more*/
+	n_bands = quantize_bands(p->hdr.width, p->hdr.height);
+	hist = NULL;
+	if(NULL != (scratch = malloc(sizeof(*scratch))) &&
+	   NULL == (hist = malloc(n_bands * sizeof(*hist))) && n_bands > 1)
+	{
+		n_bands = 1;
+		hist = malloc(sizeof(*hist));
+	}
+	if(NULL == scratch || NULL == hist)
+	{
+		free(scratch);
+		free(p->img);
+		free(p);
+		free(pixels);
+		return NULL;
+	}
+	level_4 = scratch->level_4;
+	counts = scratch->counts;
+	map = scratch->map;
+	
 	/*initialize some variables*/
 	
-	//intialize level_4 and new_position_of_level_4
+	//intialize level_4
 	for(i = 0; i < OCTREE_LEVEL4_NODES_NUM; ++i)
 	{
-		level_4[i].idx_by_RGB = i;
 		level_4[i].idx_in_level_2 = 100;
 		level_4[i].red_sum = level_4[i].green_sum = level_4[i].blue_sum = 0;
 		level_4[i].pixel_number = 0;
 		level_4[i].palette_idx = -1;
-		new_position_of_level_4[i] = -1;
 	}
 	
 	//intialize level_2
 	for(i = 0; i < OCTREE_LEVEL2_NODES_NUM; ++i)
 	{
-		level_2[i].idx_by_RGB = i;
 		level_2[i].idx_in_level_2 = 100;
 		level_2[i].red_sum = level_2[i].green_sum = level_2[i].blue_sum = 0;
 		level_2[i].pixel_number = 0;
@@ -494,61 +1706,85 @@ read_photo (const char* fname)
 		
 	}
 	
-	/*first loop over file: map all the pixels into leverl4 array 
+	/*first loop over the pixels: map all the pixels into level 4 nodes
 	 *and record the number of pixels in each node, also records their sum of RGB
-	 *this loop also put the file into the pixels array*/
+	 *the order of the rows does not matter for these sums, so large photos are
+	 *split into bands of rows, each counted by its own thread*/
+	for(b = 0; b < n_bands; ++b)
+	{
+		band[b].pixels = pixels + p->hdr.width * (p->hdr.height * b / n_bands);
+		band[b].n_pixels = p->hdr.width * (p->hdr.height * (b + 1) / n_bands - p->hdr.height * b / n_bands);
+		band[b].hist = &hist[b];
+	}
+	run_bands(histogram_band, band, sizeof(band[0]), n_bands);
 	
-	/* 
-     * Loop over rows from bottom to top.  Note that the file is stored
-     * in this order, whereas in memory we store the data in the reverse
-     * order (top to bottom).
-     */
-    for (y = p->hdr.height; y-- > 0; ) 
+	/*add up the bands and lanes into level_4, always in the same order; the level 2
+	 *node of a level 4 node is given by the top two bits of each of its R, G and B*/
+	for(i = 0; i < OCTREE_LEVEL4_NODES_NUM; ++i)
 	{
-		/* Loop over columns from left to right. */
-		for (x = 0; p->hdr.width > x; x++) 
+		for(b = 0; b < n_bands; ++b)
 		{
-	    /* 
-	     * Try to read one 16-bit pixel.  On failure, clean up and 
-	     * return NULL.
-	     */
-			if (1 != fread (&pixel, sizeof (pixel), 1, in)) 
+			for(lane = 0; lane < OCTREE_HIST_LANES; ++lane)
 			{
-				free (p->img);
-				free (p);
-				(void)fclose (in);
-				return NULL;
+				level_4[i].pixel_number += band[b].hist->lane[lane][i].pixel_number;
+				level_4[i].red_sum += band[b].hist->lane[lane][i].red_sum;
+				level_4[i].green_sum += band[b].hist->lane[lane][i].green_sum;
+				level_4[i].blue_sum += band[b].hist->lane[lane][i].blue_sum;
 			}
-			
-		//put the pixel in pixels_array
-		pixels_array[p->hdr.width * y + x] = pixel;
-		
-		//find the corrosponding level 4 node
-		i = map_to_octree (pixel, 4);
-		++level_4[i].pixel_number;
-		level_4[i].idx_in_level_2 = map_to_octree(pixel, 2);
-		level_4[i].red_sum += (pixel >> 11) & 0x001F;
-		level_4[i].green_sum += (pixel >> 5) & 0x003F;
-		level_4[i].blue_sum += pixel & 0x001F;
-		level_4[i].idx_by_RGB = i;
 		}
-    }
-	
-    /* no need for the file anymore */
-    (void)fclose (in);
+		if(level_4[i].pixel_number)
+		{
+			level_4[i].idx_in_level_2 = ((i >> 10) << 4) | (((i >> 6) & 0x3) << 2) | ((i >> 2) & 0x3);
+		}
+	}
+	free(hist);
 	
 	
-	/*qsort the level 4 array to get the first 128 nodes, the reulst will be descending order*/
-	qsort(level_4, OCTREE_LEVEL4_NODES_NUM, sizeof(struct octree_node), level_4_qsort_compare);
+	/*find the pixel count of the 128th most populated level 4 node without
+	 *moving the nodes themselves; every node with more pixels is used, and
+	 *nodes with exactly that many are used in index order until 128 are chosen
+	 *(the qsort used before did not fix the order of ties, so among ties its
+	 *choice of nodes could differ from this one)*/
+	for(i = 0; i < OCTREE_LEVEL4_NODES_NUM; ++i)
+	{
+		counts[i] = level_4[i].pixel_number;
+	}
+	threshold = kth_largest_count(counts, OCTREE_LEVEL4_NODES_NUM, OCTREE_LEVEL4_NODES_USED_NUM);
+	n_ties = OCTREE_LEVEL4_NODES_USED_NUM;
+	for(i = 0; i < OCTREE_LEVEL4_NODES_NUM; ++i)
+	{
+		if(level_4[i].pixel_number > threshold)
+		{
+			--n_ties;
+		}
+	}
 	
 	
-	/*for level 4 nodes, calculate the average color for first 128 nodes 
-	 *and put the corrosponding value in palette and the palette index 
-	 *and put their new position index to an array representing the old array*/
+	/*for the 128 chosen level 4 nodes, calculate the average color and put
+	 *the corrosponding value in palette and the palette index; put the rest
+	 *of level_4 into level_2*/
 	unsigned int pixel_num;
-	for(i = 0; i < OCTREE_LEVEL4_NODES_USED_NUM; ++i)
+	uint16_t 	level_2_idx;
+	next_palette_idx = PALETTE_USED;
+	for(i = 0; i < OCTREE_LEVEL4_NODES_NUM; ++i)
 	{
 		pixel_num = level_4[i].pixel_number;
+		if(pixel_num < threshold || (pixel_num == threshold && 0 == n_ties))
+		{
+			level_2_idx = level_4[i].idx_in_level_2;
+			if(level_2_idx < 64)
+			{
+				level_2[level_2_idx].red_sum += level_4[i].red_sum;
+				level_2[level_2_idx].green_sum += level_4[i].green_sum;
+				level_2[level_2_idx].blue_sum += level_4[i].blue_sum;
+				level_2[level_2_idx].pixel_number += level_4[i].pixel_number;
+			}
+			continue;
+		}
+		if(pixel_num == threshold)
+		{
+			--n_ties;
+		}
 		if(pixel_num)
 		{
 			red_average = level_4[i].red_sum / pixel_num;
@@ -559,27 +1795,10 @@ read_photo (const char* fname)
 		{
 			red_average = green_average = blue_average = 0;
 		}
-		p->palette[i][0] = (uint8_t) (red_average & 0x1F) << 1;
-		p->palette[i][1] = (uint8_t) (green_average & 0x3F);
-		p->palette[i][2] = (uint8_t) (blue_average & 0x1F) << 1;
-		level_4[i].palette_idx = PALETTE_USED + i;
-		new_position_of_level_4[level_4[i].idx_by_RGB] = i;
-	}
-	
-	uint16_t 	level_2_idx;
-	/*goes through the rest of the level_4 and put it in level_2 
-	 *and put their new position index to an array representing the old array*/
-	for(i = OCTREE_LEVEL4_NODES_USED_NUM; i < OCTREE_LEVEL4_NODES_NUM; ++i)
-	{
-		level_2_idx = level_4[i].idx_in_level_2;
-		if(level_2_idx < 64)
-		{
-			level_2[level_2_idx].red_sum += level_4[i].red_sum;
-			level_2[level_2_idx].green_sum += level_4[i].green_sum;
-			level_2[level_2_idx].blue_sum += level_4[i].blue_sum;
-			level_2[level_2_idx].pixel_number += level_4[i].pixel_number;
-		}
-		new_position_of_level_4[level_4[i].idx_by_RGB] = i;
+		p->palette[next_palette_idx - PALETTE_USED][0] = (uint8_t) (red_average & 0x1F) << 1;
+		p->palette[next_palette_idx - PALETTE_USED][1] = (uint8_t) (green_average & 0x3F);
+		p->palette[next_palette_idx - PALETTE_USED][2] = (uint8_t) (blue_average & 0x1F) << 1;
+		level_4[i].palette_idx = next_palette_idx++;
 	}
 		
 	/*for level 2 nodes, calculate the average color for each node 
@@ -603,25 +1822,403 @@ read_photo (const char* fname)
 		level_2[i].palette_idx = PALETTE_USED + OCTREE_LEVEL4_NODES_USED_NUM + i;
 	}
 
-	/*goes again the nodes after first 128 in level_4, and find their palette_idx in level_2*/
-	for(i = OCTREE_LEVEL4_NODES_USED_NUM; i < OCTREE_LEVEL4_NODES_NUM; ++i)
+	/*goes again over the level_4 nodes not chosen, and find their palette_idx in level_2*/
+	for(i = 0; i < OCTREE_LEVEL4_NODES_NUM; ++i)
 	{
-		if(level_4[i].idx_in_level_2 < 64)
+		if((uint16_t)-1 == level_4[i].palette_idx && level_4[i].idx_in_level_2 < 64)
 		{
 			level_4[i].palette_idx = level_2[level_4[i].idx_in_level_2].palette_idx; 
 		}		
 	}
 	
-	/*loop over the pixels_array, and put the right value in image*/
-	for(i = 0; i < image_size; ++i)
-	 {
-			p->img[i] = level_4[new_position_of_level_4[map_to_octree(pixels_array[i], 4)]].palette_idx;
-	 }
+	/*make a table of the palette entry for every 5:6:5 color, so that
+	 *putting the right palette value in the image takes one lookup per pixel*/
+	for(i = 0; i < OCTREE_LEVEL4_NODES_NUM; ++i)
+	{
+		node_color = ((i >> 8) << 12) | (((i >> 4) & 0x000F) << 7) | ((i & 0x000F) << 1);
+		for(j = 0; j < 16; ++j)
+		{
+			map[node_color | node_color_bits[j]] = level_4[i].palette_idx - PALETTE_USED;
+		}
+	}
+	remap_photo(p, pixels, map);
 	
+	free(scratch);
+	free (pixels);
+    return p;
+}
+
+
+/* 
+ * octree_photo
+ *   DESCRIPTION: Select a palette for a photo with the reducible octree
+ *                and fill in the photo's image with it.
+ *   INPUTS: pixels -- the photo's 5:6:5 pixels, in file (bottom to top)
+ *                     row order
+ *   OUTPUTS: p -- the photo, with palette and image filled in
+ *   RETURN VALUE: 1 on success, 0 if memory cannot be allocated
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+octree_photo (photo_t* p, const uint16_t* pixels)
+{
+    uint8_t* map; /* palette entry of each 5:6:5 color */
+
+    if (NULL == (map = malloc (65536))) {
+        return 0;
+    }
+
+    /* Colors beyond the palette budget are left black. */
+    (void)memset (p->palette, 0, sizeof (p->palette));
+    if (!octree_quantize (pixels, p->hdr.width * p->hdr.height,
+			  palette_budget, p->palette, map)) {
+	free (map);
+	return 0;
+    }
+    remap_photo (p, pixels, map);
+    free (map);
+    return 1;
+}
+
+
+/* 
+ * remap_photo
+ *   DESCRIPTION: Fill in a photo's image from its 5:6:5 pixels, given
+ *                the palette entry chosen for each color.  Whichever
+ *                quantizer chose the palette, this takes a single table
+ *                lookup per pixel.
+ *   INPUTS: pixels -- the photo's 5:6:5 pixels, in file (bottom to top)
+ *                     row order
+ *           map -- palette entry (less PALETTE_USED) of each color in
+ *                  the pixels
+ *   OUTPUTS: p -- the photo, with image filled in
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void
+remap_photo (photo_t* p, const uint16_t* pixels, const uint8_t map[65536])
+{
+    remap_band_t band[MAX_QUANTIZE_THREADS]; /* bands of rows */
+    uint32_t     n_bands;                    /* number of bands */
+    uint32_t     b;                          /* index over bands */
+
+    n_bands = quantize_bands (p->hdr.width, p->hdr.height);
+    for (b = 0; n_bands > b; b++) {
+	band[b].p = p;
+	band[b].pixels = pixels;
+	band[b].map = map;
+	band[b].first = p->hdr.height * b / n_bands;
+	band[b].end = p->hdr.height * (b + 1) / n_bands;
+    }
+    run_bands (remap_band, band, sizeof (band[0]), n_bands);
+}
+
+
+/* 
+ * remap_band
+ *   DESCRIPTION: Fill in one band of rows of a photo's image (see 
+ *                remap_photo).  Called directly or as a thread.
+ *   INPUTS: arg -- the band (a remap_band_t)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills in the band's rows of the photo's image
+ */
+static void*
+remap_band (void* arg)
+{
+    const remap_band_t* band = arg; /* the band to fill in         */
+    const photo_t*      p = band->p; /* photo being filled in      */
+    const uint16_t*     row;        /* current row within pixels   */
+    uint8_t*            out;        /* current row within image    */
+    uint16_t            x;          /* index over image columns    */
+    uint16_t            y;          /* index over file rows        */
+
+    /* 
+     * Note that the file is stored from bottom to top, whereas in 
+     * memory we store the data in the reverse order (top to bottom).
+     */
+    row = band->pixels + p->hdr.width * band->first;
+    for (y = band->first; band->end > y; y++, row += p->hdr.width) {
+	out = &p->img[p->hdr.width * (p->hdr.height - 1 - y)];
+	for (x = 0; p->hdr.width > x; x++) {
+	    out[x] = PALETTE_USED + band->map[row[x]];
+	}
+    }
+    return NULL;
+}
+
+
+/* 
+ * histogram_band
+ *   DESCRIPTION: Gather the level 4 octree statistics for one band of
+ *                rows of a photo.  Called directly or as a thread.
+ *   INPUTS: arg -- the band (a hist_band_t)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills in the band's statistics
+ */
+static void*
+histogram_band (void* arg)
+{
+    const hist_band_t* band = arg;          /* the band to count          */
+    uint16_t           span[MAX_PHOTO_WIDTH]; /* level 4 nodes of a run   */
+    uint32_t           len;                 /* number of pixels in run    */
+    uint32_t           i;                   /* index over pixels          */
+
+    (void)memset (band->hist, 0, sizeof (*band->hist));
+    for (i = 0; band->n_pixels > i; i += len) {
+	len = band->n_pixels - i;
+	if (MAX_PHOTO_WIDTH < len) {
+	    len = MAX_PHOTO_WIDTH;
+	}
+	map_to_octree_span (band->pixels + i, len, span, NULL);
+	accumulate_octree_hist (band->hist, band->pixels + i, span, len);
+    }
+    return NULL;
+}
+
+
+/* 
+ * quantize_bands
+ *   DESCRIPTION: Decide how many bands of rows (one per thread) to split
+ *                the pixel passes over a photo into.
+ *   INPUTS: width, height -- dimensions of the photo
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bands, from 1 to MAX_QUANTIZE_THREADS
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+quantize_bands (uint16_t width, uint16_t height)
+{
+    long n_bands; /* number of bands */
+
+    if (0 != quantize_threads) {
+	n_bands = quantize_threads;
+    } else {
+	/* Use one thread per processor, but keep bands large. */
+	n_bands = sysconf (_SC_NPROCESSORS_ONLN);
+	if ((long)width * height / QUANTIZE_BAND_PIXELS < n_bands) {
+	    n_bands = (long)width * height / QUANTIZE_BAND_PIXELS;
+	}
+    }
+    if (height < n_bands) {
+	n_bands = height;
+    }
+    if (MAX_QUANTIZE_THREADS < n_bands) {
+	n_bands = MAX_QUANTIZE_THREADS;
+    }
+    return (1 > n_bands ? 1 : n_bands);
+}
+
+
+/* 
+ * run_bands
+ *   DESCRIPTION: Run a function on each of an array of bands, one thread
+ *                per band, with the calling thread taking the first band.
+ *                If a thread can't be created, the calling thread takes
+ *                its band, too.  Returns once all bands are done.
+ *   INPUTS: fn -- the function to run
+ *           bands -- the bands
+ *           band_size -- size of each band in bytes
+ *           n_bands -- number of bands, at most MAX_QUANTIZE_THREADS
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: whatever fn does
+ */
+static void
+run_bands (void* (*fn) (void*), void* bands, size_t band_size,
+	   uint32_t n_bands)
+{
+    pthread_t worker[MAX_QUANTIZE_THREADS]; /* helper threads        */
+    int32_t   started[MAX_QUANTIZE_THREADS]; /* helper was created   */
+    uint32_t  b;                             /* index over bands     */
+
+    for (b = 1; n_bands > b; b++) {
+	started[b] = (0 == pthread_create (&worker[b], NULL, fn,
+					   (char*)bands + b * band_size));
+    }
+    (void)(*fn) (bands);
+    for (b = 1; n_bands > b; b++) {
+	if (started[b]) {
+	    (void)pthread_join (worker[b], NULL);
+	} else {
+	    (void)(*fn) ((char*)bands + b * band_size);
+	}
+    }
+}
+
+
+/* 
+ * hash_photo_file
+ *   DESCRIPTION: Calculate a 32-bit FNV-1a hash of the contents of a 
+ *                file.  Used to recognize a room photo that has been 
+ *                touched but not changed since its cache was written.
+ *   INPUTS: fname -- name of the file to hash
+ *   OUTPUTS: none
+ *   RETURN VALUE: the hash value, or 0 if the file cannot be read
+ *   SIDE EFFECTS: none
+ */
+static uint32_t
+hash_photo_file (const char* fname)
+{
+    FILE*    in;	  /* file being hashed          */
+    uint8_t  buf[4096];   /* block of data from file    */
+    size_t   len;	  /* number of bytes in block   */
+    size_t   i;		  /* index over bytes in block  */
+    uint32_t hash;	  /* hash of data so far        */
+
+    if (NULL == (in = fopen (fname, "r+b"))) {
+	return 0;
+    }
+    hash = 2166136261UL;
+    while (0 < (len = fread (buf, 1, sizeof (buf), in))) {
+	for (i = 0; len > i; i++) {
+	    hash = (hash ^ buf[i]) * 16777619UL;
+	}
+    }
+    (void)fclose (in);
+    return hash;
+}
+
+
+/* 
+ * map_photo_cache
+ *   DESCRIPTION: Try to create a photo structure from a quantized photo
+ *                cache file.  The cache is used only if it was produced
+ *                by the current quantization code (version) from a file
+ *                of the same size as the room photo, and if either the
+ *                modification times or the file hashes match.  Pixel 
+ *                data are left in the (read-only) mapping of the file.
+ *   INPUTS: cname -- name of the cache file
+ *           fname -- name of the room photo file
+ *           src -- file status of the room photo file
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to newly allocated photo on success, or NULL
+ *                 if the cache is missing or out of date
+ *   SIDE EFFECTS: dynamically allocates memory for the photo and maps
+ *                 the cache file
+ */
+static photo_t*
+map_photo_cache (const char* cname, const char* fname, const struct stat* src)
+{
+    int                         fd;    /* cache file descriptor     */
+    struct stat                 cst;   /* status of cache file      */
+    void*                       map;   /* mapping of cache file     */
+    const photo_cache_header_t* h;     /* header of cache file      */
+    photo_t*                    p;     /* photo structure           */
+    uint32_t                    mtime; /* photo modification time   */
+
+    /* Open and map the whole cache file. */
+    if (-1 == (fd = open (cname, O_RDWR)) &&
+	-1 == (fd = open (cname, O_RDONLY))) {
+	return NULL;
+    }
+    if (0 != fstat (fd, &cst) || sizeof (*h) > cst.st_size ||
+	MAP_FAILED == (map = mmap (NULL, cst.st_size, PROT_READ, 
+				   MAP_PRIVATE, fd, 0))) {
+	(void)close (fd);
+	return NULL;
+    }
+
+    /* 
+     * Check that the cache is complete and describes the room photo.
+     * The hash is only calculated when the modification times differ.
+     */
+    h = map;
+    if (PHOTO_CACHE_MAGIC != h->magic || 
+	PHOTO_CACHE_VERSION != h->version ||
+	palette_budget != h->palette_budget ||
+	src->st_size != h->src_size ||
+	MAX_PHOTO_WIDTH < h->width || MAX_PHOTO_HEIGHT < h->height ||
+	cst.st_size != sizeof (*h) + sizeof (p->palette) + 
+		       h->width * h->height ||
+	(src->st_mtime != h->src_mtime && 
+	 h->src_hash != hash_photo_file (fname)) ||
+	NULL == (p = malloc (sizeof (*p)))) {
+	(void)munmap (map, cst.st_size);
+	(void)close (fd);
+	return NULL;
+    }
+
+    /* 
+     * If the photo was only touched, record the new modification time
+     * so that we need not calculate the hash again next time.
+     */
+    if (src->st_mtime != h->src_mtime) {
+	mtime = src->st_mtime;
+	(void)pwrite (fd, &mtime, sizeof (mtime), 
+		      offsetof (photo_cache_header_t, src_mtime));
+    }
+    (void)close (fd);
+
+    /* Copy the palette, but leave the pixel data in the mapping. */
+    p->hdr.width = h->width;
+    p->hdr.height = h->height;
+    (void)memcpy (p->palette, h + 1, sizeof (p->palette));
+    p->img = (uint8_t*)(h + 1) + sizeof (p->palette);
+    p->cache = map;
+    p->cache_len = cst.st_size;
+    p->col_img = NULL;
+    p->plane_img = NULL;
     return p;
 }
 
 
+/* 
+ * write_photo_cache
+ *   DESCRIPTION: Write a quantized photo cache file holding the palette
+ *                and pixel data of a photo.  The file is written under
+ *                a temporary name and then renamed, so a partly written
+ *                cache is never seen by map_photo_cache.  Failure is not
+ *                an error: the photo is simply quantized again next time.
+ *   INPUTS: cname -- name of the cache file
+ *           p -- the photo just read from the room photo file
+ *           src -- file status of the room photo file
+ *           src_hash -- hash of the room photo file contents
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: creates or replaces the cache file
+ */
+static void
+write_photo_cache (const char* cname, const photo_t* p, 
+		   const struct stat* src, uint32_t src_hash)
+{
+    char                 tname[PHOTO_CACHE_NAME_LEN + 8]; /* temp. name */
+    int                  fd;	/* temporary file descriptor   */
+    FILE*                out;	/* temporary file              */
+    photo_cache_header_t h;	/* header for the cache file   */
+    int32_t              ok;	/* all data written?           */
+
+    /* Create a uniquely named temporary file next to the cache file. */
+    (void)snprintf (tname, sizeof (tname), "%s.XXXXXX", cname);
+    if (-1 == (fd = mkstemp (tname))) {
+	return;
+    }
+    if (NULL == (out = fdopen (fd, "w+b"))) {
+	(void)close (fd);
+	(void)unlink (tname);
+	return;
+    }
+
+    /* Write the header, the palette, and the pixel data. */
+    h.magic = PHOTO_CACHE_MAGIC;
+    h.version = PHOTO_CACHE_VERSION;
+    h.src_size = src->st_size;
+    h.src_mtime = src->st_mtime;
+    h.src_hash = src_hash;
+    h.palette_budget = palette_budget;
+    h.width = p->hdr.width;
+    h.height = p->hdr.height;
+    ok = (1 == fwrite (&h, sizeof (h), 1, out) &&
+	  1 == fwrite (p->palette, sizeof (p->palette), 1, out) &&
+	  p->hdr.width * p->hdr.height == 
+	      fwrite (p->img, 1, p->hdr.width * p->hdr.height, out));
+    if (EOF == fclose (out) || !ok || 0 != rename (tname, cname)) {
+	(void)unlink (tname);
+    }
+}
+
+
 /*
  *map_to_octree
  *Description: helper function that convert the 16 bit RGB value to map to level 2 or level 4 nodes
@@ -650,17 +2247,176 @@ uint16_t map_to_octree (const uint16_t pixel, const uint8_t level_number)
 
 
 /*
- *level_4_qsort_compare
- *Description: helper function that compare the number of pixels in two octree nodes
- *Input: general pointer a and b
+ *map_to_octree_span
+ *Description: converts a run of 16 bit RGB values to their level 4 and level 2
+ *             octree nodes, giving the same results as map_to_octree; uses
+ *             lookup tables unless compiled with -DNO_OCTREE_TABLES, in which
+ *             case the bits are gathered directly
+ *Input: pixels -- the 16 bit pixels (5:6:5) of RGB
+ *       n -- number of pixels
+ *Output: level_4_idx -- level 4 node of each pixel
+ *        level_2_idx -- level 2 node of each pixel, or NULL if not needed
+ *Return Value: None
+ *Side Effects: fills the lookup tables on the first call
+ */
+void map_to_octree_span(const uint16_t* pixels, uint32_t n,
+			uint16_t* level_4_idx, uint8_t* level_2_idx)
+{
+	uint32_t	i;	//index over pixels
+	
+#if !defined(NO_OCTREE_TABLES)
+	(void)pthread_once(&octree_tables_once, init_octree_tables);
+	for(i = 0; i < n; ++i)
+	{
+		level_4_idx[i] = octree_level_4_table[pixels[i]];
+	}
+	if(NULL != level_2_idx)
+	{
+		for(i = 0; i < n; ++i)
+		{
+			level_2_idx[i] = octree_level_2_table[pixels[i]];
+		}
+	}
+#else
+	uint16_t	pixel;	//one pixel
+	
+	for(i = 0; i < n; ++i)
+	{
+		pixel = pixels[i];
+		level_4_idx[i] = ((pixel >> 4) & 0x0F00) | ((pixel >> 3) & 0x00F0) | ((pixel >> 1) & 0x000F);
+	}
+	if(NULL != level_2_idx)
+	{
+		for(i = 0; i < n; ++i)
+		{
+			pixel = pixels[i];
+			level_2_idx[i] = ((pixel >> 10) & 0x30) | ((pixel >> 7) & 0x0C) | ((pixel >> 3) & 0x03);
+		}
+	}
+#endif
+}
+
+
+#if !defined(NO_OCTREE_TABLES)
+/*
+ *init_octree_tables
+ *Description: fills the lookup tables used by map_to_octree_span from map_to_octree
+ *Input: None
  *Output: None
- *Return Value: > 0 if the element pointed by a goes after the element pointed by b
+ *Return Value: None
+ *Side Effects: fills octree_level_4_table and octree_level_2_table
+ */
+static void init_octree_tables(void)
+{
+	uint32_t	pixel;	//index over all 16 bit pixels
+	
+	for(pixel = 0; pixel < 65536; ++pixel)
+	{
+		octree_level_4_table[pixel] = map_to_octree(pixel, 4);
+		octree_level_2_table[pixel] = map_to_octree(pixel, 2);
+	}
+}
+#endif
+
+
+/*
+ *accumulate_octree_hist
+ *Description: adds a run of pixels into the level 4 statistics, sending
+ *             consecutive pixels to different lanes
+ *Input: pixels -- the 16 bit pixels (5:6:5) of RGB
+ *       nodes -- level 4 node of each pixel, from map_to_octree_span
+ *       n -- number of pixels
+ *Output: hist -- the statistics to add to
+ *Return Value: None
  *Side Effects: None
  */
-int level_4_qsort_compare(const void *a, const void *b)
+static void accumulate_octree_hist(struct octree_hist* hist, const uint16_t* pixels,
+				   const uint16_t* nodes, uint32_t n)
+{
+	uint32_t	i;	//index over pixels
+	uint32_t	lane;	//sub-histogram for the current pixel
+	uint16_t	pixel;	//the current pixel
+	struct octree_count*	count;	//record for the current pixel's node
+	
+	for(i = 0, lane = 0; i < n; ++i)
+	{
+		pixel = pixels[i];
+		count = &hist->lane[lane][nodes[i]];
+		++count->pixel_number;
+		count->red_sum += (pixel >> 11) & 0x001F;
+		count->green_sum += (pixel >> 5) & 0x003F;
+		count->blue_sum += pixel & 0x001F;
+		if(++lane == OCTREE_HIST_LANES)
+		{
+			lane = 0;
+		}
+	}
+}
+
+
+/*
+ *kth_largest_count (interface function; declared in photo.h)
+ *Description: finds the kth largest of an array of pixel counts by repeatedly
+ *             partitioning around a median-of-three pivot (quickselect), which
+ *             takes expected time linear in the size of the array
+ *Input: counts -- the pixel counts; reordered by the call
+ *       n -- number of counts in the array
+ *       k -- which count to find, 1 for the largest
+ *Output: None
+ *Return Value: the kth largest count
+ *Side Effects: reorders counts
+ */
+unsigned int kth_largest_count(unsigned int* counts, int32_t n, int32_t k)
 {
-	const struct octree_node* octree_node_a = a;
-	const struct octree_node* octree_node_b = b;
-	return (octree_node_b->pixel_number - octree_node_a->pixel_number);
+	int32_t	lo = 0;		//first index of the range still holding the answer
+	int32_t	hi = n - 1;	//last index of that range
+	int32_t	target = k - 1;	//index of the answer once sorted in descending order
+	int32_t	i, j;		//scan indices for partitioning
+	unsigned int	a, b, c;	//candidates for the pivot
+	unsigned int	pivot;		//count to partition around
+	unsigned int	tmp;		//used for swapping
 	
+	while(lo < hi)
+	{
+		a = counts[lo];
+		b = counts[lo + (hi - lo) / 2];
+		c = counts[hi];
+		if(a < b) { tmp = a; a = b; b = tmp; }
+		if(b < c) { b = c; }
+		pivot = (a < b ? a : b);
+		
+		/*afterwards, [lo, j] >= pivot, [i, hi] <= pivot, and anything between equals pivot*/
+		i = lo;
+		j = hi;
+		while(i <= j)
+		{
+			while(counts[i] > pivot)
+			{
+				++i;
+			}
+			while(counts[j] < pivot)
+			{
+				--j;
+			}
+			if(i <= j)
+			{
+				tmp = counts[i];
+				counts[i++] = counts[j];
+				counts[j--] = tmp;
+			}
+		}
+		if(target <= j)
+		{
+			hi = j;
+		}
+		else if(target >= i)
+		{
+			lo = i;
+		}
+		else
+		{
+			return pivot;
+		}
+	}
+	return counts[target];
 }
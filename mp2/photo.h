@@ -56,12 +56,26 @@
 #define OCTREE_LEVEL2_NODES_NUM		64
 #define PALETTE_USED		64
 
+/* returned by read_obj_atlas when memory cannot be allocated */
+#define OBJ_ATLAS_NO_MEMORY	0xFFFFFFFF
+
+/* quantized photo cache files are named by adding this suffix */
+#define PHOTO_CACHE_SUFFIX	".qcache"
+#define PHOTO_CACHE_NAME_LEN	256
+
 /* Fill a buffer with the pixels for a horizontal line of current room. */
 extern void fill_horiz_buffer (int x, int y, unsigned char buf[SCROLL_X_DIM]);
 
 /* Fill a buffer with the pixels for a vertical line of current room. */
 extern void fill_vert_buffer (int x, int y, unsigned char buf[SCROLL_Y_DIM]);
 
+/* 
+ * Draw a rectangle of the current room straight into the mode X build
+ * buffer planes (see draw_rect in modex.c).
+ */
+extern void fill_rect (int x, int y, int w, int h, unsigned char* plane[4], 
+		       int pitch);
+
 /* Get height of object image in pixels. */
 extern uint32_t image_height (const image_t* im);
 
@@ -83,17 +97,86 @@ extern void prep_room (const room_t* r);
 /* Read object image from a file into a dynamically allocated structure. */
 extern image_t* read_obj_image (const char* fname);
 
+/* 
+ * Read a set of object images into one block of memory, sharing images
+ * between repeated file names.  Returns n_images on success, the
+ * index of a file that could not be read, or OBJ_ATLAS_NO_MEMORY.
+ */
+extern uint32_t read_obj_atlas (const char* const fname[], uint32_t n_images,
+				image_t* img[]);
+
 /* Read room photo from a file into a dynamically allocated structure. */
 extern photo_t* read_photo (const char* fname);
 
+/* Read only the header (dimensions) of a room photo file. */
+extern int32_t read_photo_header (const char* fname, photo_header_t* hdr);
+
+/* Free a room photo read by read_photo. */
+extern void free_photo (photo_t* p);
+
+/* 
+ * Get the memory held by a room photo: its palette and pixels, and any
+ * copies of the pixels by plane or by column.
+ */
+extern uint32_t photo_bytes (const photo_t* p);
+
+/* Enable (default) or disable the quantized photo cache used by read_photo. */
+extern void set_photo_cache (int32_t enable);
+
+/* 
+ * Draw objects by copying runs of opaque pixels, or by checking each
+ * pixel for transparency (the default).  For benchmarks only: runs are
+ * found just for object images read (by build_world) while enabled.
+ */
+extern void set_object_spans (int32_t enable);
+
+/* 
+ * Let fill_vert_buffer make and read column by column copies of room
+ * photos and object images (the default), or not.
+ */
+extern void set_column_copies (int32_t enable);
+
+/* 
+ * Find objects near each line drawn through the room's object index (the
+ * default), or check every object in the room.
+ */
+extern void set_object_index (int32_t enable);
+
+/* 
+ * Keep a copy of the pixels of photos and object images read from now on
+ * stored as mode X planes (the default), or not.
+ */
+extern void set_planar_pixels (int32_t enable);
+
+/* 
+ * Choose the palette selection used by read_photo: 0 (the default) for
+ * the fixed octree scheme, or a budget of up to 192 colors for the
+ * reducible octree.
+ */
+extern void set_palette_budget (uint32_t n_colors);
+
+/* 
+ * Choose the number of threads used for the pixel passes of read_photo,
+ * or 0 (the default) to use one per processor for oversized photos.
+ */
+extern void set_quantize_threads (uint32_t n_threads);
+
+/* Mean squared color error of a room photo against its photo file. */
+extern double photo_mse (const photo_t* p, const char* fname);
+
 /*fill in the last 192 positions of VGA palette, defined in modex.c*/
 void fill_my_palette(unsigned char my_palette[192][3]);
 
 /*convert the 16 bit RGB value to map to level 2 or level 4 nodes*/
 extern uint16_t	map_to_octree (const uint16_t pixel, const uint8_t level_number);
 
-/*the compare function for qsort of level_4*/
-extern int level_4_qsort_compare(const void *a, const void *b);
+/*convert a run of 16 bit RGB values to their level 4 and level 2 nodes*/
+extern void map_to_octree_span (const uint16_t* pixels, uint32_t n,
+				uint16_t* level_4_idx, uint8_t* level_2_idx);
+
+/*find the kth largest of an array of pixel counts, reordering the array*/
+extern unsigned int kth_largest_count (unsigned int* counts, int32_t n,
+				       int32_t k);
 
 /* 
  * N.B.  I'm aware that Valgrind and similar tools will report the fact that
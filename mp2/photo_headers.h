@@ -81,5 +81,35 @@ struct photo_header_t {
     uint16_t height;	/* image height in pixels */
 };
 
+/*
+ * Quantized room photo cache file header.  A cache file holds the 
+ * result of palette selection for one room photo so that the octree
+ * work need not be repeated every time the game starts.  The header is
+ * followed by the 192-color palette (6-bit RGB triples, as loaded into
+ * the VGA) and then by one palette index byte per pixel, starting from
+ * the upper left of the image (unlike the room photo itself).  No 
+ * padding is used.
+ *
+ * The size, modification time, and hash of the room photo file from
+ * which the cache was produced are recorded to detect stale caches, 
+ * along with the palette budget used to quantize it.  The value of
+ * PHOTO_CACHE_VERSION must be changed whenever the quantization code 
+ * changes its output.
+ */
+#define PHOTO_CACHE_MAGIC   0x51313933	/* "391Q" (little-endian)   */
+#define PHOTO_CACHE_VERSION 3		/* quantizer output version */
+
+typedef struct photo_cache_header_t photo_cache_header_t;
+struct photo_cache_header_t {
+    uint32_t magic;	/* PHOTO_CACHE_MAGIC                 */
+    uint32_t version;	/* PHOTO_CACHE_VERSION               */
+    uint32_t src_size;	/* size of room photo file in bytes  */
+    uint32_t src_mtime;	/* modification time of room photo   */
+    uint32_t src_hash;	/* FNV-1a hash of room photo file    */
+    uint32_t palette_budget; /* see set_palette_budget        */
+    uint16_t width;	/* image width in pixels             */
+    uint16_t height;	/* image height in pixels            */
+};
+
 #endif /* PHOTO_HEADERS_H */
 
@@ -0,0 +1,433 @@
+/*									tab:8
+ *
+ * render.c - render thread and its command queue
+ *
+ * Version:	    1
+ * Filename:	    render.c
+ * History:
+ *	1	First written.
+ */
+
+/*
+ * The render thread owns the mode X build buffer and video memory: the
+ * game loop and the Tux controller thread queue commands rather than
+ * drawing, so neither waits for a frame to be drawn or copied, and
+ * they never draw into the build buffer at the same time.  Whenever
+ * the queue empties, the render thread calls show_screen.  While a
+ * page waits for vertical retrace (with triple buffering), the thread
+ * polls for it between commands, yielding the processor to the game's
+ * other threads; otherwise, it sleeps until a command arrives.
+ *
+ * The queue is a bounded ring of slots, each tagged with a sequence
+ * number that says whether the slot is free for the command numbered
+ * with it, or holds that command.  Producers claim a command number
+ * with a compare-and-swap on queue_head, fill the slot, and publish
+ * it by advancing its sequence number; the render thread, the only
+ * consumer, empties slots in order.  No locks are taken.  A semaphore
+ * counts the commands queued so that the render thread can sleep.  A
+ * producer claims its number before it posts the semaphore, but two
+ * producers may publish their slots out of order, so the render thread
+ * may take a count before the oldest slot is published; it then waits
+ * for that slot rather than letting the count and the ring get out of
+ * step.
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "modex.h"
+#include "photo.h"
+#include "render.h"
+
+
+/* a few constants */
+#define RENDER_QUEUE_LEN 64 /* slots in the command queue (a power of 2) */
+#define RENDER_TEXT_LEN  40 /* characters that fit in the status bar     */
+
+/* the commands understood by the render thread */
+typedef enum {
+    RC_ENTER,  /* draw a new room                    */
+    RC_VIEW,   /* move the view window               */
+    RC_REDRAW, /* draw the whole view window again   */
+    RC_STATUS, /* draw text into the status bar      */
+    RC_STOP    /* end the render thread              */
+} render_op_t;
+
+/* one command, copied into the queue */
+typedef struct {
+    render_op_t    op;                          /* what to do          */
+    const room_t*  room;                        /* RC_ENTER: the room  */
+    int            x, y;                        /* RC_VIEW: the window */
+    int            mode;                        /* RC_STATUS: the mode */
+    char           text[RENDER_TEXT_LEN + 1];   /* RC_STATUS: the text */
+} render_cmd_t;
+
+/* one slot of the command queue */
+typedef struct {
+    uint32_t       seq; /* slot holds command seq - 1, or is free for seq */
+    render_cmd_t   cmd; /* the command                                    */
+} render_slot_t;
+
+
+/* local functions--see function headers for details */
+static void queue_cmd (const render_cmd_t* cmd);
+static int32_t dequeue_cmd (render_cmd_t* cmd);
+static void move_view (int x, int y);
+static void run_cmd (const render_cmd_t* cmd);
+static void* render_thread (void* ignore);
+
+
+/* the command queue; see the notes at the top of the file */
+static render_slot_t queue[RENDER_QUEUE_LEN];
+static uint32_t queue_head;   /* number of next command queued   */
+static uint32_t queue_tail;   /* number of next command run      */
+static sem_t queue_count;     /* number of commands in the queue */
+
+/* the render thread, and the lock it holds while drawing */
+static pthread_t render_thread_id;
+static pthread_mutex_t* render_world_lock;
+
+/* view window drawn by the render thread */
+static int view_x, view_y;
+
+
+/*
+ * queue_cmd
+ *   DESCRIPTION: Add a command to the queue, and wake the render thread.
+ *                If the queue is full, yields the processor until the
+ *                render thread makes room.
+ *   INPUTS: cmd -- the command
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the queue
+ */
+static void
+queue_cmd (const render_cmd_t* cmd)
+{
+    render_slot_t* slot; /* slot for the command              */
+    uint32_t       pos;  /* number of the command             */
+    int32_t        diff; /* slot's sequence number less pos   */
+
+    pos = __atomic_load_n (&queue_head, __ATOMIC_RELAXED);
+    while (1) {
+	slot = &queue[pos & (RENDER_QUEUE_LEN - 1)];
+	diff = (int32_t)(__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) -
+			 pos);
+
+	/* The slot is free: try to claim it (pos is reloaded if not). */
+	if (0 == diff) {
+	    if (__atomic_compare_exchange_n (&queue_head, &pos, pos + 1, 1,
+					     __ATOMIC_RELAXED,
+					     __ATOMIC_RELAXED)) {
+		break;
+	    }
+	    continue;
+	}
+
+	/* The slot still holds a command from one lap ago: queue full. */
+	if (0 > diff) {
+	    (void)sched_yield ();
+	}
+	pos = __atomic_load_n (&queue_head, __ATOMIC_RELAXED);
+    }
+
+    /* Fill the slot, then publish it. */
+    slot->cmd = *cmd;
+    __atomic_store_n (&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    (void)sem_post (&queue_count);
+}
+
+
+/*
+ * dequeue_cmd
+ *   DESCRIPTION: Take the oldest command from the queue.  Called only by
+ *                the render thread.
+ *   INPUTS: none
+ *   OUTPUTS: cmd -- the command
+ *   RETURN VALUE: 1 if a command was taken, 0 if the queue is empty
+ *   SIDE EFFECTS: changes the queue
+ */
+static int32_t
+dequeue_cmd (render_cmd_t* cmd)
+{
+    render_slot_t* slot; /* oldest slot */
+
+    slot = &queue[queue_tail & (RENDER_QUEUE_LEN - 1)];
+    if (queue_tail + 1 != __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    *cmd = slot->cmd;
+
+    /* Free the slot for the command one lap later. */
+    __atomic_store_n (&slot->seq, queue_tail + RENDER_QUEUE_LEN,
+		      __ATOMIC_RELEASE);
+    queue_tail++;
+    return 1;
+}
+
+
+/*
+ * move_view
+ *   DESCRIPTION: Move the view window, and draw the bands of it that
+ *                were not in view before: a vertical band for any
+ *                horizontal motion and a horizontal band for any
+ *                vertical motion, or the whole window if it has moved
+ *                by a window width or height.
+ *   INPUTS: (x,y) -- new upper left pixel of the view window
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer
+ */
+static void
+move_view (int x, int y)
+{
+    int dx = x - view_x; /* horizontal motion */
+    int dy = y - view_y; /* vertical motion   */
+
+    view_x = x;
+    view_y = y;
+    set_view_window (x, y);
+    if (SCROLL_X_DIM <= dx || -SCROLL_X_DIM >= dx ||
+	SCROLL_Y_DIM <= dy || -SCROLL_Y_DIM >= dy) {
+	(void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+	return;
+    }
+    if (0 < dx) {
+	(void)draw_vert_strip (SCROLL_X_DIM - dx, dx);
+    } else if (0 > dx) {
+	(void)draw_vert_strip (0, -dx);
+    }
+    if (0 < dy) {
+	(void)draw_horiz_strip (SCROLL_Y_DIM - dy, dy);
+    } else if (0 > dy) {
+	(void)draw_horiz_strip (0, -dy);
+    }
+}
+
+
+/*
+ * run_cmd
+ *   DESCRIPTION: Carry out a command other than RC_STOP.  Commands that
+ *                draw from the world hold the world lock while they do.
+ *   INPUTS: cmd -- the command
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: draws into the build buffer or the status bar; may
+ *                 change the palette
+ */
+static void
+run_cmd (const render_cmd_t* cmd)
+{
+    if (RC_STATUS == cmd->op) {
+	show_status_bar (cmd->text, cmd->mode);
+	return;
+    }
+
+    (void)pthread_mutex_lock (render_world_lock);
+    switch (cmd->op) {
+	case RC_ENTER:
+	    view_x = view_y = 0;
+	    set_view_window (0, 0);
+	    prep_room (cmd->room);
+	    (void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+	    break;
+	case RC_VIEW:
+	    move_view (cmd->x, cmd->y);
+	    break;
+	case RC_REDRAW:
+	    (void)draw_rect (0, 0, SCROLL_X_DIM, SCROLL_Y_DIM);
+	    break;
+	default:
+	    break;
+    }
+    (void)pthread_mutex_unlock (render_world_lock);
+}
+
+
+/*
+ * render_thread
+ *   DESCRIPTION: Function executed by the render thread.  Runs commands
+ *                until it finds RC_STOP.  Whenever the queue is empty,
+ *                shows the screen; then, if a page is waiting for
+ *                vertical retrace, keeps polling for it (and for new
+ *                commands), yielding the processor between polls, and
+ *                otherwise sleeps until a command is queued.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: draws into the build buffer and video memory
+ */
+static void*
+render_thread (void* ignore)
+{
+    render_cmd_t cmd; /* command being run */
+
+    while (1) {
+	if (0 != sem_trywait (&queue_count)) {
+	    show_screen ();
+	    if (0 <= poll_page_flip ()) {
+		(void)sched_yield ();
+		continue;
+	    }
+	    while (0 != sem_wait (&queue_count) && EINTR == errno) {
+	    }
+	}
+
+	/* The count taken is for the oldest slot: wait until published. */
+	while (!dequeue_cmd (&cmd)) {
+	    (void)sched_yield ();
+	}
+	if (RC_STOP == cmd.op) {
+	    break;
+	}
+	run_cmd (&cmd);
+    }
+
+    /* Show the last frame drawn before stopping. */
+    show_screen ();
+    while (0 <= poll_page_flip ()) {
+	(void)sched_yield ();
+    }
+    return NULL;
+}
+
+
+/*
+ * start_render_thread
+ *   DESCRIPTION: Empty the command queue and start the render thread.
+ *                Mode X must already be set up.
+ *   INPUTS: world_lock -- lock held by the render thread while drawing
+ *                         from the world
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on failure
+ *   SIDE EFFECTS: creates a thread
+ */
+int32_t
+start_render_thread (pthread_mutex_t* world_lock)
+{
+    uint32_t idx; /* index over queue slots */
+
+    for (idx = 0; RENDER_QUEUE_LEN > idx; idx++) {
+	queue[idx].seq = idx;
+    }
+    queue_head = queue_tail = 0;
+    if (0 != sem_init (&queue_count, 0, 0)) {
+        return -1;
+    }
+    render_world_lock = world_lock;
+    view_x = view_y = 0;
+    if (0 != pthread_create (&render_thread_id, NULL, render_thread, NULL)) {
+	(void)sem_destroy (&queue_count);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*
+ * stop_render_thread
+ *   DESCRIPTION: Queue RC_STOP and wait for the render thread to finish
+ *                the commands before it and end.  Used as a cleanup
+ *                method to ensure proper shutdown.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: ends the render thread
+ */
+void
+stop_render_thread (void* ignore)
+{
+    render_cmd_t cmd; /* the stop command */
+
+    cmd.op = RC_STOP;
+    queue_cmd (&cmd);
+    (void)pthread_join (render_thread_id, NULL);
+    (void)sem_destroy (&queue_count);
+}
+
+
+/*
+ * render_enter_room
+ *   DESCRIPTION: Queue a command to prepare a room's palette and photo,
+ *                move the view window to (0,0), and draw the room.
+ *   INPUTS: r -- the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: queues a command
+ */
+void
+render_enter_room (const room_t* r)
+{
+    render_cmd_t cmd; /* the command */
+
+    cmd.op = RC_ENTER;
+    cmd.room = r;
+    queue_cmd (&cmd);
+}
+
+
+/*
+ * render_view
+ *   DESCRIPTION: Queue a command to move the view window and draw the
+ *                parts of it exposed.
+ *   INPUTS: (x,y) -- new upper left pixel of the view window
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: queues a command
+ */
+void
+render_view (int x, int y)
+{
+    render_cmd_t cmd; /* the command */
+
+    cmd.op = RC_VIEW;
+    cmd.x = x;
+    cmd.y = y;
+    queue_cmd (&cmd);
+}
+
+
+/*
+ * render_redraw
+ *   DESCRIPTION: Queue a command to draw the whole view window again.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: queues a command
+ */
+void
+render_redraw ()
+{
+    render_cmd_t cmd; /* the command */
+
+    cmd.op = RC_REDRAW;
+    queue_cmd (&cmd);
+}
+
+
+/*
+ * render_status
+ *   DESCRIPTION: Queue a command to draw text into the status bar.  The
+ *                text is copied (up to the width of the status bar).
+ *   INPUTS: text -- the text
+ *           mode -- the mode passed to show_status_bar
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: queues a command
+ */
+void
+render_status (const char* text, int mode)
+{
+    render_cmd_t cmd; /* the command */
+
+    cmd.op = RC_STATUS;
+    cmd.mode = mode;
+    strncpy (cmd.text, text, RENDER_TEXT_LEN);
+    cmd.text[RENDER_TEXT_LEN] = '\0';
+    queue_cmd (&cmd);
+}
@@ -0,0 +1,53 @@
+/*									tab:8
+ *
+ * render.h - render thread and its command queue header file
+ *
+ * Version:	    1
+ * Filename:	    render.h
+ * History:
+ *	1	First written.
+ */
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "world.h"
+
+
+/*
+ * Start the render thread, which draws into the mode X build buffer and
+ * shows it, and is the only thread to call modex.c once started.  Mode
+ * X must already be set up.  The thread holds world_lock while it
+ * reads the world (the room photo and objects) to draw; callers must
+ * hold it while changing the world, and must not hold it while queueing
+ * commands.  Returns 0 on success, or -1 on failure.
+ */
+extern int32_t start_render_thread (pthread_mutex_t* world_lock);
+
+/*
+ * Finish the commands queued and stop the render thread (argument
+ * ignored, for use with push_cleanup).
+ */
+extern void stop_render_thread (void* ignore);
+
+/*
+ * Commands for the render thread.  Any thread may queue them; each
+ * thread's commands are carried out in the order queued.
+ */
+
+/* draw a room (prepared with prep_room) with the view window at (0,0) */
+extern void render_enter_room (const room_t* r);
+
+/* move the view window to (x,y), drawing the parts of it exposed */
+extern void render_view (int x, int y);
+
+/* draw the whole view window again (after objects have changed) */
+extern void render_redraw (void);
+
+/* draw text into the status bar (see show_status_bar) */
+extern void render_status (const char* text, int mode);
+
+#endif /* RENDER_H */
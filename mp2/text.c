@@ -37,7 +37,7 @@
 
 #include "text.h"
 #include "modex.h"
-extern unsigned char text_image[5760];	/*5760 is the result of IMAGE_X_WIDTH*STATUS_BAR_HEIGHT*/
+unsigned char text_image[5760];	/*5760 is the result of IMAGE_X_WIDTH*STATUS_BAR_HEIGHT*/
 /* 
  * These font data were read out of video memory during text mode and
  * saved here.  They could be read in the same manner at the start of a
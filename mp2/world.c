@@ -34,8 +34,10 @@
  */
  
 
+#include <pthread.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
 
 #include "assert.h"
 #include "photo.h"
@@ -171,19 +173,87 @@ enum {
 };
 
 
+/*
+ * Room photos are loaded on demand and kept in memory only within a
+ * budget (photo_budget, in bytes of memory held by the photos, as 
+ * reported by photo_bytes, including copies by plane or column).  Each room 
+ * photo and swap photo has a slot that records its file name and size
+ * (read from the file header by build_world) and, when the photo is 
+ * resident, the photo itself.  Resident photos are kept on a list in
+ * order of use; when the budget is exceeded, the least recently used
+ * photos are freed, other than the photo of the room that the player 
+ * is in (the pinned slot), the photo just used, and the last photo that
+ * use_slot returned (the shown slot).  If a photo cannot be read during
+ * the game, use_slot reports the error in the status bar and returns
+ * the shown slot's photo instead; build_world reads the starting room's
+ * photo so that there is always one to fall back on.
+ *
+ * A background thread loads photos for rooms next to the player's room
+ * (see prefetch_room_photos) so that moving between rooms does not wait
+ * for the disk or for quantization.  All slot fields other than the file
+ * name and size are protected by photo_lock; photo_cv is signaled when
+ * a slot changes state.
+ *
+ * With a budget of 0, all photos are read (concurrently) by build_world
+ * and never freed.  In that case, each slot is filled by a pool of 
+ * threads that claim slots in turn using next_photo_job.
+ */
+#define PHOTO_BUDGET_DEFAULT (4 * 1024 * 1024)
+#define MAX_PHOTO_THREADS    16
+
+typedef enum {
+    SLOT_EMPTY,		/* photo not in memory                   */
+    SLOT_QUEUED,	/* photo waiting for prefetch thread     */
+    SLOT_LOADING,	/* photo being read by some thread       */
+    SLOT_READY,		/* photo in memory (and on the LRU list) */
+    SLOT_FAILED		/* photo could not be read (not retried) */
+} slot_state_t;
+
+typedef struct photo_slot_t photo_slot_t;
+struct photo_slot_t {
+    const char*   filename;	/* photo file                          */
+    uint32_t      width;	/* photo width in pixels               */
+    uint32_t      height;	/* photo height in pixels              */
+    slot_state_t  state;	/* whether photo is in memory          */
+    photo_t*      photo;	/* photo (SLOT_READY only)             */
+    uint32_t      bytes;	/* memory held by photo (SLOT_READY    */
+    				/*    only; see photo_bytes)           */
+    photo_slot_t* newer;	/* next more recently used photo       */
+    photo_slot_t* older;	/* next less recently used photo       */
+};
+
+
 /* types local to this file (declared in types.h) */
 
+/*
+ * Each room indexes its objects by the parts of the room photo that they
+ * cover, so that drawing a line of the photo need only look at objects
+ * near that line.  The rows of the photo are split into bands of 
+ * OBJ_BAND_SIZE rows, and the columns into bands of OBJ_BAND_SIZE 
+ * columns.  For each band, the room records a bit vector of the objects
+ * (one bit per object, by index into the object array) whose images
+ * overlap the band.
+ */
+#define OBJ_BAND_SHIFT 4
+#define OBJ_BAND_SIZE  (1 << OBJ_BAND_SHIFT)
+#define N_ROW_BANDS    (MAX_PHOTO_HEIGHT >> OBJ_BAND_SHIFT)
+#define N_COL_BANDS    (MAX_PHOTO_WIDTH >> OBJ_BAND_SHIFT)
+
 /*
  * The structure representing a room in the world.  The backpack/inventory 
  * is also a 'room' (#0, R_INVENTORY). 
  */
 struct room_t {
-    const char* name;		/* name of room                   */
-    photo_t*    view;		/* photo currently shown for room */
-    object_t*   contents; 	/* linked list of objects in room */
-    room_t*     left;   	/* room to the "left"             */
-    room_t*     enter;  	/* doors, etc.                    */
-    room_t*     right;  	/* room to the "right"            */
+    const char*   name;		/* name of room                   */
+    photo_slot_t* view;		/* photo currently shown for room */
+    object_t*     contents; 	/* linked list of objects in room */
+    room_t*       left;   	/* room to the "left"             */
+    room_t*       enter;  	/* doors, etc.                    */
+    room_t*       right;  	/* room to the "right"            */
+    uint32_t      row_objs[N_ROW_BANDS]; /* objects over each band   */
+    				/*    of rows (see OBJ_BAND_SIZE)  */
+    uint32_t      col_objs[N_COL_BANDS]; /* objects over each band   */
+    				/*    of columns                   */
 };
 
 /*
@@ -197,6 +267,8 @@ struct object_t {
     room_t*      loc;      	/* in what 'room'?                */
     uint16_t     x, y;    	/* location within room photo     */
     image_t*     img;     	/* image for use in room          */
+    uint32_t     placed;	/* when put into room (the newest */
+    				/*    object is first in room)    */
 };
 
 /*
@@ -424,14 +496,24 @@ static const swap_data_t swap_data[N_SWAPS] = {
 
 /* functions local to this file--see function headers for details */
 static void do_photo_swap (room_t* r, int32_t which);
+static void evict_photos (const photo_slot_t* keep);
 static object_t* find_in_room (const room_t* r, const char* arg);
 static void insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y);
 static void insert_object (object_t* o, room_t* r);
+static void index_object (object_t* o, int32_t add);
+static int32_t indexed_objects (uint32_t mask, object_t* objs[]);
 static void move_object_to_inventory (object_t* obj);
 static object_t* obj_special_get (room_t* r, const char* arg);
+static void lru_insert (photo_slot_t* slot);
+static void lru_remove (photo_slot_t* slot);
+static photo_t* load_slot (photo_slot_t* slot);
+static void* photo_worker (void* ignore);
 static int32_t player_flag_is_set (int32_t fnum);
 static void player_set_flag (int32_t fnum);
+static void* prefetch_thread (void* ignore);
+static void read_all_photos (void);
 static void remove_object (object_t* o);
+static photo_t* use_slot (photo_slot_t* slot);
 
 
 /* file-scope variables */
@@ -443,27 +525,85 @@ static void remove_object (object_t* o);
 static room_t   room[N_ROOMS];			     /* rooms                */
 static object_t object[N_OBJECTS];		     /* objects              */
 static uint32_t player_flags[(NUM_FLAGS + 31) / 32]; /* accomplishment flags */
-static photo_t* swap_photo[N_SWAPS];                 /* swapping photos      */
+static photo_slot_t* swap_photo[N_SWAPS];            /* swapping photos      */
+static uint32_t n_placed;			     /* objects put in rooms */
+
+/* room photo management (see the description of photo slots above) */
+static photo_slot_t photo_slot[N_ROOMS + N_SWAPS]; /* room, then swap photos */
+static photo_slot_t* lru_newest;	/* most recently used resident photo  */
+static photo_slot_t* lru_oldest;	/* least recently used resident photo */
+static photo_slot_t* pinned_slot;	/* photo of player's room             */
+static photo_slot_t* shown_slot;	/* last photo returned by use_slot    */
+static photo_slot_t* failed_slot;	/* last unreadable photo reported     */
+static uint32_t photo_budget = PHOTO_BUDGET_DEFAULT; /* 0 for no limit    */
+static uint32_t resident_bytes;		/* size of resident photos            */
+static int32_t  next_photo_job;		/* next slot for read_all_photos      */
+static int32_t  prefetch_started;	/* prefetch thread is running         */
+static pthread_t prefetch_thread_id;	/* prefetch thread                    */
+static pthread_mutex_t photo_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  photo_cv = PTHREAD_COND_INITIALIZER;
 
 
 /* 
  * do_photo_swap
- *   DESCRIPTION: Swap a room photo with another stored image.
+ *   DESCRIPTION: Swap a room photo with another stored image.  If the
+ *                room's photo was pinned (the room is the player's), the
+ *                photo swapped in is pinned instead, so that the photo
+ *                on display is never freed to make room for another.
  *   INPUTS: r -- the room into which the photo is swapped
  *	     which -- index into array of stored photos
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: may change the pinned slot
  */
 static void
 do_photo_swap (room_t* r, int32_t which)
 {
-    photo_t* tmp;	/* temporary variable to help with swap */
+    photo_slot_t* tmp;	/* temporary variable to help with swap */
 
     /* Swap the photos. */
+    (void)pthread_mutex_lock (&photo_lock);
     tmp               = r->view;
     r->view           = swap_photo[which];
     swap_photo[which] = tmp;
+    if (pinned_slot == tmp) {
+	pinned_slot = r->view;
+    }
+    (void)pthread_mutex_unlock (&photo_lock);
+}
+
+
+/* 
+ * evict_photos
+ *   DESCRIPTION: Free least recently used room photos until the resident
+ *                photos fit within the photo budget.  The pinned photo,
+ *                the shown photo, and the photo given are never freed,
+ *                so the budget may still be exceeded afterward.  Must
+ *                be called with photo_lock held.
+ *   INPUTS: keep -- a slot whose photo must not be freed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: frees photos and empties their slots
+ */
+static void
+evict_photos (const photo_slot_t* keep)
+{
+    photo_slot_t* victim; /* loop index over photos, oldest first */
+    photo_slot_t* newer;  /* next photo to consider               */
+
+    for (victim = lru_oldest; 
+	 NULL != victim && 0 != photo_budget && photo_budget < resident_bytes;
+	 victim = newer) {
+	newer = victim->newer;
+	if (keep == victim || pinned_slot == victim || shown_slot == victim) {
+	    continue;
+	}
+	lru_remove (victim);
+	resident_bytes -= victim->bytes;
+	free_photo (victim->photo);
+	victim->photo = NULL;
+	victim->state = SLOT_EMPTY;
+    }
 }
 
 
@@ -522,7 +662,9 @@ insert_object_at (object_t* o, room_t* r, int32_t x, int32_t y)
     /* Now add the object to the new room's contents. */
     o->loc = r;
     o->next = r->contents;
+    o->placed = n_placed++;
     r->contents = o;
+    index_object (o, 1);
 }
 
 
@@ -548,11 +690,11 @@ insert_object (object_t* o, room_t* r)
 
 
     /* Choose a random x location. */
-    range = photo_width (r->view) - image_width (o->img);
+    range = room_photo_width (r) - image_width (o->img);
     xpos = (0 >= range ? 0 : (rand () % range));
 
     /* Place in the lowest quarter of the roo photo if the object fits... */
-    space = photo_height (r->view);
+    space = room_photo_height (r);
     img_ht = image_height (o->img);
     range = space / 4 - img_ht;
     if (0 >= range) {
@@ -568,6 +710,163 @@ insert_object (object_t* o, room_t* r)
 }
 
 
+/* 
+ * index_object
+ *   DESCRIPTION: Add an object to, or remove it from, the index of its
+ *                room's objects by band of rows and columns (see 
+ *                OBJ_BAND_SIZE).
+ *   INPUTS: o -- the object, with its room and position set
+ *           add -- 1 to add the object, 0 to remove it
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the index of the object's room
+ */
+static void
+index_object (object_t* o, int32_t add)
+{
+    uint32_t bit;	/* the object's bit in the index        */
+    int32_t  band;	/* index over bands covered by object   */
+    int32_t  last;	/* last band covered by object          */
+
+    bit = (1UL << (o - object));
+    last = (o->y + image_height (o->img) - 1) >> OBJ_BAND_SHIFT;
+    if (N_ROW_BANDS <= last) {
+        last = N_ROW_BANDS - 1;
+    }
+    for (band = o->y >> OBJ_BAND_SHIFT; last >= band; band++) {
+	o->loc->row_objs[band] = (add ? o->loc->row_objs[band] | bit :
+				  o->loc->row_objs[band] & ~bit);
+    }
+    last = (o->x + image_width (o->img) - 1) >> OBJ_BAND_SHIFT;
+    if (N_COL_BANDS <= last) {
+        last = N_COL_BANDS - 1;
+    }
+    for (band = o->x >> OBJ_BAND_SHIFT; last >= band; band++) {
+	o->loc->col_objs[band] = (add ? o->loc->col_objs[band] | bit :
+				  o->loc->col_objs[band] & ~bit);
+    }
+}
+
+
+/* 
+ * indexed_objects
+ *   DESCRIPTION: List the objects in a bit vector from a room's object
+ *                index, in the same order as the room's contents list
+ *                (most recently placed first).
+ *   INPUTS: mask -- the bit vector
+ *   OUTPUTS: objs -- the objects
+ *   RETURN VALUE: number of objects
+ *   SIDE EFFECTS: none
+ */
+static int32_t
+indexed_objects (uint32_t mask, object_t* objs[])
+{
+    int32_t   n_objs;	/* number of objects found              */
+    int32_t   pos;	/* where new object goes in list        */
+    object_t* o;	/* object found in mask                 */
+
+    for (n_objs = 0; 0 != mask; mask &= mask - 1, n_objs++) {
+	o = &object[__builtin_ctz (mask)];
+
+	/* Insertion sort: there are few objects in any one room. */
+	for (pos = n_objs; 0 < pos && objs[pos - 1]->placed < o->placed; 
+	     pos--) {
+	    objs[pos] = objs[pos - 1];
+	}
+	objs[pos] = o;
+    }
+    return n_objs;
+}
+
+
+/* 
+ * load_slot
+ *   DESCRIPTION: Read the photo for an empty (or queued) slot, then make
+ *                it resident, freeing older photos if necessary.  Must 
+ *                be called with photo_lock held; the lock is released
+ *                while the photo is being read.
+ *   INPUTS: slot -- the slot to be filled
+ *   OUTPUTS: none
+ *   RETURN VALUE: the photo, or NULL if it could not be read (in which
+ *                 case the slot is marked so that it is not read again)
+ *   SIDE EFFECTS: changes slot state; signals photo_cv
+ */
+static photo_t*
+load_slot (photo_slot_t* slot)
+{
+    photo_t* p; /* photo read */
+
+    /* Other threads wait for us while we read the photo. */
+    slot->state = SLOT_LOADING;
+    (void)pthread_mutex_unlock (&photo_lock);
+    p = read_photo (slot->filename);
+    (void)pthread_mutex_lock (&photo_lock);
+
+    /* Make the photo resident and keep within the budget. */
+    if (NULL != p) {
+	slot->photo = p;
+	slot->state = SLOT_READY;
+	lru_insert (slot);
+	slot->bytes = photo_bytes (p);
+	resident_bytes += slot->bytes;
+	evict_photos (slot);
+    } else {
+	slot->state = SLOT_FAILED;
+    }
+    (void)pthread_cond_broadcast (&photo_cv);
+    return p;
+}
+
+
+/* 
+ * lru_insert
+ *   DESCRIPTION: Add a resident photo's slot to the LRU list as the most
+ *                recently used photo.  Must be called with photo_lock 
+ *                held.
+ *   INPUTS: slot -- the slot (not already on the list)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the LRU list
+ */
+static void
+lru_insert (photo_slot_t* slot)
+{
+    slot->newer = NULL;
+    slot->older = lru_newest;
+    if (NULL != lru_newest) {
+	lru_newest->newer = slot;
+    } else {
+	lru_oldest = slot;
+    }
+    lru_newest = slot;
+}
+
+
+/* 
+ * lru_remove
+ *   DESCRIPTION: Take a slot off of the LRU list.  Must be called with
+ *                photo_lock held.
+ *   INPUTS: slot -- the slot (on the list)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the LRU list
+ */
+static void
+lru_remove (photo_slot_t* slot)
+{
+    if (NULL != slot->newer) {
+	slot->newer->older = slot->older;
+    } else {
+	lru_newest = slot->older;
+    }
+    if (NULL != slot->older) {
+	slot->older->newer = slot->newer;
+    } else {
+	lru_oldest = slot->newer;
+    }
+}
+
+
 /* 
  * move_object_to_inventory
  *   DESCRIPTION: Move an object into the player's inventory.  Try to 
@@ -650,6 +949,42 @@ obj_special_get (room_t* r, const char* arg)
 }
 
 
+/* 
+ * photo_worker
+ *   DESCRIPTION: Read photos for build_world until every slot has been
+ *                claimed.  Run by each thread of the photo reading pool
+ *                (including the thread calling read_all_photos).
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills in photos in the photo_slot array
+ */
+static void*
+photo_worker (void* ignore)
+{
+    int32_t  job; /* index of slot claimed */
+    photo_t* p;   /* photo read            */
+
+    while (1) {
+	/* Claim the next slot, if any are left. */
+	(void)pthread_mutex_lock (&photo_lock);
+	job = next_photo_job++;
+	(void)pthread_mutex_unlock (&photo_lock);
+	if (N_ROOMS + N_SWAPS <= job) {
+	    return NULL;
+	}
+
+	/* Failure is reported later by build_world (slot stays empty). */
+	if (NULL != (p = read_photo (photo_slot[job].filename))) {
+	    photo_slot[job].width = photo_width (p);
+	    photo_slot[job].height = photo_height (p);
+	    photo_slot[job].photo = p;
+	    photo_slot[job].state = SLOT_READY;
+	}
+    }
+}
+
+
 /* 
  * player_flag_is_set
  *   DESCRIPTION: Checks whether the player has accomplished a specified task.
@@ -681,6 +1016,86 @@ player_set_flag (int32_t fnum)
 }
 
 
+/* 
+ * prefetch_thread
+ *   DESCRIPTION: Function executed by the photo prefetch helper thread.
+ *                Waits for slots to be queued by prefetch_room_photos,
+ *                then reads their photos one at a time.
+ *   INPUTS: none (ignored)
+ *   OUTPUTS: none
+ *   RETURN VALUE: NULL
+ *   SIDE EFFECTS: fills queued photo slots
+ */
+static void*
+prefetch_thread (void* ignore)
+{
+    int32_t idx; /* index over photo slots */
+
+    (void)pthread_mutex_lock (&photo_lock);
+    while (1) {
+	for (idx = 0; N_ROOMS + N_SWAPS > idx; idx++) {
+	    if (SLOT_QUEUED == photo_slot[idx].state) {
+		break;
+	    }
+	}
+	if (N_ROOMS + N_SWAPS == idx) {
+	    pthread_cond_wait (&photo_cv, &photo_lock);
+	} else {
+	    /* A failed prefetch is reported when the room is entered. */
+	    (void)load_slot (&photo_slot[idx]);
+	}
+    }
+
+    /* This code never executes. */
+    return NULL;
+}
+
+
+/* 
+ * read_all_photos
+ *   DESCRIPTION: Read every room photo and swap photo named in the photo
+ *                slot array, using one thread per processor.
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: fills in the photo_slot array (leaving empty any slot
+ *                 whose photo could not be read)
+ */
+static void
+read_all_photos ()
+{
+    pthread_t worker[MAX_PHOTO_THREADS]; /* helper threads             */
+    long      n_threads;		 /* number of threads to use   */
+    long      n_started;		 /* number of helpers started  */
+
+    /* Use one thread per processor, within reason. */
+    n_threads = sysconf (_SC_NPROCESSORS_ONLN);
+    if (1 > n_threads) {
+	n_threads = 1;
+    } else if (MAX_PHOTO_THREADS < n_threads) {
+	n_threads = MAX_PHOTO_THREADS;
+    }
+
+    /* 
+     * Start the helpers, then work alongside them.  If a helper can't be
+     * created, the remaining threads simply take on its share.
+     */
+    next_photo_job = 0;
+    for (n_started = 0; n_threads - 1 > n_started; n_started++) {
+	if (0 != pthread_create (&worker[n_started], NULL, photo_worker, 
+				 NULL)) {
+	    break;
+	}
+    }
+    (void)photo_worker (NULL);
+
+    /* Wait for the helpers to finish their last jobs. */
+    while (0 < n_started--) {
+	(void)pthread_join (worker[n_started], NULL);
+    }
+}
+
+
 /* 
  * remove_object
  *   DESCRIPTION: Take an object out of its current location, leaving it
@@ -699,6 +1114,7 @@ remove_object (object_t* o)
     if (NULL != o->loc) {
 
 	/* Remove from previous room (with safety check)... */
+	index_object (o, 0);
 	for (find = &o->loc->contents; NULL != *find; find = &(*find)->next) {
 	    if (o == *find) {
 		/* We found the predecessor!  Unlink the object. */
@@ -713,6 +1129,59 @@ remove_object (object_t* o)
 }
 
 
+/* 
+ * use_slot
+ *   DESCRIPTION: Get the photo for a slot, reading it if necessary (or
+ *                waiting for another thread that is reading it), and 
+ *                mark it as the most recently used photo.  If the photo
+ *                can no longer be read, the error is shown in the status
+ *                bar and the last photo returned is used again.
+ *   INPUTS: slot -- the photo slot
+ *   OUTPUTS: none
+ *   RETURN VALUE: the slot's photo, or the last photo returned if the 
+ *                 slot's photo cannot be read
+ *   SIDE EFFECTS: may read the photo and free other photos; may show
+ *                 a status message
+ */
+static photo_t*
+use_slot (photo_slot_t* slot)
+{
+    photo_t* p = NULL; /* the slot's photo            */
+    int32_t  report = 0; /* a new failure to report?  */
+
+    (void)pthread_mutex_lock (&photo_lock);
+    while (SLOT_LOADING == slot->state) {
+	pthread_cond_wait (&photo_cv, &photo_lock);
+    }
+    if (SLOT_READY == slot->state) {
+	p = slot->photo;
+	if (0 != photo_budget && lru_newest != slot) {
+	    lru_remove (slot);
+	    lru_insert (slot);
+	}
+    } else if (SLOT_FAILED != slot->state) {
+	p = load_slot (slot);
+    }
+
+    /* build_world reads a photo first, so there is one to fall back on. */
+    if (NULL != p) {
+	shown_slot = slot;
+	failed_slot = NULL;
+    } else {
+	ASSERT (NULL != shown_slot);
+	p = shown_slot->photo;
+	report = (failed_slot != slot);
+	failed_slot = slot;
+    }
+    (void)pthread_mutex_unlock (&photo_lock);
+
+    if (report) {
+	show_status ("Can't read this room's photo.");
+    }
+    return p;
+}
+
+
 /* 
  * obj_get_x
  *   DESCRIPTION: Get x position of object within containing room.
@@ -808,16 +1277,61 @@ room_name (const room_t* r)
 
 /* 
  * room_photo
- *   DESCRIPTION: Get room photo for a room.
+ *   DESCRIPTION: Get room photo for a room, reading it first if it is
+ *                not in memory.
  *   INPUTS: r -- pointer to the room
  *   OUTPUTS: none
  *   RETURN VALUE: a pointer to room r's photo
- *   SIDE EFFECTS: none
+ *   SIDE EFFECTS: may read the photo and free other photos; the photo
+ *                 returned remains valid until another photo is read
  */
 photo_t*
 room_photo (const room_t* r)
 {
-    return r->view;
+    return use_slot (r->view);
+}
+
+
+/* 
+ * room_row_objects
+ *   DESCRIPTION: Find the objects in a room whose images may cover a row 
+ *                of the room photo: those that cover the band of rows
+ *                (see OBJ_BAND_SIZE) that holds the row.  The objects 
+ *                are given in the same order as by room_contents_iterate.
+ *   INPUTS: r -- pointer to the room
+ *           y -- the row
+ *   OUTPUTS: objs -- the objects (at most MAX_LINE_OBJECTS)
+ *   RETURN VALUE: number of objects
+ *   SIDE EFFECTS: none
+ */
+int32_t
+room_row_objects (const room_t* r, int32_t y, object_t* objs[])
+{
+    if (0 > y || MAX_PHOTO_HEIGHT <= y) {
+        return 0;
+    }
+    return indexed_objects (r->row_objs[y >> OBJ_BAND_SHIFT], objs);
+}
+
+
+/* 
+ * room_col_objects
+ *   DESCRIPTION: Find the objects in a room whose images may cover a 
+ *                column of the room photo, as room_row_objects does for
+ *                rows.
+ *   INPUTS: r -- pointer to the room
+ *           x -- the column
+ *   OUTPUTS: objs -- the objects (at most MAX_LINE_OBJECTS)
+ *   RETURN VALUE: number of objects
+ *   SIDE EFFECTS: none
+ */
+int32_t
+room_col_objects (const room_t* r, int32_t x, object_t* objs[])
+{
+    if (0 > x || MAX_PHOTO_WIDTH <= x) {
+        return 0;
+    }
+    return indexed_objects (r->col_objs[x >> OBJ_BAND_SHIFT], objs);
 }
 
 
@@ -832,7 +1346,7 @@ room_photo (const room_t* r)
 uint32_t 
 room_photo_height (const room_t* r)
 {
-    return photo_height (r->view);
+    return r->view->height;
 }
 
 
@@ -847,15 +1361,111 @@ room_photo_height (const room_t* r)
 uint32_t 
 room_photo_width (const room_t* r)
 {
-    return photo_width (r->view);
+    return r->view->width;
+}
+
+
+/* 
+ * room_photo_grew
+ *   DESCRIPTION: Count memory that a room's photo has come to hold since
+ *                it was read (such as a column by column copy of its 
+ *                pixels) against the photo budget, freeing older photos
+ *                if necessary.
+ *   INPUTS: r -- pointer to the room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may free other photos
+ */
+void
+room_photo_grew (const room_t* r)
+{
+    photo_slot_t* slot = r->view; /* slot holding the room's photo */
+    uint32_t      bytes;          /* memory now held by the photo  */
+
+    (void)pthread_mutex_lock (&photo_lock);
+    if (0 != photo_budget && SLOT_READY == slot->state) {
+	bytes = photo_bytes (slot->photo);
+	resident_bytes += bytes - slot->bytes;
+	slot->bytes = bytes;
+	evict_photos (slot);
+    }
+    (void)pthread_mutex_unlock (&photo_lock);
+}
+
+
+/* 
+ * prefetch_room_photos
+ *   DESCRIPTION: Prepare photos for the player's room.  The photo of the
+ *                room is kept in memory while the player is there, and
+ *                the photos of the rooms to its left, right, and through
+ *                its 'enter' direction are read in the background.  Any
+ *                earlier requests that have not yet been started are 
+ *                dropped.
+ *   INPUTS: r -- the player's room
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may start the photo prefetch helper thread
+ */
+void
+prefetch_room_photos (const room_t* r)
+{
+    const room_t* next[3]; /* rooms reachable from r */
+    int32_t       idx;     /* index over rooms/slots */
+
+    (void)pthread_mutex_lock (&photo_lock);
+    pinned_slot = r->view;
+
+    /* Drop stale requests, then queue the neighbors' photos. */
+    for (idx = 0; N_ROOMS + N_SWAPS > idx; idx++) {
+	if (SLOT_QUEUED == photo_slot[idx].state) {
+	    photo_slot[idx].state = SLOT_EMPTY;
+	}
+    }
+    next[0] = r->left;
+    next[1] = r->enter;
+    next[2] = r->right;
+    for (idx = 0; 3 > idx; idx++) {
+	if (NULL != next[idx] && SLOT_EMPTY == next[idx]->view->state) {
+	    next[idx]->view->state = SLOT_QUEUED;
+	}
+    }
+
+    /* Start the helper thread the first time that it's needed. */
+    if (!prefetch_started && 
+	0 == pthread_create (&prefetch_thread_id, NULL, prefetch_thread, 
+			     NULL)) {
+	(void)pthread_detach (prefetch_thread_id);
+	prefetch_started = 1;
+    }
+    (void)pthread_cond_broadcast (&photo_cv);
+    (void)pthread_mutex_unlock (&photo_lock);
+}
+
+
+/* 
+ * set_photo_budget
+ *   DESCRIPTION: Set the amount of memory that resident room photos may
+ *                use.  Must be called before build_world.  With a budget
+ *                of 0, all photos are read by build_world and kept.
+ *   INPUTS: bytes -- the budget in bytes (see photo_bytes)
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void
+set_photo_budget (uint32_t bytes)
+{
+    photo_budget = bytes;
 }
 
 
 /* 
  * build_world
  *   DESCRIPTION: Builds and connects the rooms, creates objects, and 
- *                reads in all image data (could be done lazily with 
- *                caching instead).
+ *                reads in object images.  Room and swap photos are read
+ *                on demand within the photo budget, or all at once 
+ *                (concurrently; see read_all_photos) if there is no
+ *                budget.
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: 1 on success, or 0 on failure
@@ -864,12 +1474,45 @@ room_photo_width (const room_t* r)
 int32_t
 build_world ()
 {
-    int32_t idx;	/* index over data arrays   */
-    int32_t which;	/* id for current data item */
+    int32_t        idx;		/* index over data arrays     */
+    int32_t        which;	/* id for current data item   */
+    photo_header_t hdr;		/* size of a room/swap photo  */
+    const char*    obj_file[N_OBJECTS]; /* object image file names */
+    image_t*       obj_img[N_OBJECTS];  /* object images           */
+    uint32_t       bad_obj;	/* object image that failed   */
+
+    /* Room object indices hold one bit per object. */
+    ASSERT (MAX_LINE_OBJECTS >= N_OBJECTS && 32 >= MAX_LINE_OBJECTS);
 
     /* Clear all accomplishment flags. */
     (void)memset (player_flags, 0, sizeof (player_flags));
 
+    /* 
+     * Set up a slot for each room photo and swap photo.  Without a photo
+     * budget, read all of the photos now; otherwise, read only their
+     * sizes.  Errors are reported below (slots of unreadable photos are
+     * left with no size).
+     */
+    lru_newest = lru_oldest = pinned_slot = shown_slot = failed_slot = NULL;
+    resident_bytes = 0;
+    for (idx = 0; N_ROOMS + N_SWAPS > idx; idx++) {
+	photo_slot[idx].filename = (N_ROOMS > idx ? room_data[idx].filename :
+				    swap_data[idx - N_ROOMS].filename);
+	photo_slot[idx].width = 0;
+	photo_slot[idx].height = 0;
+	photo_slot[idx].state = SLOT_EMPTY;
+	photo_slot[idx].photo = NULL;
+	photo_slot[idx].bytes = 0;
+	if (0 != photo_budget && 
+	    read_photo_header (photo_slot[idx].filename, &hdr)) {
+	    photo_slot[idx].width = hdr.width;
+	    photo_slot[idx].height = hdr.height;
+	}
+    }
+    if (0 == photo_budget) {
+	read_all_photos ();
+    }
+
     /* Clear room data to enable sanity check for duplication. */
     (void)memset (room, 0, sizeof (room));
 
@@ -891,8 +1534,8 @@ build_world ()
 
 	/* Set up the room. */
         room[which].name = room_data[idx].name;
-	room[which].view = read_photo (room_data[idx].filename);
-	if (NULL == room[which].view) {
+	room[which].view = &photo_slot[idx];
+	if (0 == room[which].view->width) {
 	    fprintf (stderr, "Can't read room photo %s.\n", 
 	    	     room_data[idx].filename);
 	    return 0;
@@ -909,6 +1552,19 @@ build_world ()
     /* Clear object data to enable sanity check for duplication. */
     (void)memset (object, 0, sizeof (object));
 
+    /* 
+     * Read all of the object images together.  Images that fail are
+     * reported in the loop below; a lack of memory is reported here.
+     */
+    for (idx = 0; N_OBJECTS > idx; idx++) {
+        obj_file[idx] = obj_data[idx].filename;
+    }
+    bad_obj = read_obj_atlas (obj_file, N_OBJECTS, obj_img);
+    if (OBJ_ATLAS_NO_MEMORY == bad_obj) {
+	fputs ("Out of memory reading object photos.\n", stderr);
+	return 0;
+    }
+
     /* Loop over object data. */
     for (idx = 0; N_OBJECTS > idx; idx++) {
 
@@ -927,8 +1583,8 @@ build_world ()
 
 	/* Set up the object. */
         object[which].name = obj_data[idx].name;
-	object[which].img = read_obj_image (obj_data[idx].filename);
-	if (NULL == object[which].img) {
+	object[which].img = obj_img[idx];
+	if (bad_obj <= (uint32_t)idx) {
 	    fprintf (stderr, "Can't read object photo %s.\n", 
 	    	     obj_data[idx].filename);
 	    return 0;
@@ -968,20 +1624,78 @@ build_world ()
 	    return 0;
 	}
 
-	/* Read in the swap photo. */
-	swap_photo[which] = read_photo (swap_data[idx].filename);
-	if (NULL == swap_photo[which]) {
+	/* Set up the swap photo. */
+	swap_photo[which] = &photo_slot[N_ROOMS + idx];
+	if (0 == swap_photo[which]->width) {
 	    fprintf (stderr, "Can't read room photo %s.\n", 
 	    	     swap_data[idx].filename);
 	    return 0;
 	}
     }
 
+    /* 
+     * Read the starting room's photo now, so that an unreadable photo is
+     * found before the game starts, and so that use_slot always has a 
+     * photo to fall back on.
+     */
+    (void)pthread_mutex_lock (&photo_lock);
+    shown_slot = start_in_room ()->view;
+    if (SLOT_READY != shown_slot->state && NULL == load_slot (shown_slot)) {
+	shown_slot = NULL;
+    }
+    (void)pthread_mutex_unlock (&photo_lock);
+    if (NULL == shown_slot) {
+	fprintf (stderr, "Can't read room photo %s.\n", 
+		 start_in_room ()->view->filename);
+	return 0;
+    }
+
     /* Everything worked! */
     return 1;
 }
 
 
+/* 
+ * gather_objects
+ *   DESCRIPTION: Move objects (including any that are in limbo or
+ *                carried by the player) into one room, at random 
+ *                positions.  The game never does this; it lets the
+ *                drawing of a room crowded with objects be timed.
+ *   INPUTS: r -- the room
+ *           n_objs -- number of objects to move, starting from the
+ *                     first; all are moved if there are fewer
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the location of the objects
+ */
+void
+gather_objects (room_t* r, int32_t n_objs)
+{
+    int32_t idx; /* index over objects */
+
+    for (idx = 0; N_OBJECTS > idx && n_objs > idx; idx++) {
+        insert_object (&object[idx], r);
+    }
+}
+
+
+/* 
+ * nth_room
+ *   DESCRIPTION: Get a room by its place in the list of rooms, so that
+ *                every room can be visited (as when testing drawing).
+ *   INPUTS: n -- index of the room, starting from 0
+ *   OUTPUTS: none
+ *   RETURN VALUE: pointer to the room, or NULL if there are not that 
+ *                 many rooms
+ *   SIDE EFFECTS: none
+ */
+room_t*
+nth_room (int32_t n)
+{
+    return (0 <= n && N_ROOMS > n ? &room[n] : NULL);
+}
+
+
 /* 
  * start_in_room
  *   DESCRIPTION: Get a pointer to the room in which the player begins 
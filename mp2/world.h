@@ -39,20 +39,57 @@
 #include "types.h"
 
 
+/* most objects found by room_row_objects or room_col_objects */
+#define MAX_LINE_OBJECTS 32
+
+
 /* structure access functions */
 extern uint16_t obj_get_x (const object_t* obj);
 extern uint16_t obj_get_y (const object_t* obj);
 extern image_t* obj_image (const object_t* obj);
 extern object_t* obj_next (const object_t* obj);
 extern object_t* room_contents_iterate (const room_t* r);
+
+/* 
+ * Find the objects in a room that may cover a row or column of its photo,
+ * in the order given by room_contents_iterate.
+ */
+extern int32_t room_row_objects (const room_t* r, int32_t y, 
+				 object_t* objs[]);
+extern int32_t room_col_objects (const room_t* r, int32_t x, 
+				 object_t* objs[]);
 extern const char* room_name (const room_t* r);
 extern photo_t* room_photo (const room_t* r);
 extern uint32_t room_photo_height (const room_t* r);
 extern uint32_t room_photo_width (const room_t* r);
 
+/* 
+ * Count memory newly held by a room's photo (such as a column by column
+ * copy) against the photo budget.
+ */
+extern void room_photo_grew (const room_t* r);
+
+/* 
+ * Set memory budget for resident room photos (0 reads all photos up front
+ * and keeps them); call before build_world.
+ */
+extern void set_photo_budget (uint32_t bytes);
+
+/* Keep the room's photo in memory and read its neighbors' in background. */
+extern void prefetch_room_photos (const room_t* r);
+
 /* Build the game world.  Returns 0 on failure, or 1 on success. */
 extern int32_t build_world (void);
 
+/* 
+ * Move the first n_objs objects (every object, if there are fewer) into a
+ * room, as for timing the drawing of objects.
+ */
+extern void gather_objects (room_t* r, int32_t n_objs);
+
+/* Get the nth room (starting from 0), or NULL if there are fewer rooms. */
+extern room_t* nth_room (int32_t n);
+
 /* Get pointer to starting room for player. */
 extern room_t* start_in_room (void);
 